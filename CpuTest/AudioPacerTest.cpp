@@ -0,0 +1,130 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "DjeeDjay/Electron/AudioPacer.h"
+
+namespace DjeeDjay {
+
+namespace {
+
+constexpr int SampleRate = 44100;
+constexpr int FrameRate = 50;
+constexpr size_t BlockSize = 512;		// Samples taken by each consumer read
+constexpr int Seconds = 120;
+
+// An audio device that reads a block of samples at a time at its own rate. Time only passes
+// while the pacer sleeps, so the run is deterministic and takes no real time.
+class SimulatedConsumer final : public PacerClock
+{
+public:
+	explicit SimulatedConsumer(double rate) :
+		m_rate(rate),
+		m_ring(nullptr),
+		m_blocks(0),
+		m_block(BlockSize)
+	{
+	}
+
+	void Ring(SampleRing& ring)
+	{
+		m_ring = &ring;
+	}
+
+	Clock::time_point Now() override
+	{
+		return m_now;
+	}
+
+	void SleepUntil(Clock::time_point time) override
+	{
+		for (auto read = ReadTime(); read <= time; read = ReadTime())
+		{
+			m_now = read;
+			m_ring->Read(m_block.data(), m_block.size());
+			++m_blocks;
+		}
+		m_now = std::max(m_now, time);
+	}
+
+private:
+	Clock::time_point ReadTime() const
+	{
+		std::chrono::duration<double> offset(static_cast<double>(m_blocks * BlockSize) / m_rate);
+		return Clock::time_point(std::chrono::duration_cast<Clock::duration>(offset));
+	}
+
+	double m_rate;
+	SampleRing* m_ring;
+	uint64_t m_blocks;
+	std::vector<int16_t> m_block;
+	Clock::time_point m_now;
+};
+
+// Runs the emulation side as the Electron does: every frame synthesises its samples at the
+// resampling ratio of the pacer and queues them
+bool TestConsumerRate(double drift)
+{
+	SimulatedConsumer consumer(SampleRate * (1 + drift));
+	AudioPacer pacer(16384, 2048, consumer);
+	consumer.Ring(pacer.Ring());
+	pacer.Reset(SampleRate);
+
+	std::vector<int16_t> samples;
+	double pending = 0;
+	int frames = Seconds * FrameRate;
+	size_t minSize = pacer.Ring().Capacity();
+	size_t maxSize = 0;
+	uint64_t underruns = 0;
+	AudioPacer::Clock::time_point start;
+	double ratioSum = 0;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		pending += pacer.Ratio() * SampleRate / FrameRate;
+		samples.resize(static_cast<size_t>(pending));
+		pending -= static_cast<double>(samples.size());
+		pacer.Pace(samples.data(), samples.size());
+
+		// The first half settles the ratio, each rate measurement is only accurate to a consumer block
+		if (frame == frames / 2)
+		{
+			underruns = pacer.Ring().Underruns();
+			start = consumer.Now();
+		}
+		if (frame >= frames / 2)
+		{
+			ratioSum += pacer.Ratio();
+			minSize = std::min(minSize, pacer.Ring().Size());
+			maxSize = std::max(maxSize, pacer.Ring().Size());
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(consumer.Now() - start).count();
+	double frameRate = (frames - frames / 2) / seconds;
+	double ratio = ratioSum / (frames - frames / 2);
+	underruns = pacer.Ring().Underruns() - underruns;
+	bool pass = std::abs(ratio - (1 + drift)) < 0.001 &&
+		std::abs(frameRate - FrameRate) < 0.1 &&
+		minSize + 2 * BlockSize >= pacer.LowWater() && maxSize <= pacer.LowWater() &&
+		underruns == 0;
+
+	std::cout << "Consumer rate " << 1 + drift << ": ratio " << ratio << ", " << frameRate << " frames/s"
+		<< ", ring " << minSize << ".." << maxSize << " (low water " << pacer.LowWater() << ")"
+		<< ", " << underruns << " underruns: " << (pass ? "pass" : "FAIL") << "\n";
+	return pass;
+}
+
+} // namespace
+
+// The pacer must follow a consumer that runs off the nominal sample rate with its resampling ratio,
+// so the frame rate stays nominal while the ring stays just below the low water mark
+bool TestAudioPacer()
+{
+	bool fast = TestConsumerRate(0.01);
+	bool slow = TestConsumerRate(-0.01);
+	return fast && slow;
+}
+
+} // namespace DjeeDjay
@@ -10,7 +10,9 @@
 
 namespace DjeeDjay {
 
-class CpuTester : public Memory
+bool TestAudioPacer();
+
+class CpuTester final : public Memory
 {
 public:
 	explicit CpuTester(const std::vector<uint8_t>& code) :
@@ -63,7 +65,7 @@ public:
 
 private:
 	std::array<uint8_t, 64 * 1024> m_memory;
-	MOS6502 m_cpu;
+	BasicMOS6502<CpuTester> m_cpu;
 	bool m_stop;
 };
 
@@ -84,6 +86,7 @@ void TestCpu(const char* filename, bool trace)
 void Syntax()
 {
 	std::cout << "Syntax: CpuTest [--trace] <ImageFile>\n";
+	std::cout << "        CpuTest --audio-pacer\n";
 }
 
 } // namespace DjeeDjay
@@ -94,16 +97,21 @@ try
 	using namespace DjeeDjay;
 
 	bool trace = false;
+	bool audioPacer = false;
 	const char* filename = nullptr;
 
 	while (*++argv)
 	{
 		if (argv[0] == std::string("--trace"))
 			trace = true;
+		else if (argv[0] == std::string("--audio-pacer"))
+			audioPacer = true;
 		else
 			filename = argv[0];
 	}
 
+	if (audioPacer)
+		return TestAudioPacer() ? EXIT_SUCCESS : EXIT_FAILURE;
 	if (filename)
 		TestCpu(filename, trace);
 	else
@@ -0,0 +1,187 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <algorithm>
+#include <thread>
+#include "DjeeDjay/Electron/AudioPacer.h"
+
+namespace DjeeDjay {
+
+namespace {
+
+constexpr AudioPacer::Clock::duration MaxWait = std::chrono::milliseconds(100);
+
+// The consumer rate is measured over RateInterval and smoothed, the ratio stays within MaxDrift of 1
+constexpr AudioPacer::Clock::duration RateInterval = std::chrono::seconds(2);
+constexpr double MaxDrift = 0.02;
+
+class SteadyPacerClock final : public PacerClock
+{
+public:
+	Clock::time_point Now() override
+	{
+		return Clock::now();
+	}
+
+	void SleepUntil(Clock::time_point time) override
+	{
+		std::this_thread::sleep_until(time);
+	}
+};
+
+PacerClock& SteadyClock()
+{
+	static SteadyPacerClock clock;
+	return clock;
+}
+
+} // namespace
+
+SampleRing::SampleRing(size_t capacity) :
+	m_samples(capacity + 1),
+	m_head(0),
+	m_tail(0),
+	m_read(0),
+	m_underruns(0)
+{
+}
+
+size_t SampleRing::Capacity() const
+{
+	return m_samples.size() - 1;
+}
+
+size_t SampleRing::Size() const
+{
+	size_t head = m_head.load(std::memory_order_acquire);
+	size_t tail = m_tail.load(std::memory_order_acquire);
+	return tail >= head ? tail - head : tail + m_samples.size() - head;
+}
+
+uint64_t SampleRing::SamplesRead() const
+{
+	return m_read;
+}
+
+uint64_t SampleRing::Underruns() const
+{
+	return m_underruns;
+}
+
+size_t SampleRing::Write(const int16_t* samples, size_t count)
+{
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	size_t head = m_head.load(std::memory_order_acquire);
+	size_t space = (head > tail ? head - tail : head + m_samples.size() - tail) - 1;
+	count = std::min(count, space);
+
+	size_t first = std::min(count, m_samples.size() - tail);
+	std::copy(samples, samples + first, m_samples.begin() + tail);
+	std::copy(samples + first, samples + count, m_samples.begin());
+	m_tail.store((tail + count) % m_samples.size(), std::memory_order_release);
+	return count;
+}
+
+size_t SampleRing::Read(int16_t* samples, size_t count)
+{
+	size_t head = m_head.load(std::memory_order_relaxed);
+	size_t tail = m_tail.load(std::memory_order_acquire);
+	size_t size = tail >= head ? tail - head : tail + m_samples.size() - head;
+	size_t n = std::min(count, size);
+
+	size_t first = std::min(n, m_samples.size() - head);
+	std::copy(m_samples.begin() + head, m_samples.begin() + head + first, samples);
+	std::copy(m_samples.begin(), m_samples.begin() + (n - first), samples + first);
+	m_head.store((head + n) % m_samples.size(), std::memory_order_release);
+
+	std::fill(samples + n, samples + count, static_cast<int16_t>(0));
+	m_read += count;
+	if (n < count)
+		++m_underruns;
+	return n;
+}
+
+AudioPacer::AudioPacer(size_t capacity, size_t lowWater) :
+	AudioPacer(capacity, lowWater, SteadyClock())
+{
+}
+
+AudioPacer::AudioPacer(size_t capacity, size_t lowWater, PacerClock& clock) :
+	m_clock(clock),
+	m_ring(capacity),
+	m_lowWater(lowWater),
+	m_sampleRate(44100),
+	m_late(false),
+	m_ratio(1),
+	m_rateRead(0)
+{
+	Reset(m_sampleRate);
+}
+
+SampleRing& AudioPacer::Ring()
+{
+	return m_ring;
+}
+
+void AudioPacer::LowWater(size_t samples)
+{
+	m_lowWater = std::min(samples, m_ring.Capacity());
+}
+
+size_t AudioPacer::LowWater() const
+{
+	return m_lowWater;
+}
+
+void AudioPacer::Reset(int sampleRate)
+{
+	m_sampleRate = sampleRate;
+	m_ratio = 1;
+	m_rateTime = m_clock.Now();
+	m_rateRead = m_ring.SamplesRead();
+}
+
+// Sleeps for the time the consumer needs to bring the ring down to the low water mark
+void AudioPacer::Pace(const int16_t* samples, size_t count)
+{
+	m_late = m_ring.Size() < m_lowWater;
+	m_ring.Write(samples, count);
+
+	auto timeout = m_clock.Now() + MaxWait;
+	for (;;)
+	{
+		size_t size = m_ring.Size();
+		auto now = m_clock.Now();
+		if (size < m_lowWater || now >= timeout)
+			break;
+		auto wait = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(static_cast<double>(size - m_lowWater + 1) / m_sampleRate));
+		m_clock.SleepUntil(std::min(now + std::max<Clock::duration>(wait, std::chrono::milliseconds(1)), timeout));
+	}
+
+	MeasureRate();
+}
+
+bool AudioPacer::Late() const
+{
+	return m_late;
+}
+
+double AudioPacer::Ratio() const
+{
+	return m_ratio;
+}
+
+void AudioPacer::MeasureRate()
+{
+	auto now = m_clock.Now();
+	std::chrono::duration<double> elapsed = now - m_rateTime;
+	if (now - m_rateTime < RateInterval)
+		return;
+
+	uint64_t read = m_ring.SamplesRead();
+	double rate = static_cast<double>(read - m_rateRead) / elapsed.count() / m_sampleRate;
+	m_ratio = std::min(std::max(0.75 * m_ratio + 0.25 * rate, 1 - MaxDrift), 1 + MaxDrift);
+	m_rateTime = now;
+	m_rateRead = read;
+}
+
+} // namespace DjeeDjay
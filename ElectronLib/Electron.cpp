@@ -1,10 +1,11 @@
 // (C) Copyright Gert-Jan de Vos 2021.
 
 #include <cassert>
+#include <algorithm>
 #include <iomanip>
-#include <thread>
 #include "DjeeDjay/ToHexString.h"
 #include "DjeeDjay/Electron.h"
+#include "DjeeDjay/Electron/SaveState.h"
 
 namespace DjeeDjay {
 
@@ -74,122 +75,776 @@ KeyboardBit ToKeyboardBit(ElectronKey key)
 	}
 }
 
+constexpr int MaxRunAhead = 8;
+
+// The OS start up takes this long to reach the BASIC prompt
+constexpr uint64_t BootCycles = 450'000;
+
+// FNV-1a
+uint64_t Hash(uint64_t hash, const uint8_t* data, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ data[i]) * 0x100000001b3;
+	return hash;
+}
+
 } // namespace
 
-Electron::Electron(const std::vector<uint8_t>& rom) :
+HostCommand HostCommand::KeyDown(ElectronKey key)
+{
+	return { HostCommandType::KeyDown, key, 0, 0, 0, {} };
+}
+
+HostCommand HostCommand::KeyUp(ElectronKey key)
+{
+	return { HostCommandType::KeyUp, key, 0, 0, 0, {} };
+}
+
+HostCommand HostCommand::Break()
+{
+	return { HostCommandType::Break, ElectronKey::None, 0, 0, 0, {} };
+}
+
+HostCommand HostCommand::Restart()
+{
+	return { HostCommandType::Restart, ElectronKey::None, 0, 0, 0, {} };
+}
+
+HostCommand HostCommand::InstallRom(int bank, std::vector<uint8_t> rom)
+{
+	return { HostCommandType::InstallRom, ElectronKey::None, bank, 0, 0, std::move(rom) };
+}
+
+HostCommand HostCommand::Speed(double multiplier)
+{
+	return { HostCommandType::Speed, ElectronKey::None, 0, multiplier, 0, {} };
+}
+
+HostCommand HostCommand::RunAhead(int frames)
+{
+	return { HostCommandType::RunAhead, ElectronKey::None, 0, 0, frames, {} };
+}
+
+HostCommand HostCommand::Stop()
+{
+	return { HostCommandType::Stop, ElectronKey::None, 0, 0, 0, {} };
+}
+
+template <typename Policy>
+BasicElectron<Policy>::BasicElectron(const std::vector<uint8_t>& rom) :
 	m_cpu(*this),
-	m_ula(m_cpu)
+	m_ram(),
+	m_ramCode(0x80),
+	m_osCode(0x40),
+	m_memoryMap(m_cpu),
+	m_ula(m_cpu, m_memoryMap, m_scheduler),
+	m_renderWorker(2, 4),
+	m_frameEnded(false),
+	m_rendering(FrameRendering::Always),
+	m_frameRequested(false),
+	m_frameSkip(0),
+	m_skippedFrames(0),
+	m_rateCycles(0),
+	m_rateFrames(0),
+	m_mhz(0),
+	m_fps(0),
+	m_runAhead(0),
+	m_pacingDeferred(false),
+	m_runningAhead(false),
+	m_runAheadState(),
+	m_runAheadTime(0),
+	m_runAheadCost(0),
+	m_synthesizer(44100),
+	m_clock(ClockSource::Wall),
+	m_audioPacer(16384, 2048),
+	m_commands(256)
 {
 	if (rom.size() != 0x4000)
 		throw std::runtime_error("Bad ROM size");
 	std::copy(rom.begin(), rom.end(), m_os.begin());
+
+	m_memoryMap.MapRam(0x00, 0x80, m_ram.data(), m_ramCode.data());
+	m_memoryMap.MapRom(0xc0, 0x3e, m_os.data(), m_osCode.data());
+	m_memoryMap.MapRom(0xff, 0x01, m_os.data() + 0x3f00, m_osCode.data() + 0x3f);
+
+	m_ula.ConnectScreen(m_ram.data());
+	m_ula.FrameEnd([this]() { CompleteFrame(); });
+	m_cpu.RamWritten([this](uint16_t address, int size) { m_ula.ScreenWritten(address, size); });
+	m_cpu.DirectWrites(Ula::MinScreenAddress);
+}
+
+template <typename Policy>
+Policy& BasicElectron<Policy>::Instrumentation()
+{
+	return m_cpu.Instrumentation();
+}
+
+template <typename Policy>
+const Policy& BasicElectron<Policy>::Instrumentation() const
+{
+	return m_cpu.Instrumentation();
 }
 
-void Electron::InstallRom(int bank, std::vector<uint8_t> rom)
+template <typename Policy>
+void BasicElectron<Policy>::InstallRom(int bank, std::vector<uint8_t> rom)
 {
 	m_ula.InstallRom(bank, std::move(rom));
 }
 
-void Electron::Restart()
+template <typename Policy>
+void BasicElectron<Policy>::Restart()
 {
 	m_cpu.Reset(true);
 	m_ula.Restart();
 	m_cpu.Step();
 	m_cpu.Reset(false);
-	m_startTime = std::chrono::steady_clock::now();
-	m_oneMhzCycles = 0;
+	ResetPacing();
+	ResetSound();
 }
 
-void Electron::Break()
+template <typename Policy>
+void BasicElectron<Policy>::Break()
 {
 	m_cpu.Reset(true);
 	m_ula.Reset();
 	m_cpu.Step();
 	m_cpu.Reset(false);
-	m_startTime = std::chrono::steady_clock::now();
-	m_oneMhzCycles = 0;
+	ResetPacing();
+	ResetSound();
 }
 
-void Electron::KeyDown(ElectronKey key)
+template <typename Policy>
+void BasicElectron<Policy>::KeyDown(ElectronKey key)
 {
 	m_ula.KeyDown(ToKeyboardBit(key));
 }
 
-void Electron::KeyUp(ElectronKey key)
+template <typename Policy>
+void BasicElectron<Policy>::KeyUp(ElectronKey key)
 {
 	m_ula.KeyUp(ToKeyboardBit(key));
 }
 
-void Electron::Trace(TraceEvent slot)
+template <typename Policy>
+bool BasicElectron<Policy>::Post(HostCommand&& command)
+{
+	return m_commands.Push(std::move(command));
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::Trace(TraceEvent slot)
 {
 	m_ula.Trace(slot);
 	m_trace = slot;
 }
 
-void Electron::FrameCompleted(FrameCompletedEvent slot)
+template <typename Policy>
+void BasicElectron<Policy>::FrameCompleted(FrameCompletedEvent slot)
+{
+	m_renderWorker.FrameCompleted(slot);
+}
+
+template <typename Policy>
+const Frame* BasicElectron<Policy>::ReceiveFrame()
+{
+	return m_renderWorker.ReceiveFrame();
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::ReleaseFrame(const Frame* frame)
 {
-	m_frameCompleted = slot;
+	m_renderWorker.ReleaseFrame(frame);
 }
 
-void Electron::CapsLock(CapsLockEvent slot)
+template <typename Policy>
+void BasicElectron<Policy>::CapsLock(CapsLockEvent slot)
 {
 	m_ula.CapsLock(slot);
 }
 
-void Electron::CassetteMotor(CassetteMotorEvent slot)
+template <typename Policy>
+void BasicElectron<Policy>::CassetteMotor(CassetteMotorEvent slot)
 {
 	m_ula.CassetteMotor(slot);
 }
 
-bool Electron::CapsLock() const
+template <typename Policy>
+bool BasicElectron<Policy>::CapsLock() const
 {
 	return m_ula.CapsLock();
 }
 
-bool Electron::CassetteMotor() const
+template <typename Policy>
+bool BasicElectron<Policy>::CassetteMotor() const
 {
 	return m_ula.CassetteMotor();
 }
 
-void Electron::Speaker(SpeakerEvent slot)
+template <typename Policy>
+void BasicElectron<Policy>::Sound(SoundEvent slot)
+{
+	m_sound = slot;
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::Translation(TranslationMode mode)
 {
-	return m_ula.Speaker(slot);
+	m_cpu.Translation(mode);
+}
+
+template <typename Policy>
+TranslationMode BasicElectron<Policy>::Translation() const
+{
+	return m_cpu.Translation();
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::IdleSkipping(bool enable)
+{
+	m_cpu.IdleSkipping(enable);
+}
+
+template <typename Policy>
+bool BasicElectron<Policy>::IdleSkipping() const
+{
+	return m_cpu.IdleSkipping();
+}
+
+template <typename Policy>
+uint64_t BasicElectron<Policy>::IdleCycles() const
+{
+	return m_cpu.IdleCycles();
 }
 
 using CpuCycles = std::chrono::duration<uint64_t, std::ratio<1, 2'000'000>>;
 
-void Electron::Step()
+constexpr uint64_t FrameCycles = 312 * 64 * 2;
+
+template <typename Policy>
+void BasicElectron<Policy>::Rendering(FrameRendering mode)
+{
+	m_rendering = mode;
+}
+
+template <typename Policy>
+FrameRendering BasicElectron<Policy>::Rendering() const
+{
+	return m_rendering;
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::RequestFrame()
+{
+	m_frameRequested = true;
+}
+
+template <typename Policy>
+uint64_t BasicElectron<Policy>::SkippedFrames() const
+{
+	return m_skippedFrames;
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::Speed(double multiplier)
+{
+	m_pacer.Speed(multiplier);
+	m_pacer.Reset(m_ula.ElapsedCycles());
+}
+
+template <typename Policy>
+double BasicElectron<Policy>::Speed() const
 {
-	m_ula.UpdateTimers();
-	if (m_ula.ReadyForNextFrame())
+	return m_pacer.Speed();
+}
+
+template <typename Policy>
+double BasicElectron<Policy>::Mhz() const
+{
+	return m_mhz;
+}
+
+template <typename Policy>
+double BasicElectron<Policy>::FramesPerSecond() const
+{
+	return m_fps;
+}
+
+template <typename Policy>
+PacingStatistics BasicElectron<Policy>::Pacing() const
+{
+	return m_pacer.Statistics();
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::SampleRate(int rate)
+{
+	m_synthesizer = SoundSynthesizer(rate);
+	m_audioPacer.Reset(rate);
+	ResetSound();
+}
+
+template <typename Policy>
+int BasicElectron<Policy>::SampleRate() const
+{
+	return m_synthesizer.SampleRate();
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::Clock(ClockSource source)
+{
+	m_clock = source;
+	m_synthesizer.Ratio(1);
+	m_audioPacer.Reset(m_synthesizer.SampleRate());
+	m_pacer.Reset(m_ula.ElapsedCycles());
+}
+
+template <typename Policy>
+ClockSource BasicElectron<Policy>::Clock() const
+{
+	return m_clock;
+}
+
+template <typename Policy>
+SampleRing& BasicElectron<Policy>::AudioOutput()
+{
+	return m_audioPacer.Ring();
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::AudioLowWater(size_t samples)
+{
+	m_audioPacer.LowWater(samples);
+}
+
+// Turning run-ahead off redraws the whole screen, the last drawn frame was one from ahead
+template <typename Policy>
+void BasicElectron<Policy>::RunAhead(int frames)
+{
+	m_runAhead = std::min(std::max(frames, 0), MaxRunAhead);
+	if (m_runAhead == 0)
+		m_ula.InvalidateScreen();
+}
+
+template <typename Policy>
+int BasicElectron<Policy>::RunAhead() const
+{
+	return m_runAhead;
+}
+
+template <typename Policy>
+double BasicElectron<Policy>::RunAheadCost() const
+{
+	return m_runAheadCost;
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::Save(ElectronSnapshot& snapshot) const
+{
+	m_cpu.Save(snapshot.cpu);
+	m_ula.Save(snapshot.ula);
+	snapshot.ram = m_ram;
+}
+
+// Compares page by page, so decoded code and screen lines survive in the pages that did not change
+template <typename Policy>
+void BasicElectron<Policy>::Restore(const ElectronSnapshot& snapshot)
+{
+	m_cpu.Restore(snapshot.cpu);
+	m_ula.Restore(snapshot.ula);
+	for (int page = 0; page < 0x80; ++page)
+	{
+		auto from = snapshot.ram.begin() + page * 0x100;
+		auto to = m_ram.begin() + page * 0x100;
+		if (std::equal(from, from + 0x100, to))
+			continue;
+
+		std::copy(from, from + 0x100, to);
+		m_ramCode[page].Invalidate(0, 0xff);
+		if (page >= Ula::MinScreenAddress >> 8)
+			m_ula.ScreenWritten(static_cast<uint16_t>(page << 8), 0x100);
+	}
+}
+
+template <typename Policy>
+uint64_t BasicElectron<Policy>::RomHash() const
+{
+	uint64_t hash = Hash(0xcbf29ce484222325, m_os.data(), m_os.size());
+	const auto& roms = m_ula.Roms();
+	for (size_t bank = 0; bank < roms.size(); ++bank)
+	{
+		if (roms[bank].empty())
+			continue;
+		uint8_t bankNr = static_cast<uint8_t>(bank);
+		hash = Hash(hash, &bankNr, 1);
+		hash = Hash(hash, roms[bank].data(), roms[bank].size());
+	}
+	return hash;
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::SaveState(const std::string& filename) const
+{
+	ElectronSnapshot snapshot;
+	Save(snapshot);
+	SaveStateFile(filename, WriteSaveState(snapshot, RomHash()));
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::LoadState(const std::string& filename)
+{
+	ElectronSnapshot snapshot;
+	if (ReadSaveState(LoadStateFile(filename), snapshot) != RomHash())
+		throw std::runtime_error("Save state of another ROM set");
+	Restore(snapshot);
+	m_ula.InvalidateScreen();
+	ResetPacing();
+	ResetSound();
+}
+
+// A cached state that cannot be loaded is replaced by a cold start.
+// The start up runs whole frames without pacing, so the state is saved at a frame end.
+template <typename Policy>
+void BasicElectron<Policy>::Boot(const std::string& cacheDirectory)
+{
+	std::string filename;
+	if (!cacheDirectory.empty())
+	{
+		filename = cacheDirectory + "/" + ToLowerHexString(RomHash()) + ".state";
+		try
+		{
+			LoadState(filename);
+			return;
+		}
+		catch (std::runtime_error&)
+		{
+		}
+	}
+
+	Restart();
+	m_pacingDeferred = true;
+	bool completed = true;
+	while (m_cpu.Cycles() < BootCycles && completed)
 	{
-		m_ula.GenerateFrame(m_ram.data(), m_image);
-		m_frameCompleted(m_image);
-		std::this_thread::sleep_until(m_startTime + CpuCycles(m_cpu.Cycles() + m_oneMhzCycles + m_ula.OneMHzCycles() + m_ula.VideoCycles()));
+		m_frameEnded = false;
+		while (!m_frameEnded && completed)
+			completed = RunSlice(Scheduler::Never);
 	}
+	m_pacingDeferred = false;
+	ResetPacing();
+	if (!completed || filename.empty())
+		return;
+
+	// The cache only saves time, a cold start that cannot be cached still succeeds
+	try
+	{
+		SaveState(filename);
+	}
+	catch (std::runtime_error&)
+	{
+	}
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::Step()
+{
+	m_scheduler.Dispatch(m_cpu.Cycles());
 	m_cpu.Step();
 }
 
-uint8_t Electron::Read(uint16_t address)
+template <typename Policy>
+RunResult BasicElectron<Policy>::RunFor(uint64_t cycles)
 {
-	if (address < 0x8000)
-		return m_ram[address];
-	else if (address < 0xc000)
-		return m_ula.ReadRom(address);
+	uint64_t start = m_cpu.Cycles();
+	if (!ExecuteCommands())
+		return { 0, StopReason::Stopped };
+	uint64_t end = start + cycles;
+	while (m_cpu.Cycles() < end)
+	{
+		if (!RunSlice(end))
+			return { m_cpu.Cycles() - start, StopReason::Breakpoint };
+	}
+	return { m_cpu.Cycles() - start, StopReason::CycleLimit };
+}
+
+template <typename Policy>
+RunResult BasicElectron<Policy>::RunUntilFrameEnd()
+{
+	uint64_t start = m_cpu.Cycles();
+	if (!ExecuteCommands())
+		return { 0, StopReason::Stopped };
+	m_frameEnded = false;
+	m_pacingDeferred = m_runAhead > 0;
+	bool completed = true;
+	while (!m_frameEnded && completed)
+		completed = RunSlice(Scheduler::Never);
+	if (m_frameEnded && m_pacingDeferred)
+		RunAheadFrames(PaceFrame());
+	m_pacingDeferred = false;
+	return { m_cpu.Cycles() - start, completed ? StopReason::FrameEnd : StopReason::Breakpoint };
+}
+
+// The predicate is evaluated after every instruction, posted commands at every event
+template <typename Policy>
+RunResult BasicElectron<Policy>::RunUntil(std::function<bool ()> predicate)
+{
+	uint64_t start = m_cpu.Cycles();
+	for (;;)
+	{
+		if (!ExecuteCommands())
+			return { m_cpu.Cycles() - start, StopReason::Stopped };
+		uint64_t limit = m_scheduler.NextEventCycle();
+		while (m_cpu.Cycles() < limit)
+		{
+			if (m_cpu.Instrumentation().Break(m_cpu.PC(), m_cpu.Cycles()))
+				return { m_cpu.Cycles() - start, StopReason::Breakpoint };
+			m_cpu.Step();
+			if (predicate())
+				return { m_cpu.Cycles() - start, StopReason::Predicate };
+		}
+		m_scheduler.Dispatch(m_cpu.Cycles());
+	}
+}
+
+// Returns false on a Stop command, later commands stay queued
+template <typename Policy>
+bool BasicElectron<Policy>::ExecuteCommands()
+{
+	HostCommand command;
+	while (m_commands.Pop(command))
+	{
+		switch (command.type)
+		{
+		case HostCommandType::KeyDown:
+			KeyDown(command.key);
+			break;
+		case HostCommandType::KeyUp:
+			KeyUp(command.key);
+			break;
+		case HostCommandType::Break:
+			Break();
+			break;
+		case HostCommandType::Restart:
+			Restart();
+			break;
+		case HostCommandType::InstallRom:
+			InstallRom(command.bank, std::move(command.rom));
+			Break();
+			break;
+		case HostCommandType::Speed:
+			Speed(command.speed);
+			break;
+		case HostCommandType::RunAhead:
+			RunAhead(command.frames);
+			break;
+		case HostCommandType::Stop:
+			return false;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+// Runs instructions up to the next scheduled event or endCycle and then dispatches the due events.
+// Returns false when the CPU stopped at a breakpoint.
+template <typename Policy>
+bool BasicElectron<Policy>::RunSlice(uint64_t endCycle)
+{
+	bool completed = m_cpu.Run(std::min(m_scheduler.NextEventCycle(), endCycle));
+	m_scheduler.Dispatch(m_cpu.Cycles());
+	return completed;
+}
+
+// Frames that run ahead are only drawn, the last of them when the real frame is to be drawn.
+// The real frames are not captured while running ahead, RunAheadFrames() counts their skips.
+template <typename Policy>
+void BasicElectron<Policy>::CompleteFrame()
+{
+	m_frameEnded = true;
+	ScreenFrame frame = m_ula.GenerateFrame();
+	if (m_ula.CaptureScreen())
+		m_renderWorker.Submit(std::move(frame));
+	else if (!m_runningAhead && !m_pacingDeferred)
+		++m_skippedFrames;
+	if (m_runningAhead)
+		return;
+
+	GenerateSound();
+	if (!m_pacingDeferred)
+		m_ula.CaptureScreen(PaceFrame());
+}
+
+// Waits for the clock and returns whether the next frame is drawn
+template <typename Policy>
+bool BasicElectron<Policy>::PaceFrame()
+{
+	auto now = std::chrono::steady_clock::now();
+	MeasureRate(now);
+	bool draw;
+	if (m_clock == ClockSource::Audio)
+	{
+		m_audioPacer.Pace(m_samples.data(), m_samples.size());
+		m_synthesizer.Ratio(m_audioPacer.Ratio());
+		draw = RenderNextFrame(m_audioPacer.Late());
+	}
+	else if (m_pacer.Speed() > 0)
+	{
+		draw = RenderNextFrame(now > m_pacer.Deadline(m_ula.ElapsedCycles()));
+		m_pacer.Wait(m_ula.ElapsedCycles());
+	}
+	else
+	{
+		// Unthrottled, draw at most one frame per real frame time
+		draw = RenderNextFrame(now < m_drawTime + CpuCycles(FrameCycles));
+	}
+	if (draw)
+		m_drawTime = now;
+	return draw;
+}
+
+// The real machine never captures the screen while running ahead. The shown frame comes from a
+// state the renderer has not seen, so it is drawn in full. A breakpoint ends the frames ahead early.
+template <typename Policy>
+void BasicElectron<Policy>::RunAheadFrames(bool draw)
+{
+	auto start = std::chrono::steady_clock::now();
+	Save(m_runAheadState);
+	m_runningAhead = true;
+	bool completed = true;
+	for (int i = 1; i <= m_runAhead && completed; ++i)
+	{
+		bool last = i == m_runAhead;
+		if (last && draw)
+			m_ula.InvalidateScreen();
+		m_ula.CaptureScreen(last && draw);
+		m_frameEnded = false;
+		while (!m_frameEnded && completed)
+			completed = RunSlice(Scheduler::Never);
+	}
+	m_runningAhead = false;
+	Restore(m_runAheadState);
+	m_ula.CaptureScreen(false);
+	if (!draw)
+		++m_skippedFrames;
+	m_frameEnded = true;
+
+	// The speaker changes ahead are heard when the real machine gets there
+	SpeakerChange change;
+	while (m_ula.ReadSpeaker(change))
+	{
+	}
+	m_runAheadTime += std::chrono::steady_clock::now() - start;
+}
+
+// Decides at the end of a frame whether the ULA captures the next frame for drawing
+template <typename Policy>
+bool BasicElectron<Policy>::RenderNextFrame(bool late)
+{
+	// Automatic skipping still draws every MaxFrameSkip + 1th frame, unless unthrottled
+	constexpr int MaxFrameSkip = 4;
+
+	switch (m_rendering)
+	{
+	case FrameRendering::OnRequest:
+		return m_frameRequested.exchange(false);
+	case FrameRendering::Auto:
+		if (late && (m_frameSkip < MaxFrameSkip || m_pacer.Speed() == 0))
+		{
+			++m_frameSkip;
+			return false;
+		}
+		m_frameSkip = 0;
+		return true;
+	default:
+		return true;
+	}
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::ResetPacing()
+{
+	m_pacer.Reset(m_ula.ElapsedCycles());
+	m_rateTime = std::chrono::steady_clock::now();
+	m_rateCycles = m_ula.ElapsedCycles();
+	m_rateFrames = 0;
+}
+
+// Logged speaker changes from before a reset have a time base that no longer applies
+template <typename Policy>
+void BasicElectron<Policy>::ResetSound()
+{
+	SpeakerChange change;
+	while (m_ula.ReadSpeaker(change))
+	{
+	}
+	m_synthesizer.Reset(m_ula.ElapsedCycles());
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::GenerateSound()
+{
+	m_samples.clear();
+	SpeakerChange change;
+	while (m_ula.ReadSpeaker(change))
+		m_synthesizer.Change(change, m_samples);
+	m_synthesizer.Generate(m_ula.ElapsedCycles(), m_samples);
+	if (m_sound && !m_samples.empty())
+		m_sound(m_samples.data(), m_samples.size());
+}
+
+template <typename Policy>
+void BasicElectron<Policy>::MeasureRate(std::chrono::steady_clock::time_point now)
+{
+	++m_rateFrames;
+	std::chrono::duration<double> elapsed = now - m_rateTime;
+	if (elapsed.count() < 1)
+		return;
+
+	uint64_t cycles = m_ula.ElapsedCycles();
+	m_mhz = static_cast<double>(cycles - m_rateCycles) / elapsed.count() / 1e6;
+	m_fps = static_cast<double>(m_rateFrames) / elapsed.count();
+	m_runAheadCost = std::chrono::duration<double, std::micro>(m_runAheadTime).count() / static_cast<double>(m_rateFrames);
+	m_runAheadTime = std::chrono::steady_clock::duration(0);
+	m_rateTime = now;
+	m_rateCycles = cycles;
+	m_rateFrames = 0;
+}
+
+template <typename Policy>
+uint8_t BasicElectron<Policy>::Read(uint16_t address)
+{
+	if (auto page = m_memoryMap.ReadPage(address))
+		return page[address & 0xff];
 	else if (address >= 0xfe00 && address < 0xff00)
-		return m_ula.Read(address);
+	{
+		uint8_t value = m_ula.Read(address);
+		m_cpu.Instrumentation().IoRead(address, value);
+		return value;
+	}
 	else
-		return m_os[address - 0xc000];
+		return m_ula.ReadRom(address);
 }
 
-void Electron::Write(uint16_t address, uint8_t value)
+template <typename Policy>
+void BasicElectron<Policy>::Write(uint16_t address, uint8_t value)
 {
-	if (address < 0x8000)
-		m_ram[address] = value;
+	if (auto page = m_memoryMap.WritePage(address))
+	{
+		page[address & 0xff] = value;
+		m_cpu.InvalidateCode(address);
+		if (address >= Ula::MinScreenAddress)
+			m_ula.ScreenWritten(address, 1);
+	}
 	else if (address >= 0xfe00 && address < 0xff00)
-		return m_ula.Write(address, value);
+	{
+		m_cpu.Instrumentation().IoWrite(address, value);
+		m_ula.Write(address, value);
+	}
 	else
 		m_trace("Invalid write " + ToHexString(address) + ", " + ToHexString(value) + "\n");
 }
 
+template class BasicElectron<FastPolicy>;
+template class BasicElectron<DebugPolicy>;
+
 } // namespace DjeeDjay
@@ -0,0 +1,191 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include "DjeeDjay/Electron/FramePacer.h"
+
+namespace DjeeDjay {
+
+namespace {
+
+using CpuCycles = std::chrono::duration<uint64_t, std::ratio<1, 2'000'000>>;
+
+constexpr FramePacer::Clock::duration StallTime = std::chrono::milliseconds(100);
+
+// The spin time never drops below MinSpinTime, a coarse OS timer is not spun out beyond MaxSpinTime
+constexpr FramePacer::Clock::duration MinSpinTime = std::chrono::microseconds(200);
+constexpr FramePacer::Clock::duration MaxSpinTime = std::chrono::milliseconds(4);
+
+int64_t Microseconds(FramePacer::Clock::duration value)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(value).count();
+}
+
+} // namespace
+
+Histogram::Histogram(int64_t first, int64_t bucketWidth, int buckets) :
+	m_first(first),
+	m_bucketWidth(bucketWidth),
+	m_counts(static_cast<size_t>(buckets))
+{
+	if (bucketWidth <= 0 || buckets <= 0)
+		throw std::invalid_argument("Bad histogram");
+	Clear();
+}
+
+void Histogram::Add(int64_t value)
+{
+	int64_t bucket = value < m_first ? 0 : std::min<int64_t>((value - m_first) / m_bucketWidth, Buckets() - 1);
+	++m_counts[static_cast<size_t>(bucket)];
+	m_min = m_samples == 0 ? value : std::min(m_min, value);
+	m_max = m_samples == 0 ? value : std::max(m_max, value);
+	m_sum += value;
+	++m_samples;
+}
+
+void Histogram::Clear()
+{
+	std::fill(m_counts.begin(), m_counts.end(), 0);
+	m_samples = 0;
+	m_min = 0;
+	m_max = 0;
+	m_sum = 0;
+}
+
+int Histogram::Buckets() const
+{
+	return static_cast<int>(m_counts.size());
+}
+
+int64_t Histogram::BucketStart(int bucket) const
+{
+	return m_first + bucket * m_bucketWidth;
+}
+
+uint64_t Histogram::Count(int bucket) const
+{
+	return m_counts.at(static_cast<size_t>(bucket));
+}
+
+uint64_t Histogram::Samples() const
+{
+	return m_samples;
+}
+
+int64_t Histogram::Min() const
+{
+	return m_min;
+}
+
+int64_t Histogram::Max() const
+{
+	return m_max;
+}
+
+double Histogram::Mean() const
+{
+	return m_samples == 0 ? 0 : static_cast<double>(m_sum) / static_cast<double>(m_samples);
+}
+
+PacingStatistics::PacingStatistics() :
+	lateness(0, 100, 32),
+	drift(-1600, 100, 32),
+	stalls(0)
+{
+}
+
+FramePacer::FramePacer() :
+	m_speed(1),
+	m_startTime(Clock::now()),
+	m_startCycles(0),
+	m_spinTime(std::chrono::milliseconds(1)),
+	m_previous(false)
+{
+}
+
+void FramePacer::Speed(double multiplier)
+{
+	if (multiplier < 0)
+		throw std::invalid_argument("Bad speed");
+	m_speed = multiplier;
+}
+
+double FramePacer::Speed() const
+{
+	return m_speed;
+}
+
+void FramePacer::Reset(uint64_t cycles)
+{
+	m_startTime = Clock::now();
+	m_startCycles = cycles;
+	m_previous = false;
+}
+
+// Unthrottled, every deadline is the start time
+FramePacer::Clock::time_point FramePacer::Deadline(uint64_t cycles) const
+{
+	if (m_speed == 0)
+		return m_startTime;
+	return m_startTime + std::chrono::duration_cast<Clock::duration>(CpuCycles(cycles - m_startCycles) / m_speed);
+}
+
+void FramePacer::Wait(uint64_t cycles)
+{
+	if (m_speed == 0)
+		return;
+
+	auto deadline = Deadline(cycles);
+	if (Clock::now() > deadline + StallTime)
+	{
+		Reset(cycles);
+		std::lock_guard<std::mutex> lock(m_mtx);
+		++m_statistics.stalls;
+		return;
+	}
+
+	Sleep(deadline);
+	auto wake = Clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_statistics.lateness.Add(Microseconds(wake - deadline));
+	if (m_previous)
+		m_statistics.drift.Add(Microseconds((wake - m_previousWake) - (deadline - m_previousDeadline)));
+	m_previous = true;
+	m_previousWake = wake;
+	m_previousDeadline = deadline;
+}
+
+PacingStatistics FramePacer::Statistics() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_statistics;
+}
+
+void FramePacer::ClearStatistics()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_statistics = PacingStatistics();
+}
+
+// Sleeps until m_spinTime before the deadline and spins from there.
+// The spin time follows an increase of the oversleep at once and a decrease slowly.
+void FramePacer::Sleep(Clock::time_point deadline)
+{
+	auto sleepEnd = deadline - m_spinTime;
+	if (Clock::now() < sleepEnd)
+	{
+		std::this_thread::sleep_until(sleepEnd);
+		auto oversleep = Clock::now() - sleepEnd;
+		if (oversleep + oversleep / 4 > m_spinTime)
+			m_spinTime = std::min(oversleep + oversleep / 4, MaxSpinTime);
+		else
+			m_spinTime = std::max(m_spinTime - (m_spinTime - oversleep) / 16, MinSpinTime);
+	}
+
+	while (Clock::now() < deadline)
+		std::this_thread::yield();
+}
+
+} // namespace DjeeDjay
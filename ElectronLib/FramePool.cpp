@@ -0,0 +1,47 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include "DjeeDjay/Electron/FramePool.h"
+
+namespace DjeeDjay {
+
+FramePool::FramePool(size_t size) :
+	m_frames(size),
+	m_free(size),
+	m_published(size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		m_frames[i].changes = ScreenChanges();
+		m_frames[i].serial = 0;
+		m_free.Push(i);
+	}
+}
+
+size_t FramePool::Size() const
+{
+	return m_frames.size();
+}
+
+Frame* FramePool::Acquire()
+{
+	size_t index;
+	return m_free.Pop(index) ? &m_frames[index] : nullptr;
+}
+
+void FramePool::Publish(Frame* frame)
+{
+	m_published.Push(static_cast<size_t>(frame - m_frames.data()));
+}
+
+const Frame* FramePool::Receive()
+{
+	size_t index;
+	return m_published.Pop(index) ? &m_frames[index] : nullptr;
+}
+
+void FramePool::Release(const Frame* frame)
+{
+	m_free.Push(static_cast<size_t>(frame - m_frames.data()));
+}
+
+} // namespace DjeeDjay
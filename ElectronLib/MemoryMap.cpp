@@ -0,0 +1,48 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include "DjeeDjay/MOS6502.h"
+#include "DjeeDjay/Electron/MemoryMap.h"
+
+namespace DjeeDjay {
+
+MemoryMap::MemoryMap(MOS6502State& cpu) :
+	m_cpu(cpu)
+{
+	m_read.fill(nullptr);
+	m_write.fill(nullptr);
+}
+
+void MemoryMap::MapRom(int firstPage, int pageCount, const uint8_t* data, DecodedPage* code)
+{
+	for (int i = 0; i < pageCount; ++i)
+	{
+		m_read[firstPage + i] = data + 0x100 * i;
+		m_write[firstPage + i] = nullptr;
+		m_cpu.MapCode(firstPage + i, code + i, true);
+		m_cpu.MapRom(firstPage + i, data + 0x100 * i);
+	}
+}
+
+void MemoryMap::MapRam(int firstPage, int pageCount, uint8_t* data, DecodedPage* code)
+{
+	for (int i = 0; i < pageCount; ++i)
+	{
+		m_read[firstPage + i] = data + 0x100 * i;
+		m_write[firstPage + i] = data + 0x100 * i;
+		m_cpu.MapCode(firstPage + i, code + i, false);
+		m_cpu.MapRam(firstPage + i, data + 0x100 * i);
+	}
+}
+
+void MemoryMap::Unmap(int firstPage, int pageCount)
+{
+	for (int i = 0; i < pageCount; ++i)
+	{
+		m_read[firstPage + i] = nullptr;
+		m_write[firstPage + i] = nullptr;
+		m_cpu.MapCode(firstPage + i, nullptr, false);
+		m_cpu.MapRam(firstPage + i, nullptr);
+	}
+}
+
+} // namespace DjeeDjay
@@ -0,0 +1,132 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <algorithm>
+#include "DjeeDjay/Electron/RenderWorker.h"
+
+namespace DjeeDjay {
+
+namespace {
+
+// Changes of older frames are not kept, a pool frame that is further behind is copied completely
+constexpr size_t HistorySize = 64;
+
+void Merge(ScreenChanges& changes, const ScreenChanges& next)
+{
+	if (next.firstLine == next.lastLine)
+		return;
+	changes.firstLine = changes.firstLine == changes.lastLine ? next.firstLine : std::min(changes.firstLine, next.firstLine);
+	changes.lastLine = std::max(changes.lastLine, next.lastLine);
+	changes.rows |= next.rows;
+}
+
+} // namespace
+
+RenderWorker::RenderWorker(size_t queueSize, size_t poolSize) :
+	m_serial(0),
+	m_history(HistorySize),
+	m_unpublished(),
+	m_pool(poolSize),
+	m_queueSize(queueSize),
+	m_busy(false),
+	m_stop(false),
+	m_thread([this]() { Run(); })
+{
+}
+
+// Frames that are still queued are drawn before the worker stops
+RenderWorker::~RenderWorker()
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_stop = true;
+	lock.unlock();
+	m_cv.notify_all();
+	m_thread.join();
+}
+
+void RenderWorker::FrameCompleted(FrameCompletedEvent slot)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_frameCompleted = slot;
+}
+
+void RenderWorker::Submit(ScreenFrame frame)
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_cv.wait(lock, [this]() { return m_queue.size() < m_queueSize; });
+	m_queue.push_back(std::move(frame));
+	lock.unlock();
+	m_cv.notify_all();
+}
+
+void RenderWorker::Flush()
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_cv.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+}
+
+const Frame* RenderWorker::ReceiveFrame()
+{
+	return m_pool.Receive();
+}
+
+void RenderWorker::ReleaseFrame(const Frame* frame)
+{
+	m_pool.Release(frame);
+}
+
+void RenderWorker::Run()
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	for (;;)
+	{
+		m_cv.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+		if (m_queue.empty())
+			return;
+
+		ScreenFrame screen = std::move(m_queue.front());
+		m_queue.pop_front();
+		FrameCompletedEvent frameCompleted = m_frameCompleted;
+		m_busy = true;
+		lock.unlock();
+		m_cv.notify_all();
+
+		m_renderer.Render(screen, m_image);
+		++m_serial;
+		m_history[m_serial % m_history.size()] = screen.changes;
+		Merge(m_unpublished, screen.changes);
+		if (Frame* frame = m_pool.Acquire())
+		{
+			CopyChangedLines(*frame);
+			frame->changes = m_unpublished;
+			frame->serial = m_serial;
+			m_unpublished = ScreenChanges();
+			m_pool.Publish(frame);
+			if (frameCompleted)
+				frameCompleted();
+		}
+
+		lock.lock();
+		m_busy = false;
+		m_cv.notify_all();
+	}
+}
+
+// Copies the lines that changed since frame was last published from the drawn image
+void RenderWorker::CopyChangedLines(Frame& frame) const
+{
+	if (frame.serial == 0 || m_serial - frame.serial > m_history.size() ||
+		frame.image.Width() != m_image.Width() || frame.image.Height() != m_image.Height())
+	{
+		frame.image = m_image;
+		return;
+	}
+
+	ScreenChanges changes = ScreenChanges();
+	for (uint64_t serial = frame.serial + 1; serial <= m_serial; ++serial)
+		Merge(changes, m_history[serial % m_history.size()]);
+	int width = m_image.Width();
+	std::copy(m_image.Data() + changes.firstLine * width, m_image.Data() + changes.lastLine * width, frame.image.Data() + changes.firstLine * width);
+	frame.image.Palette(m_image.Palette());
+}
+
+} // namespace DjeeDjay
@@ -0,0 +1,238 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include "DjeeDjay/ToHexString.h"
+#include "DjeeDjay/Electron/SaveState.h"
+
+#if defined(_WIN32)
+#	include <windows.h>
+#endif // _WIN32
+
+namespace DjeeDjay {
+
+namespace {
+
+const char Magic[4] = { 'E', 'L', 'S', 'S' };
+
+void WriteDataFile(const std::string& filename, const std::vector<uint8_t>& data)
+{
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("Cannot create " + filename);
+	file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+	file.close();
+	if (file.fail())
+		throw std::runtime_error("Save state write failed");
+}
+
+bool RenameOver(const std::string& from, const std::string& to)
+{
+#if defined(_WIN32)
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif // _WIN32
+}
+
+class StateWriter
+{
+public:
+	explicit StateWriter(std::vector<uint8_t>& data) :
+		m_data(data)
+	{
+	}
+
+	void Bytes(const uint8_t* data, size_t size)
+	{
+		m_data.insert(m_data.end(), data, data + size);
+	}
+
+	void U8(uint8_t value)
+	{
+		m_data.push_back(value);
+	}
+
+	template <typename T>
+	void LittleEndian(T value, int size)
+	{
+		for (int i = 0; i < size; ++i)
+			m_data.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+	}
+
+private:
+	std::vector<uint8_t>& m_data;
+};
+
+class StateReader
+{
+public:
+	explicit StateReader(const std::vector<uint8_t>& data) :
+		m_data(data),
+		m_pos(0)
+	{
+	}
+
+	void Bytes(uint8_t* data, size_t size)
+	{
+		Check(size);
+		std::copy(m_data.begin() + m_pos, m_data.begin() + m_pos + size, data);
+		m_pos += size;
+	}
+
+	uint8_t U8()
+	{
+		Check(1);
+		return m_data[m_pos++];
+	}
+
+	uint64_t LittleEndian(int size)
+	{
+		Check(size);
+		uint64_t value = 0;
+		for (int i = 0; i < size; ++i)
+			value |= static_cast<uint64_t>(m_data[m_pos++]) << (8 * i);
+		return value;
+	}
+
+	bool AtEnd() const
+	{
+		return m_pos == m_data.size();
+	}
+
+private:
+	void Check(size_t size) const
+	{
+		if (m_data.size() - m_pos < size)
+			throw std::runtime_error("Save state truncated");
+	}
+
+	const std::vector<uint8_t>& m_data;
+	size_t m_pos;
+};
+
+} // namespace
+
+std::vector<uint8_t> WriteSaveState(const ElectronSnapshot& snapshot, uint64_t romHash)
+{
+	std::vector<uint8_t> data;
+	data.reserve(0x8100);
+	StateWriter writer(data);
+	writer.Bytes(reinterpret_cast<const uint8_t*>(Magic), sizeof(Magic));
+	writer.LittleEndian(SaveStateVersion, 4);
+	writer.LittleEndian(romHash, 8);
+
+	const MOS6502Snapshot& cpu = snapshot.cpu;
+	writer.LittleEndian(cpu.cycle, 8);
+	writer.LittleEndian(cpu.pc, 2);
+	writer.U8(cpu.a);
+	writer.U8(cpu.x);
+	writer.U8(cpu.y);
+	writer.U8(cpu.s);
+	writer.U8(cpu.p);
+	writer.U8(cpu.pending);
+
+	const UlaSnapshot& ula = snapshot.ula;
+	writer.Bytes(ula.keyboard.data(), ula.keyboard.size());
+	writer.LittleEndian(ula.oneMHzCycles, 8);
+	writer.LittleEndian(ula.videoCycles, 8);
+	writer.LittleEndian(ula.nextFrameCycle, 8);
+	writer.LittleEndian(ula.nextRtcCycle, 8);
+	writer.U8(ula.nmi);
+	writer.U8(ula.irqStatus);
+	writer.U8(ula.irqEnable);
+	writer.U8(ula.screenLow);
+	writer.U8(ula.screenHigh);
+	writer.U8(static_cast<uint8_t>(ula.romBankIndex));
+	writer.U8(ula.counter);
+	writer.U8(ula.miscControl);
+	writer.Bytes(ula.palette.data(), ula.palette.size());
+	writer.LittleEndian(ula.imageWidth, 4);
+	writer.LittleEndian(ula.frameStart, 4);
+
+	writer.Bytes(snapshot.ram.data(), snapshot.ram.size());
+	return data;
+}
+
+uint64_t ReadSaveState(const std::vector<uint8_t>& data, ElectronSnapshot& snapshot)
+{
+	StateReader reader(data);
+	uint8_t magic[sizeof(Magic)];
+	reader.Bytes(magic, sizeof(magic));
+	if (!std::equal(std::begin(magic), std::end(magic), reinterpret_cast<const uint8_t*>(Magic)))
+		throw std::runtime_error("Not a save state");
+	if (reader.LittleEndian(4) != SaveStateVersion)
+		throw std::runtime_error("Unsupported save state version");
+	uint64_t romHash = reader.LittleEndian(8);
+
+	MOS6502Snapshot& cpu = snapshot.cpu;
+	cpu.cycle = reader.LittleEndian(8);
+	cpu.pc = static_cast<uint16_t>(reader.LittleEndian(2));
+	cpu.a = reader.U8();
+	cpu.x = reader.U8();
+	cpu.y = reader.U8();
+	cpu.s = reader.U8();
+	cpu.p = reader.U8();
+	cpu.pending = reader.U8();
+
+	UlaSnapshot& ula = snapshot.ula;
+	reader.Bytes(ula.keyboard.data(), ula.keyboard.size());
+	ula.oneMHzCycles = reader.LittleEndian(8);
+	ula.videoCycles = reader.LittleEndian(8);
+	ula.nextFrameCycle = reader.LittleEndian(8);
+	ula.nextRtcCycle = reader.LittleEndian(8);
+	ula.nmi = reader.U8() != 0;
+	ula.irqStatus = reader.U8();
+	ula.irqEnable = reader.U8();
+	ula.screenLow = reader.U8();
+	ula.screenHigh = reader.U8();
+	ula.romBankIndex = reader.U8();
+	ula.counter = reader.U8();
+	ula.miscControl = reader.U8();
+	reader.Bytes(ula.palette.data(), ula.palette.size());
+	ula.imageWidth = static_cast<int>(reader.LittleEndian(4));
+	ula.frameStart = static_cast<size_t>(reader.LittleEndian(4));
+	ula.dirtyLines.set();
+	ula.capturedLines = 0;
+	ula.frame = ScreenFrame();
+
+	reader.Bytes(snapshot.ram.data(), snapshot.ram.size());
+	if (!reader.AtEnd())
+		throw std::runtime_error("Bad save state size");
+	if (ula.romBankIndex > 15)
+		throw std::runtime_error("Bad save state ROM bank");
+	return romHash;
+}
+
+// The state is written to a temporary file that is renamed over filename, so a reader never sees
+// a partial file. The temporary name is unique, concurrent writers of the same file do not collide.
+void SaveStateFile(const std::string& filename, const std::vector<uint8_t>& data)
+{
+	std::random_device random;
+	std::string temporary = filename + "." + ToLowerHexString(random()) + ".tmp";
+	try
+	{
+		WriteDataFile(temporary, data);
+		if (!RenameOver(temporary, filename))
+			throw std::runtime_error("Cannot replace " + filename);
+	}
+	catch (std::runtime_error&)
+	{
+		std::remove(temporary.c_str());
+		throw;
+	}
+}
+
+std::vector<uint8_t> LoadStateFile(const std::string& filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("Cannot open " + filename);
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+} // namespace DjeeDjay
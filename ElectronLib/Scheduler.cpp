@@ -0,0 +1,72 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <algorithm>
+#include "DjeeDjay/Electron/Scheduler.h"
+
+namespace DjeeDjay {
+
+int Scheduler::Register(EventHandler handler)
+{
+	m_events.push_back(Event{ std::move(handler), 0, false });
+	return static_cast<int>(m_events.size() - 1);
+}
+
+void Scheduler::Schedule(int event, uint64_t cycle)
+{
+	auto& ev = m_events[event];
+	++ev.generation;
+	ev.scheduled = true;
+	m_heap.push_back(Entry{ cycle, event, ev.generation });
+	std::push_heap(m_heap.begin(), m_heap.end(), Later);
+	PopStale();
+}
+
+void Scheduler::Cancel(int event)
+{
+	auto& ev = m_events[event];
+	++ev.generation;
+	ev.scheduled = false;
+	PopStale();
+}
+
+uint64_t Scheduler::NextEventCycle() const
+{
+	return m_heap.empty() ? Never : m_heap.front().cycle;
+}
+
+void Scheduler::Dispatch(uint64_t cycle)
+{
+	while (!m_heap.empty() && m_heap.front().cycle <= cycle)
+	{
+		auto entry = m_heap.front();
+		std::pop_heap(m_heap.begin(), m_heap.end(), Later);
+		m_heap.pop_back();
+
+		auto& ev = m_events[entry.event];
+		ev.scheduled = false;
+		ev.handler();
+		PopStale();
+	}
+}
+
+// Orders equal cycles by registration so simultaneous events fire in a fixed order
+bool Scheduler::Later(const Entry& a, const Entry& b)
+{
+	return a.cycle != b.cycle ? a.cycle > b.cycle : a.event > b.event;
+}
+
+// Rescheduled and cancelled events leave stale entries, drop them once they reach the top
+void Scheduler::PopStale()
+{
+	while (!m_heap.empty())
+	{
+		auto& top = m_heap.front();
+		auto& ev = m_events[top.event];
+		if (ev.scheduled && ev.generation == top.generation)
+			break;
+		std::pop_heap(m_heap.begin(), m_heap.end(), Later);
+		m_heap.pop_back();
+	}
+}
+
+} // namespace DjeeDjay
@@ -0,0 +1,115 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <algorithm>
+#include "DjeeDjay/IndexedImage.h"
+#include "DjeeDjay/Electron/ScreenRenderer.h"
+
+namespace DjeeDjay {
+
+namespace {
+
+// The RGB values of the 8 physical colours, bit 0 is red, bit 1 green and bit 2 blue
+const IndexedImage::PaletteType physicalColours =
+{
+	0x000000, 0xFF0000, 0x00FF00, 0xFFFF00, 0x0000FF, 0xFF00FF, 0x00FFFF, 0xFFFFFF,
+	0x000000, 0xFF0000, 0x00FF00, 0xFFFF00, 0x0000FF, 0xFF00FF, 0x00FFFF, 0xFFFFFF
+};
+
+// Expands screen memory through a pixel table, one table entry per screen byte.
+// The screen consists of character rows of Columns cells of 8 bytes, one byte per line.
+// Only the marked lines of the segment are drawn.
+template <int BitsPerPixel, int Columns, int RowHeight>
+void GenerateLines(const ScreenSegment& segment, const ScreenRenderer::PixelTable<BitsPerPixel>& pixels, IndexedImage& image)
+{
+	constexpr int PixelsPerByte = 8 / BitsPerPixel;
+	constexpr int Width = Columns * PixelsPerByte;
+	constexpr int Rows = 256 / RowHeight;
+	// Modes with 10 line rows show 25 rows starting at line 4, the 2 bottom lines of a row are blank
+	constexpr int Top = RowHeight == 8 ? 0 : 4;
+
+	image.Resize(Width, 256);
+	for (int y = segment.firstLine; y < segment.lastLine; ++y)
+	{
+		if (!segment.lines[y])
+			continue;
+
+		uint8_t* out = image.Data() + y * Width;
+		int row = (y - Top) / RowHeight;
+		int line = (y - Top) % RowHeight;
+		if (y < Top || row >= Rows || line >= 8)
+		{
+			std::fill(out, out + Width, static_cast<uint8_t>(0));
+			continue;
+		}
+
+		const uint8_t* in = segment.ram.data() + (row - segment.firstRow) * 8 * Columns + line;
+		for (int x = 0; x < Columns; ++x)
+		{
+			const auto& group = pixels[in[8 * x]];
+			std::copy(group.begin(), group.end(), out);
+			out += PixelsPerByte;
+		}
+	}
+}
+
+} // namespace
+
+ScreenRenderer::ScreenRenderer()
+{
+	// No logical colour maps to physical colour 255, the first use builds each table
+	for (auto& colours : m_tableColours)
+		colours.fill(0xff);
+}
+
+void ScreenRenderer::UpdatePixelTable(int bitsPerPixel, const std::array<uint8_t, 16>& colours)
+{
+	auto& tableColours = m_tableColours[bitsPerPixel / 2];
+	if (colours == tableColours)
+		return;
+	tableColours = colours;
+
+	switch (bitsPerPixel)
+	{
+	case 1:
+		for (int value = 0; value < 256; ++value)
+		{
+			for (int i = 0; i < 8; ++i)
+				m_pixels1[value][i] = colours[(value >> (7 - i)) & 1];
+		}
+		break;
+	case 2:
+		for (int value = 0; value < 256; ++value)
+		{
+			for (int i = 0; i < 4; ++i)
+				m_pixels2[value][i] = colours[((value >> (6 - i)) & 2) | ((value >> (3 - i)) & 1)];
+		}
+		break;
+	case 4:
+		for (int value = 0; value < 256; ++value)
+		{
+			for (int i = 0; i < 2; ++i)
+				m_pixels4[value][i] = colours[((value >> (4 - i)) & 8) | ((value >> (3 - i)) & 4) | ((value >> (2 - i)) & 2) | ((value >> (1 - i)) & 1)];
+		}
+		break;
+	}
+}
+
+void ScreenRenderer::Render(const ScreenFrame& frame, IndexedImage& image)
+{
+	image.Palette(physicalColours);
+	for (auto& segment : frame.segments)
+	{
+		switch (segment.mode)
+		{
+		case 0: UpdatePixelTable(1, segment.colours); GenerateLines<1, 80, 8>(segment, m_pixels1, image); break;
+		case 1: UpdatePixelTable(2, segment.colours); GenerateLines<2, 80, 8>(segment, m_pixels2, image); break;
+		case 2: UpdatePixelTable(4, segment.colours); GenerateLines<4, 80, 8>(segment, m_pixels4, image); break;
+		case 3: UpdatePixelTable(1, segment.colours); GenerateLines<1, 80, 10>(segment, m_pixels1, image); break;
+		case 4: UpdatePixelTable(1, segment.colours); GenerateLines<1, 40, 8>(segment, m_pixels1, image); break;
+		case 5: UpdatePixelTable(2, segment.colours); GenerateLines<2, 40, 8>(segment, m_pixels2, image); break;
+		case 6: UpdatePixelTable(1, segment.colours); GenerateLines<1, 40, 10>(segment, m_pixels1, image); break;
+		}
+	}
+}
+
+} // namespace DjeeDjay
@@ -0,0 +1,178 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include "DjeeDjay/Electron/Sound.h"
+
+namespace DjeeDjay {
+
+namespace {
+
+constexpr uint64_t CyclesPerSecond = 2'000'000;
+constexpr uint64_t SampleTicks = CyclesPerSecond;
+constexpr uint64_t Never = std::numeric_limits<uint64_t>::max();
+
+void WriteLittleEndian(std::ostream& os, uint32_t value, int size)
+{
+	for (int i = 0; i < size; ++i)
+		os.put(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+} // namespace
+
+SoundSynthesizer::SoundSynthesizer(int sampleRate) :
+	m_sampleRate(sampleRate),
+	m_amplitude(16384),
+	m_ratio(1),
+	m_sampleTicks(SampleTicks)
+{
+	if (sampleRate <= 0)
+		throw std::invalid_argument("Bad sample rate");
+	Reset(0);
+}
+
+int SoundSynthesizer::SampleRate() const
+{
+	return m_sampleRate;
+}
+
+void SoundSynthesizer::Amplitude(double value)
+{
+	m_amplitude = static_cast<int>(std::min(std::max(value, 0.0), 1.0) * std::numeric_limits<int16_t>::max());
+}
+
+double SoundSynthesizer::Amplitude() const
+{
+	return static_cast<double>(m_amplitude) / std::numeric_limits<int16_t>::max();
+}
+
+void SoundSynthesizer::Ratio(double ratio)
+{
+	if (ratio <= 0)
+		throw std::invalid_argument("Bad sample ratio");
+	m_ratio = ratio;
+	m_sampleTicks = static_cast<uint64_t>(SampleTicks / ratio + 0.5);
+}
+
+double SoundSynthesizer::Ratio() const
+{
+	return m_ratio;
+}
+
+void SoundSynthesizer::Reset(uint64_t cycle)
+{
+	m_time = cycle * static_cast<uint64_t>(m_sampleRate);
+	m_sampleEnd = m_time + m_sampleTicks;
+	m_sum = 0;
+	m_halfPeriod = 0;
+	m_nextToggle = Never;
+	m_level = 1;
+}
+
+// A new tone continues from the current level, a speaker that turns on starts high
+void SoundSynthesizer::Change(const SpeakerChange& change, std::vector<int16_t>& samples)
+{
+	Generate(change.cycle, samples);
+
+	if (change.halfPeriod == 0)
+	{
+		m_halfPeriod = 0;
+		m_nextToggle = Never;
+		return;
+	}
+	if (m_halfPeriod == 0)
+		m_level = 1;
+	m_halfPeriod = static_cast<uint64_t>(change.halfPeriod) * static_cast<uint64_t>(m_sampleRate);
+	m_nextToggle = m_time + m_halfPeriod;
+}
+
+// Integrates the square wave from toggle to toggle and emits the average at the end of each sample
+void SoundSynthesizer::Generate(uint64_t cycle, std::vector<int16_t>& samples)
+{
+	uint64_t end = cycle * static_cast<uint64_t>(m_sampleRate);
+	while (m_time < end)
+	{
+		uint64_t next = std::min({ end, m_sampleEnd, m_nextToggle });
+		if (m_halfPeriod != 0)
+			m_sum += m_level * static_cast<int64_t>(next - m_time);
+		m_time = next;
+
+		if (m_time == m_nextToggle)
+		{
+			m_level = -m_level;
+			m_nextToggle += m_halfPeriod;
+		}
+		if (m_time == m_sampleEnd)
+		{
+			samples.push_back(static_cast<int16_t>(m_sum * m_amplitude / static_cast<int64_t>(m_sampleTicks)));
+			m_sum = 0;
+			m_sampleEnd += m_sampleTicks;
+		}
+	}
+}
+
+SoundFile::SoundFile(const std::string& filename, int sampleRate, SoundFileFormat format) :
+	m_file(filename, std::ios::binary),
+	m_sampleRate(sampleRate),
+	m_format(format),
+	m_samples(0)
+{
+	if (!m_file)
+		throw std::runtime_error("Cannot create " + filename);
+	if (m_format == SoundFileFormat::Wave)
+		WriteHeader();
+}
+
+SoundFile::~SoundFile()
+{
+	try
+	{
+		Close();
+	}
+	catch (std::exception&)
+	{
+	}
+}
+
+void SoundFile::Write(const int16_t* samples, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		WriteLittleEndian(m_file, static_cast<uint16_t>(samples[i]), 2);
+	m_samples += count;
+}
+
+void SoundFile::Close()
+{
+	if (!m_file.is_open())
+		return;
+
+	if (m_format == SoundFileFormat::Wave)
+	{
+		m_file.seekp(0);
+		WriteHeader();
+	}
+	m_file.close();
+	if (m_file.fail())
+		throw std::runtime_error("Sound file write failed");
+}
+
+void SoundFile::WriteHeader()
+{
+	uint32_t dataSize = static_cast<uint32_t>(std::min<uint64_t>(2 * m_samples, 0xffffffff - 36));
+	m_file.write("RIFF", 4);
+	WriteLittleEndian(m_file, 36 + dataSize, 4);
+	m_file.write("WAVE", 4);
+	m_file.write("fmt ", 4);
+	WriteLittleEndian(m_file, 16, 4);
+	WriteLittleEndian(m_file, 1, 2);			// PCM
+	WriteLittleEndian(m_file, 1, 2);			// Mono
+	WriteLittleEndian(m_file, static_cast<uint32_t>(m_sampleRate), 4);
+	WriteLittleEndian(m_file, static_cast<uint32_t>(2 * m_sampleRate), 4);
+	WriteLittleEndian(m_file, 2, 2);			// Block align
+	WriteLittleEndian(m_file, 16, 2);			// Bits per sample
+	m_file.write("data", 4);
+	WriteLittleEndian(m_file, dataSize, 4);
+}
+
+} // namespace DjeeDjay
@@ -1,9 +1,13 @@
 ﻿// (C) Copyright Gert-Jan de Vos 2021.
 
 #include <cassert>
-#include "DjeeDjay/Image.h"
+#include <algorithm>
+#include <bitset>
+#include <iterator>
 #include "DjeeDjay/ToHexString.h"
 #include "DjeeDjay/MOS6502.h"
+#include "DjeeDjay/Electron/MemoryMap.h"
+#include "DjeeDjay/Electron/Scheduler.h"
 #include "DjeeDjay/Electron/Ula.h"
 
 namespace DjeeDjay {
@@ -20,7 +24,21 @@ constexpr uint8_t PowerOnReset = 0x02;
 constexpr uint8_t AllInteruptsMask = HighToneDetect | ReceiveDataFull | TransmitDataEmpty | RealTimeClock | DisplayEnd;
 constexpr uint8_t MasterIrq = 0x01;
 
+constexpr uint8_t Black = 0;
+constexpr uint8_t Red = 1;
+constexpr uint8_t Green = 2;
+constexpr uint8_t Blue = 4;
+
+uint8_t PhysicalColour(uint8_t blue, uint8_t green, uint8_t red)
+{
+	return static_cast<uint8_t>(blue | green | red);
+}
+
+constexpr uint64_t LineCycles = 64 * 2;
 constexpr uint64_t VSyncCycles = 312 * 64 * 2;
+
+// A tight loop that writes the counter every 10 cycles fills a frame with 4000 changes
+constexpr size_t SpeakerLogSize = 16384;
 constexpr uint64_t VSyncToRtcCycles = 100 * 64 * 2;
 
 int RomBankNr(int index)
@@ -35,219 +53,34 @@ int RomBankNr(int index)
 	}
 }
 
-class ScreenBufferIterator
+struct ScreenLayout
 {
-public:
-	ScreenBufferIterator(const uint8_t* ram, size_t screenMin, size_t screenStart) :
-		m_ram(ram),
-		m_screenMin(screenMin),
-		m_address(screenStart)
-	{
-	}
-
-	ScreenBufferIterator& operator++()
-	{
-		if (++m_address == 0x8000)
-			m_address = m_screenMin;
-		return *this;
-	}
-
-	uint8_t operator*() const
-	{
-		return m_ram[m_address];
-	}
-
-private:
-	const uint8_t* m_ram;
-	size_t m_screenMin;
-	size_t m_address;
+	size_t screenMin;	// Screen memory runs from screenMin up to &8000
+	int bitsPerPixel;
+	int rowBytes;		// Bytes per character row
+	int rows;
+	int top;			// First image line of character row 0
+	int rowHeight;		// Image lines per character row
 };
 
-void Write1(Image& image, int x, int y, uint32_t value)
-{
-	image.Data()[y * image.Width() + x] = value;
-}
-
-void Write2(Image& image, int x, int y, uint32_t value, const std::array<uint32_t, 16>& palette)
-{
-	Write1(image, x + 0, y, palette[((value & 0x80) >> 4) | ((value & 0x20) >> 3) | ((value & 0x08) >> 2) | ((value & 0x02) >> 1)]);
-	Write1(image, x + 1, y, palette[((value & 0x40) >> 3) | ((value & 0x10) >> 2) | ((value & 0x04) >> 1) | (value & 0x01)]);
-}
-
-void Write4(Image& image, int x, int y, uint32_t value, const std::array<uint32_t, 4>& palette)
-{
-	Write1(image, x + 0, y, palette[((value & 0x80) >> 6) | ((value & 0x08) >> 3)]);
-	Write1(image, x + 1, y, palette[((value & 0x40) >> 5) | ((value & 0x04) >> 2)]);
-	Write1(image, x + 2, y, palette[((value & 0x20) >> 4) | ((value & 0x02) >> 1)]);
-	Write1(image, x + 3, y, palette[((value & 0x10) >> 3) | (value & 0x01)]);
-}
-
-void Write8(Image& image, int x, int y, uint32_t value, const std::array<uint32_t, 2>& palette)
-{
-	Write1(image, x + 0, y, palette[(value & 0x80) >> 7]);
-	Write1(image, x + 1, y, palette[(value & 0x40) >> 6]);
-	Write1(image, x + 2, y, palette[(value & 0x20) >> 5]);
-	Write1(image, x + 3, y, palette[(value & 0x10) >> 4]);
-	Write1(image, x + 4, y, palette[(value & 0x08) >> 3]);
-	Write1(image, x + 5, y, palette[(value & 0x04) >> 2]);
-	Write1(image, x + 6, y, palette[(value & 0x02) >> 1]);
-	Write1(image, x + 7, y, palette[value & 0x01]);
-}
-
-void GenerateMode0(const uint8_t* ram, size_t screenStart, const std::array<uint32_t, 2>& palette, Image& image)
-{
-	image.Resize(640, 256);
-	ScreenBufferIterator it(ram, 0x3000, screenStart);
-
-	for (int y = 0; y < 32; ++y)
-	{
-		for (int x = 0; x < 80; ++x)
-		{
-			for (int row = 0; row < 8; ++row)
-			{
-				Write8(image, 8 * x, 8 * y + row, *it, palette);
-				++it;
-			}
-		}
-	}
-}
-
-void GenerateMode1(const uint8_t* ram, size_t screenStart, const std::array<uint32_t, 4>& palette, Image& image)
-{
-	image.Resize(320, 256);
-	ScreenBufferIterator it(ram, 0x3000, screenStart);
-
-	for (int y = 0; y < 32; ++y)
-	{
-		for (int x = 0; x < 80; ++x)
-		{
-			for (int row = 0; row < 8; ++row)
-			{
-				Write4(image, 4 * x, 8 * y + row, *it, palette);
-				++it;
-			}
-		}
-	}
-}
-
-void GenerateMode2(const uint8_t* ram, size_t screenStart, const std::array<uint32_t, 16>& palette, Image& image)
+const ScreenLayout screenLayouts[8] =
 {
-	image.Resize(160, 256);
-	ScreenBufferIterator it(ram, 0x3000, screenStart);
-
-	for (int y = 0; y < 32; ++y)
-	{
-		for (int x = 0; x < 80; ++x)
-		{
-			for (int row = 0; row < 8; ++row)
-			{
-				Write2(image, 2 * x, 8 * y + row, *it, palette);
-				++it;
-			}
-		}
-	}
-}
-
-void GenerateMode3(const uint8_t* ram, size_t screenStart, const std::array<uint32_t, 2>& palette, Image& image)
-{
-	image.Resize(640, 256);
-	ScreenBufferIterator it(ram, 0x4000, screenStart);
-
-	for (int x = 0; x < image.Width(); ++x)
-	{
-		Write1(image, x, 0, 0);
-		Write1(image, x, 1, 0);
-		Write1(image, x, 2, 0);
-		Write1(image, x, 3, 0);
-		Write1(image, x, 254, 0);
-		Write1(image, x, 255, 0);
-	}
-	for (int y = 0; y < 25; ++y)
-	{
-		for (int x = 0; x < 80; ++x)
-		{
-			for (int row = 0; row < 8; ++row)
-			{
-				Write8(image, 8 * x, 4 + 10 * y + row, *it, palette);
-				++it;
-			}
-		}
-
-		for (int x = 0; x < image.Width(); ++x)
-		{
-			Write1(image, x, 4 + 10 * y + 8, 0);
-			Write1(image, x, 4 + 10 * y + 9, 0);
-		}
-	}
-}
-
-void GenerateMode4(const uint8_t* ram, size_t screenStart, const std::array<uint32_t, 2>& palette, Image& image)
-{
-	image.Resize(320, 256);
-	ScreenBufferIterator it(ram, 0x5800, screenStart);
-
-	for (int y = 0; y < 32; ++y)
-	{
-		for (int x = 0; x < 40; ++x)
-		{
-			for (int row = 0; row < 8; ++row)
-			{
-				Write8(image, 8 * x, 8 * y + row, *it, palette);
-				++it;
-			}
-		}
-	}
-}
-
-void GenerateMode5(const uint8_t* ram, size_t screenStart, const std::array<uint32_t, 4>& palette, Image& image)
-{
-	image.Resize(160, 256);
-	ScreenBufferIterator it(ram, 0x5800, screenStart);
-
-	for (int y = 0; y < 32; ++y)
-	{
-		for (int x = 0; x < 40; ++x)
-		{
-			for (int row = 0; row < 8; ++row)
-			{
-				Write4(image, 4 * x, 8 * y + row, *it, palette);
-				++it;
-			}
-		}
-	}
-}
+	{ 0x3000, 1, 640, 32, 0, 8 },
+	{ 0x3000, 2, 640, 32, 0, 8 },
+	{ 0x3000, 4, 640, 32, 0, 8 },
+	{ 0x4000, 1, 640, 25, 4, 10 },
+	{ 0x5800, 1, 320, 32, 0, 8 },
+	{ 0x5800, 2, 320, 32, 0, 8 },
+	{ 0x6000, 1, 320, 25, 4, 10 },
+	{ 0x8000, 1, 320, 0, 0, 8 }		// Mode 7 is not displayed
+};
 
-void GenerateMode6(const uint8_t* ram, size_t screenStart, const std::array<uint32_t, 2>& palette, Image& image)
+// Returns the offset of address from the start of the screen, or -1 when it is not screen memory
+int ScreenOffset(const ScreenLayout& layout, size_t screenStart, size_t address)
 {
-	image.Resize(320, 256);
-	ScreenBufferIterator it(ram, 0x6000, screenStart);
-
-	for (int x = 0; x < image.Width(); ++x)
-	{
-		Write1(image, x, 0, 0);
-		Write1(image, x, 1, 0);
-		Write1(image, x, 2, 0);
-		Write1(image, x, 3, 0);
-		Write1(image, x, 254, 0);
-		Write1(image, x, 255, 0);
-	}
-	for (int y = 0; y < 25; ++y)
-	{
-		for (int x = 0; x < 40; ++x)
-		{
-			for (int row = 0; row < 8; ++row)
-			{
-				Write8(image, 8 * x, 4 + 10 * y + row, *it, palette);
-				++it;
-			}
-		}
-
-		for (int x = 0; x < image.Width(); ++x)
-		{
-			Write1(image, x, 4 + 10 * y + 8, 0);
-			Write1(image, x, 4 + 10 * y + 9, 0);
-		}
-	}
+	if (address < layout.screenMin || address >= 0x8000)
+		return -1;
+	return static_cast<int>(address >= screenStart ? address - screenStart : address + (0x8000 - layout.screenMin) - screenStart);
 }
 
 } // namespace
@@ -258,9 +91,30 @@ KeyboardBit::KeyboardBit(int column, int bit) :
 {
 }
 
-Ula::Ula(MOS6502& cpu) :
-	m_cpu(cpu)
-{
+Ula::Ula(MOS6502State& cpu, MemoryMap& memoryMap, Scheduler& scheduler) :
+	m_cpu(cpu),
+	m_memoryMap(memoryMap),
+	m_scheduler(scheduler),
+	m_rtcEvent(scheduler.Register([this]() { TriggerRtcInterrupt(); })),
+	m_displayEndEvent(scheduler.Register([this]() { TriggerDisplayEndInterrupt(); })),
+	m_nmi(false),
+	m_irqStatus(0),
+	m_irqEnable(0),
+	m_screenLow(0),
+	m_screenHigh(0),
+	m_romBankIndex(0),
+	m_counter(0),
+	m_miscControl(0),
+	m_palette(),
+	m_screenRam(nullptr),
+	m_captureScreen(true),
+	m_imageWidth(0),
+	m_capturedLines(0),
+	m_frameStart(0),
+	m_frame(),
+	m_speakerLog(SpeakerLogSize)
+{
+	m_dirtyLines.set();
 	std::fill(m_keyboard.begin(), m_keyboard.end(), static_cast<uint8_t>(0));
 	Restart();
 }
@@ -280,9 +134,9 @@ void Ula::CassetteMotor(CassetteMotorEvent slot)
 	m_cassetteMotor = slot;
 }
 
-void Ula::Speaker(SpeakerEvent slot)
+void Ula::FrameEnd(FrameEndEvent slot)
 {
-	m_speaker = slot;
+	m_frameEnd = slot;
 }
 
 bool Ula::CapsLock() const
@@ -301,7 +155,15 @@ void Ula::InstallRom(int bank, std::vector<uint8_t> rom)
 		throw std::runtime_error("Bad ROM bank");
 	if (rom.size() > 0x4000)
 		throw std::runtime_error("Bad ROM size");
+	rom.resize(0x4000, 0xff);
 	m_roms[RomBankNr(bank)] = std::move(rom);
+	m_romCode[RomBankNr(bank)].assign(0x40, DecodedPage());
+	MapRomBank();
+}
+
+const std::array<std::vector<uint8_t>, 16>& Ula::Roms() const
+{
+	return m_roms;
 }
 
 void Ula::Restart()
@@ -316,10 +178,73 @@ void Ula::Reset()
 	m_videoCycles = 0;
 	m_nextFrameCycle = VSyncCycles;
 	m_nextRtcCycle = VSyncCycles + VSyncToRtcCycles;
+	m_scheduler.Schedule(m_displayEndEvent, m_nextFrameCycle + 1);
+	m_scheduler.Schedule(m_rtcEvent, m_nextRtcCycle + 1);
+	m_frame = ScreenFrame();
+	m_capturedLines = 0;
+	m_dirtyLines.set();
 	m_romBankIndex = 0;
+	MapRomBank();
 	UpdateIrqStatus(0, 0);
 }
 
+void Ula::Save(UlaSnapshot& snapshot) const
+{
+	snapshot.keyboard = m_keyboard;
+	snapshot.oneMHzCycles = m_oneMHzCycles;
+	snapshot.videoCycles = m_videoCycles;
+	snapshot.nextFrameCycle = m_nextFrameCycle;
+	snapshot.nextRtcCycle = m_nextRtcCycle;
+	snapshot.nmi = m_nmi;
+	snapshot.irqStatus = m_irqStatus;
+	snapshot.irqEnable = m_irqEnable;
+	snapshot.screenLow = m_screenLow;
+	snapshot.screenHigh = m_screenHigh;
+	snapshot.romBankIndex = m_romBankIndex;
+	snapshot.counter = m_counter;
+	snapshot.miscControl = m_miscControl;
+	std::copy(std::begin(m_palette), std::end(m_palette), snapshot.palette.begin());
+	snapshot.imageWidth = m_imageWidth;
+	snapshot.dirtyLines = m_dirtyLines;
+	snapshot.capturedLines = m_capturedLines;
+	snapshot.frameStart = m_frameStart;
+	snapshot.frame = m_frame;
+}
+
+void Ula::Restore(const UlaSnapshot& snapshot)
+{
+	bool capsLock = snapshot.miscControl & 0x80;
+	if (capsLock != CapsLock())
+		m_capsLock(capsLock);
+	bool cassetteMotor = snapshot.miscControl & 0x40;
+	if (cassetteMotor != CassetteMotor())
+		m_cassetteMotor(cassetteMotor);
+
+	m_keyboard = snapshot.keyboard;
+	m_oneMHzCycles = snapshot.oneMHzCycles;
+	m_videoCycles = snapshot.videoCycles;
+	m_nextFrameCycle = snapshot.nextFrameCycle;
+	m_nextRtcCycle = snapshot.nextRtcCycle;
+	m_nmi = snapshot.nmi;
+	m_irqStatus = snapshot.irqStatus;
+	m_irqEnable = snapshot.irqEnable;
+	m_screenLow = snapshot.screenLow;
+	m_screenHigh = snapshot.screenHigh;
+	m_romBankIndex = snapshot.romBankIndex;
+	m_counter = snapshot.counter;
+	m_miscControl = snapshot.miscControl;
+	std::copy(snapshot.palette.begin(), snapshot.palette.end(), std::begin(m_palette));
+	m_imageWidth = snapshot.imageWidth;
+	m_dirtyLines = snapshot.dirtyLines;
+	m_capturedLines = snapshot.capturedLines;
+	m_frameStart = snapshot.frameStart;
+	m_frame = snapshot.frame;
+
+	m_scheduler.Schedule(m_displayEndEvent, m_nextFrameCycle + 1);
+	m_scheduler.Schedule(m_rtcEvent, m_nextRtcCycle + 1);
+	MapRomBank();
+}
+
 uint8_t Ula::ReadKeyboard(uint16_t address) const
 {
 	uint8_t value = 0;
@@ -372,12 +297,6 @@ void Ula::KeyUp(const KeyboardBit& key)
 	m_keyboard[key.column] &= ~(1 << key.bit);
 }
 
-void Ula::UpdateTimers()
-{
-	if (m_cpu.Cycles() > m_nextRtcCycle)
-		TriggerRtcInterrupt();
-}
-
 uint64_t Ula::OneMHzCycles() const
 {
 	return m_oneMHzCycles;
@@ -388,15 +307,38 @@ uint64_t Ula::VideoCycles() const
 	return m_videoCycles;
 }
 
-bool Ula::ReadyForNextFrame() const
+uint64_t Ula::ElapsedCycles() const
+{
+	return m_cpu.Cycles() + m_oneMHzCycles + m_videoCycles;
+}
+
+bool Ula::ReadSpeaker(SpeakerChange& change)
+{
+	return m_speakerLog.Pop(change);
+}
+
+// The keyboard and empty banks are left unmapped and served by ReadRom()
+void Ula::MapRomBank()
 {
-	return m_cpu.Cycles() > m_nextFrameCycle;
+	if (m_romBankIndex == 8 || m_roms[m_romBankIndex].empty())
+		m_memoryMap.Unmap(0x80, 0x40);
+	else
+		m_memoryMap.MapRom(0x80, 0x40, m_roms[m_romBankIndex].data(), m_romCode[m_romBankIndex].data());
 }
 
 void Ula::TriggerRtcInterrupt()
 {
 	UpdateIrqStatus(m_irqEnable, m_irqStatus | RealTimeClock);
 	m_nextRtcCycle += VSyncCycles;
+	m_scheduler.Schedule(m_rtcEvent, m_nextRtcCycle + 1);
+}
+
+void Ula::TriggerDisplayEndInterrupt()
+{
+	m_frameEnd();
+	UpdateIrqStatus(m_irqEnable, m_irqStatus | DisplayEnd);
+	m_nextFrameCycle += VSyncCycles;
+	m_scheduler.Schedule(m_displayEndEvent, m_nextFrameCycle + 1);
 }
 
 void Ula::UpdateIrqStatus(uint8_t enable, uint8_t status)
@@ -436,6 +378,10 @@ uint8_t Ula::Read(uint16_t address)
 
 void Ula::Write(uint16_t address, uint8_t value)
 {
+	// Lines up to the beam position are drawn with the registers as they were
+	if ((address & 0xff0f) >= 0xfe02)
+		CaptureLines(BeamLine());
+
 	switch (address & 0xff0f)
 	{
 	case 0xfe00: return UpdateIrqStatus(value, m_irqStatus);
@@ -487,6 +433,7 @@ void Ula::CassetteDataShift(uint8_t)
 void Ula::InterruptClearAndPaging(uint8_t value)
 {
 	m_romBankIndex = RomBankNr(value & 0x0f);
+	MapRomBank();
 	if (value & 0x80)
 		m_nmi = false;
 
@@ -502,10 +449,10 @@ void Ula::InterruptClearAndPaging(uint8_t value)
 
 void Ula::Counter(uint8_t value)
 {
-	if (((m_miscControl & 0x06) >> 1) == 1 && value != m_counter)
-		m_speaker(1'000'000 / (16 * (value + 1)));
-
+	bool changed = SpeakerHalfPeriod() != 0 && value != m_counter;
 	m_counter = value;
+	if (changed)
+		LogSpeaker();
 }
 
 uint8_t Ula::MiscellaneousControl()
@@ -522,11 +469,23 @@ void Ula::MiscellaneousControl(uint8_t value)
 	if (cassetteMotor != CassetteMotor())
 		m_cassetteMotor(cassetteMotor);
 
-	auto mode = (value & 0x06) >> 1;
-	if (mode != ((m_miscControl & 0x06) >> 1))
-		m_speaker(mode == 1 ? 1'000'000 / (16 * (m_counter + 1)) : 0);
-
+	bool speakerChanged = (value ^ m_miscControl) & 0x06;
+	if ((value ^ m_miscControl) & 0x38)
+		m_dirtyLines.set();
 	m_miscControl = value;
+	if (speakerChanged)
+		LogSpeaker();
+}
+
+// In sound mode 1 the speaker plays a square wave of 1 MHz / (16 * (counter + 1))
+int Ula::SpeakerHalfPeriod() const
+{
+	return ((m_miscControl & 0x06) >> 1) == 1 ? 16 * (m_counter + 1) : 0;
+}
+
+void Ula::LogSpeaker()
+{
+	m_speakerLog.Push(SpeakerChange{ ElapsedCycles(), SpeakerHalfPeriod() });
 }
 
 uint8_t Ula::Palette(int index)
@@ -536,106 +495,266 @@ uint8_t Ula::Palette(int index)
 
 void Ula::Palette(int index, uint8_t value)
 {
-	m_palette[index] = value;
+	if (value != m_palette[index])
+	{
+		m_palette[index] = value;
+		m_dirtyLines.set();
+	}
 }
 
-uint32_t Ula::PaletteB(int index, int bit) const
+uint8_t Ula::PaletteB(int index, int bit) const
 {
-	return m_palette[index] & (1 << bit) ? 0 : 0x0000FF;
+	return m_palette[index] & (1 << bit) ? Black : Blue;
 }
 
-uint32_t Ula::PaletteG(int index, int bit) const
+uint8_t Ula::PaletteG(int index, int bit) const
 {
-	return m_palette[index] & (1 << bit) ? 0 : 0x00FF00;
+	return m_palette[index] & (1 << bit) ? Black : Green;
 }
 
-uint32_t Ula::PaletteR(int index, int bit) const
+uint8_t Ula::PaletteR(int index, int bit) const
 {
-	return m_palette[index] & (1 << bit) ? 0 : 0xFF0000;
+	return m_palette[index] & (1 << bit) ? Black : Red;
 }
 
-std::array<uint32_t, 2> Ula::Palette2()
+std::array<uint8_t, 2> Ula::Palette2()
 {
 	return
 	{
-		PaletteB(0, 4) | PaletteG(1, 4) | PaletteR(1, 0),
-		PaletteB(0, 6) | PaletteG(0, 2) | PaletteR(1, 2)
+		PhysicalColour(PaletteB(0, 4), PaletteG(1, 4), PaletteR(1, 0)),
+		PhysicalColour(PaletteB(0, 6), PaletteG(0, 2), PaletteR(1, 2))
 	};
 }
 
-std::array<uint32_t, 4> Ula::Palette4()
+std::array<uint8_t, 4> Ula::Palette4()
 {
 	return
 	{
-		PaletteB(0, 4) | PaletteG(1, 4) | PaletteR(1, 0),
-		PaletteB(0, 5) | PaletteG(1, 5) | PaletteR(1, 1),
-		PaletteB(0, 6) | PaletteG(0, 2) | PaletteR(1, 2),
-		PaletteB(0, 7) | PaletteG(0, 3) | PaletteR(1, 3)
+		PhysicalColour(PaletteB(0, 4), PaletteG(1, 4), PaletteR(1, 0)),
+		PhysicalColour(PaletteB(0, 5), PaletteG(1, 5), PaletteR(1, 1)),
+		PhysicalColour(PaletteB(0, 6), PaletteG(0, 2), PaletteR(1, 2)),
+		PhysicalColour(PaletteB(0, 7), PaletteG(0, 3), PaletteR(1, 3))
 	};
 }
 
-std::array<uint32_t, 16> Ula::Palette16()
+std::array<uint8_t, 16> Ula::Palette16()
 {
 	return
 	{
-		PaletteB(0, 4) | PaletteG(1, 4) | PaletteR(1, 0), // 0
-		PaletteB(6, 4) | PaletteG(7, 4) | PaletteR(7, 0), // 1
-		PaletteB(0, 5) | PaletteG(1, 5) | PaletteR(1, 1), // 2
-		PaletteB(6, 5) | PaletteG(7, 5) | PaletteR(7, 1), // 3
-		PaletteB(2, 4) | PaletteG(3, 4) | PaletteR(3, 0), // 4
-		PaletteB(4, 4) | PaletteG(5, 4) | PaletteR(5, 0), // 5
-		PaletteB(2, 5) | PaletteG(3, 5) | PaletteR(3, 1), // 6
-		PaletteB(4, 5) | PaletteG(5, 5) | PaletteR(5, 1), // 7
-		PaletteB(0, 6) | PaletteG(0, 2) | PaletteR(1, 2), // 8
-		PaletteB(6, 6) | PaletteG(6, 2) | PaletteR(7, 2), // 9
-		PaletteB(0, 7) | PaletteG(0, 3) | PaletteR(1, 3), // 10
-		PaletteB(6, 7) | PaletteG(6, 3) | PaletteR(6, 3), // 11
-		PaletteB(2, 6) | PaletteG(2, 2) | PaletteR(3, 2), // 12
-		PaletteB(4, 6) | PaletteG(4, 2) | PaletteR(5, 2), // 13
-		PaletteB(2, 7) | PaletteG(2, 3) | PaletteR(3, 3), // 14
-		PaletteB(4, 7) | PaletteG(4, 3) | PaletteR(4, 3), // 15
+		PhysicalColour(PaletteB(0, 4), PaletteG(1, 4), PaletteR(1, 0)), // 0
+		PhysicalColour(PaletteB(6, 4), PaletteG(7, 4), PaletteR(7, 0)), // 1
+		PhysicalColour(PaletteB(0, 5), PaletteG(1, 5), PaletteR(1, 1)), // 2
+		PhysicalColour(PaletteB(6, 5), PaletteG(7, 5), PaletteR(7, 1)), // 3
+		PhysicalColour(PaletteB(2, 4), PaletteG(3, 4), PaletteR(3, 0)), // 4
+		PhysicalColour(PaletteB(4, 4), PaletteG(5, 4), PaletteR(5, 0)), // 5
+		PhysicalColour(PaletteB(2, 5), PaletteG(3, 5), PaletteR(3, 1)), // 6
+		PhysicalColour(PaletteB(4, 5), PaletteG(5, 5), PaletteR(5, 1)), // 7
+		PhysicalColour(PaletteB(0, 6), PaletteG(0, 2), PaletteR(1, 2)), // 8
+		PhysicalColour(PaletteB(6, 6), PaletteG(6, 2), PaletteR(7, 2)), // 9
+		PhysicalColour(PaletteB(0, 7), PaletteG(0, 3), PaletteR(1, 3)), // 10
+		PhysicalColour(PaletteB(6, 7), PaletteG(6, 3), PaletteR(6, 3)), // 11
+		PhysicalColour(PaletteB(2, 6), PaletteG(2, 2), PaletteR(3, 2)), // 12
+		PhysicalColour(PaletteB(4, 6), PaletteG(4, 2), PaletteR(5, 2)), // 13
+		PhysicalColour(PaletteB(2, 7), PaletteG(2, 3), PaletteR(3, 3)), // 14
+		PhysicalColour(PaletteB(4, 7), PaletteG(4, 3), PaletteR(4, 3)), // 15
 	};
 }
 
-void Ula::GenerateFrame(const uint8_t* ram, Image& image)
+// Returns the physical colour of each logical colour of the screen mode
+std::array<uint8_t, 16> Ula::Colours(int bitsPerPixel)
 {
-	int mode = (m_miscControl & 0x38) >> 3;
-
-	size_t screenStart = ((m_screenHigh << 9) | (m_screenLow << 1)) & 0x7fc0;
-	switch (mode)
+	std::array<uint8_t, 16> colours = {};
+	switch (bitsPerPixel)
 	{
-	case 0:
-		GenerateMode0(ram, screenStart, Palette2(), image);
-		m_videoCycles += 80 * 8 * 32 * 2;
-		break;
 	case 1:
-		GenerateMode1(ram, screenStart, Palette4(), image);
-		m_videoCycles += 40 * 2 * 8 * 32 * 2;
+	{
+		auto palette = Palette2();
+		std::copy(palette.begin(), palette.end(), colours.begin());
 		break;
+	}
 	case 2:
-		GenerateMode2(ram, screenStart, Palette16(), image);
-		m_videoCycles += 20 * 4 * 8 * 32 * 2;
-		break;
-	case 3:
-		GenerateMode3(ram, screenStart, Palette2(), image);
-		m_videoCycles += 80 * 8 * 25 * 2;
+	{
+		auto palette = Palette4();
+		std::copy(palette.begin(), palette.end(), colours.begin());
 		break;
+	}
 	case 4:
-		GenerateMode4(ram, screenStart, Palette2(), image);
-		m_videoCycles += 40 * 8 * 32 * 2;
-		break;
-	case 5:
-		GenerateMode5(ram, screenStart, Palette4(), image);
-		m_videoCycles += 20 * 2 * 8 * 32 * 2;
-		break;
-	case 6:
-		GenerateMode6(ram, screenStart, Palette2(), image);
-		m_videoCycles += 40 * 8 * 25 * 2;
+		colours = Palette16();
 		break;
 	}
+	return colours;
+}
 
-	UpdateIrqStatus(m_irqEnable, m_irqStatus | DisplayEnd);
-	m_nextFrameCycle += VSyncCycles;
+int Ula::ScreenMode() const
+{
+	return (m_miscControl & 0x38) >> 3;
+}
+
+size_t Ula::ScreenStart() const
+{
+	return ((m_screenHigh << 9) | (m_screenLow << 1)) & 0x7fc0;
+}
+
+void Ula::ConnectScreen(const uint8_t* ram)
+{
+	m_screenRam = ram;
+	m_dirtyLines.set();
+}
+
+void Ula::CaptureScreen(bool enable)
+{
+	m_captureScreen = enable;
+}
+
+bool Ula::CaptureScreen() const
+{
+	return m_captureScreen;
+}
+
+// Returns the number of image lines the beam has completed in the current frame.
+// The 256 image lines are the last lines before the display end interrupt.
+int Ula::BeamLine() const
+{
+	uint64_t cycle = m_cpu.Cycles();
+	if (cycle >= m_nextFrameCycle)
+		return 256;
+	uint64_t lines = (m_nextFrameCycle - cycle + LineCycles - 1) / LineCycles;
+	return lines >= 256 ? 0 : 256 - static_cast<int>(lines);
+}
+
+// Captures the dirty lines from the last captured line up to lastLine with the current registers
+void Ula::CaptureLines(int lastLine)
+{
+	if (!m_screenRam || !m_captureScreen || lastLine <= m_capturedLines)
+		return;
+
+	// The screen start address is latched when the beam starts the first line
+	int firstLine = m_capturedLines;
+	m_capturedLines = lastLine;
+	if (firstLine == 0 && ScreenStart() != m_frameStart)
+	{
+		m_frameStart = ScreenStart();
+		m_dirtyLines.set();
+	}
+
+	int mode = ScreenMode();
+	const ScreenLayout& layout = screenLayouts[mode];
+	if (layout.rows == 0)
+		return;
+
+	// The image has a single width, a mode change to another width redraws the frame so far in the new mode
+	int width = layout.rowBytes / layout.bitsPerPixel;
+	if (width != m_imageWidth)
+	{
+		m_imageWidth = width;
+		m_dirtyLines.set();
+		m_frame.changes = ScreenChanges();
+		firstLine = 0;
+	}
+
+	// A screen start below the screen memory makes rows overlap, always redraw it completely
+	if (m_frameStart < layout.screenMin)
+		m_dirtyLines.set();
+
+	ScreenSegment segment;
+	segment.mode = mode;
+	segment.colours = Colours(layout.bitsPerPixel);
+	segment.firstLine = lastLine;
+	segment.lastLine = firstLine;
+	for (int y = firstLine; y < lastLine; ++y)
+	{
+		if (!m_dirtyLines[y])
+			continue;
+		m_dirtyLines[y] = false;
+		segment.lines[y] = true;
+		segment.firstLine = std::min(segment.firstLine, y);
+		segment.lastLine = y + 1;
+
+		ScreenChanges& changes = m_frame.changes;
+		if (changes.firstLine == changes.lastLine)
+			changes.firstLine = y;
+		changes.lastLine = y + 1;
+		int row = (y - layout.top) / layout.rowHeight;
+		if (y >= layout.top && row < layout.rows)
+			changes.rows |= 1u << row;
+	}
+	if (segment.firstLine >= segment.lastLine)
+		return;
+
+	// Copy the screen memory of the rows with drawn lines, screen memory wraps around from &8000 to screenMin
+	segment.firstRow = std::max(segment.firstLine - layout.top, 0) / layout.rowHeight;
+	int lastRow = std::min(std::max(segment.lastLine - layout.top, 0) + layout.rowHeight - 1, layout.rows * layout.rowHeight) / layout.rowHeight;
+	if (lastRow > segment.firstRow)
+	{
+		size_t begin = m_frameStart + segment.firstRow * layout.rowBytes;
+		size_t end = m_frameStart + lastRow * layout.rowBytes;
+		segment.ram.reserve(end - begin);
+		if (begin < 0x8000)
+			segment.ram.insert(segment.ram.end(), m_screenRam + begin, m_screenRam + std::min<size_t>(end, 0x8000));
+		if (end > 0x8000)
+		{
+			size_t wrap = 0x8000 - layout.screenMin;
+			segment.ram.insert(segment.ram.end(), m_screenRam + std::max<size_t>(begin, 0x8000) - wrap, m_screenRam + end - wrap);
+		}
+	}
+	m_frame.segments.push_back(std::move(segment));
+}
+
+// Captures the rest of the frame and returns it to be drawn
+ScreenFrame Ula::GenerateFrame()
+{
+	CaptureLines(256);
+	ScreenFrame frame = std::move(m_frame);
+	m_frame = ScreenFrame();
+	m_capturedLines = 0;
+
+	switch (ScreenMode())
+	{
+	case 0: m_videoCycles += 80 * 8 * 32 * 2; break;
+	case 1: m_videoCycles += 40 * 2 * 8 * 32 * 2; break;
+	case 2: m_videoCycles += 20 * 4 * 8 * 32 * 2; break;
+	case 3: m_videoCycles += 80 * 8 * 25 * 2; break;
+	case 4: m_videoCycles += 40 * 8 * 32 * 2; break;
+	case 5: m_videoCycles += 20 * 2 * 8 * 32 * 2; break;
+	case 6: m_videoCycles += 40 * 8 * 25 * 2; break;
+	}
+	return frame;
+}
+
+// Marks the image lines that show the written bytes, they are captured when the beam reaches them
+void Ula::ScreenWritten(uint16_t address, int size)
+{
+	const ScreenLayout& layout = screenLayouts[ScreenMode()];
+	if (size == 1)
+	{
+		int offset = ScreenOffset(layout, m_frameStart, address);
+		int row = offset / layout.rowBytes;
+		if (offset >= 0 && row < layout.rows)
+			m_dirtyLines[layout.top + row * layout.rowHeight + (offset & 7)] = true;
+		return;
+	}
+
+	auto markRow = [this, &layout](size_t address)
+	{
+		int row = ScreenOffset(layout, m_frameStart, address) / layout.rowBytes;
+		for (int line = 0; line < 8 && row < layout.rows; ++line)
+			m_dirtyLines[layout.top + row * layout.rowHeight + line] = true;
+	};
+
+	size_t first = std::max<size_t>(address, layout.screenMin);
+	size_t last = std::min<size_t>(address + size, 0x8000);
+	if (first >= last)
+		return;
+	// Within screen memory consecutive addresses change row at most once per rowBytes
+	for (size_t scan = first; scan < last - 1; scan += layout.rowBytes)
+		markRow(scan);
+	markRow(last - 1);
+}
+
+// Redraws the complete screen, after screen memory was changed without ScreenWritten()
+void Ula::InvalidateScreen()
+{
+	m_dirtyLines.set();
 }
 
 } // namespace DjeeDjay
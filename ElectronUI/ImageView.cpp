@@ -35,6 +35,12 @@ void ImageView::BackgroundColor(COLORREF value)
 }
 
 void ImageView::Update(const Image& image)
+{
+	Update(image, 0, image.Height());
+}
+
+// Only lines firstLine up to lastLine are copied when the bitmap size is unchanged
+void ImageView::Update(const Image& image, int firstLine, int lastLine)
 {
 	CreateGraphicsResources();
 
@@ -44,8 +50,8 @@ void ImageView::Update(const Image& image)
 
 	if (m_pIBitmap && size.width == static_cast<unsigned>(image.Width()) && size.height == static_cast<unsigned>(image.Height()))
 	{
-		auto rect = D2D1::RectU(0, 0, size.width, size.height);
-		Win32::ThrowFailed(m_pIBitmap->CopyFromMemory(&rect, image.Data(), image.Stride()));
+		auto rect = D2D1::RectU(0, firstLine, size.width, lastLine);
+		Win32::ThrowFailed(m_pIBitmap->CopyFromMemory(&rect, image.Data() + firstLine * image.Width(), image.Stride()));
 	}
 	else
 	{
@@ -21,6 +21,7 @@ public:
 	COLORREF BackgroundColor() const;
 	void BackgroundColor(COLORREF value);
 	void Update(const Image& image);
+	void Update(const Image& image, int firstLine, int lastLine);
 
 private:
 	DECLARE_MSG_MAP()
@@ -1,9 +1,12 @@
 // (C) Copyright Gert-Jan de Vos 2021.
 
 #include "stdafx.h"
+#include <algorithm>
 #include <vector>
 #include <fstream>
 #include <iterator>
+#include <iomanip>
+#include <sstream>
 #include "resource.h"
 #include "DjeeDjay/string_cast.h"
 #include "DjeeDjay/Win32/Clipboard.h"
@@ -172,9 +175,14 @@ ElectronKey MakeElectronKey(UINT keyCode)
 
 BEGIN_UPDATE_UI_MAP2(MainFrame)
 	UPDATE_ELEMENT(IDM_ELECTRON_MUTE, UPDUI_MENUPOPUP)
+	UPDATE_ELEMENT(IDM_ELECTRON_SPEED_REAL_TIME, UPDUI_MENUPOPUP)
+	UPDATE_ELEMENT(IDM_ELECTRON_SPEED_4X, UPDUI_MENUPOPUP)
+	UPDATE_ELEMENT(IDM_ELECTRON_SPEED_UNLIMITED, UPDUI_MENUPOPUP)
+	UPDATE_ELEMENT(IDM_ELECTRON_RUN_AHEAD, UPDUI_MENUPOPUP)
 	UPDATE_ELEMENT(0, UPDUI_STATUSBAR)
 	UPDATE_ELEMENT(1, UPDUI_STATUSBAR)
 	UPDATE_ELEMENT(2, UPDUI_STATUSBAR)
+	UPDATE_ELEMENT(3, UPDUI_STATUSBAR)
 END_UPDATE_UI_MAP()
 
 BEGIN_MSG_MAP2(MainFrame)
@@ -189,22 +197,27 @@ BEGIN_MSG_MAP2(MainFrame)
 	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_MUTE, OnMute)
 	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_COPY_SCREEN, OnCopyScreen)
 	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_FULL_SCREEN, OnFullScreen)
+	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_SPEED_REAL_TIME, OnSpeed)
+	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_SPEED_4X, OnSpeed)
+	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_SPEED_UNLIMITED, OnSpeed)
+	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_RUN_AHEAD, OnRunAhead)
 	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_BREAK, OnElectronBreak)
 	COMMAND_ID_HANDLER_EX(IDM_ELECTRON_RESTART, OnElectronRestart)
 	COMMAND_ID_HANDLER_EX(ID_CPU_EXCEPTION, OnCpuException)
 	COMMAND_ID_HANDLER_EX(ID_FRAME_COMPLETED, OnFrameCompleted)
 	COMMAND_ID_HANDLER_EX(ID_CAPSLOCK_CHANGED, OnCapsLockChanged)
 	COMMAND_ID_HANDLER_EX(ID_CASSETTEMOTOR_CHANGED, OnCassetteMotorChanged)
-	COMMAND_ID_HANDLER_EX(ID_PLAY_SOUND, OnPlaySound)
 	CHAIN_MSG_MAP(CUpdateUI<MainFrame>)
 	CHAIN_MSG_MAP(CFrameWindowImpl<MainFrame>)
 END_MSG_MAP()
 
 MainFrame::MainFrame() :
 	m_mute(false),
-	m_stop(false),
-	m_electron(ExtractResourceData(IDR_OS_ROM)),
-	m_qChanged(false)
+	m_speed(1),
+	m_runAhead(0),
+	m_framePosted(false),
+	m_running(false),
+	m_electron(ExtractResourceData(IDR_OS_ROM))
 {
 	m_electron.InstallRom(10, ExtractResourceData(IDR_BASIC_ROM));
 }
@@ -212,6 +225,10 @@ MainFrame::MainFrame() :
 BOOL MainFrame::OnIdle()
 {
 	UISetCheck(IDM_ELECTRON_MUTE, m_mute);
+	UISetCheck(IDM_ELECTRON_SPEED_REAL_TIME, m_speed == 1);
+	UISetCheck(IDM_ELECTRON_SPEED_4X, m_speed == 4);
+	UISetCheck(IDM_ELECTRON_SPEED_UNLIMITED, m_speed == 0);
+	UISetCheck(IDM_ELECTRON_RUN_AHEAD, m_runAhead > 0);
 	UIUpdateToolBar();
 	UIUpdateStatusBar();
 	UIUpdateChildWindows();
@@ -241,8 +258,8 @@ LRESULT MainFrame::OnCreate(const CREATESTRUCT* /*pCreate*/)
 	m_hWndStatusBar = m_statusBar.Create(*this);
 	UIAddStatusBar(m_hWndStatusBar);
 
-	int paneIds[] = { ID_DEFAULT_PANE, ID_CAPSLOCK_PANE, ID_CASSETTEMOTOR_PANE };
-	m_statusBar.SetPanes(paneIds, 3, false);
+	int paneIds[] = { ID_DEFAULT_PANE, ID_CAPSLOCK_PANE, ID_CASSETTEMOTOR_PANE, ID_SPEED_PANE };
+	m_statusBar.SetPanes(paneIds, 4, false);
 
 	//HWND hWndToolBar = CreateSimpleToolBarCtrl(rebar, IDR_MAINFRAME, FALSE, ATL_SIMPLE_TOOLBAR_PANE_STYLE);
 	//AddSimpleReBarBand(hWndToolBar, nullptr, true);
@@ -266,6 +283,7 @@ LRESULT MainFrame::OnCreate(const CREATESTRUCT* /*pCreate*/)
 	auto sz = frameRect.Size() - clientRect.Size();
 	m_frameSize = CPoint(640 + sz.cx, 512 + cmdBarRect.Height() + statusRect.Height() + sz.cy);
 
+	m_running = true;
 	m_thread = std::thread([this]() { Run(); });
 
 	DragAcceptFiles(true);
@@ -279,7 +297,9 @@ BOOL MainFrame::PreTranslateMessage(MSG* pMsg)
 
 void MainFrame::OnClose()
 {
-	RunElectron([this]() { m_stop = true; });
+	// Stop must not be dropped while the emulation runs, a stopped emulation thread is joined right away
+	while (m_running && !m_electron.Post(HostCommand::Stop()))
+		std::this_thread::yield();
 	m_thread.join();
 
 	DestroyWindow();
@@ -299,7 +319,7 @@ void MainFrame::OnKeyDown(UINT nChar, UINT /*nRepCnt*/, UINT /*nFlags*/)
 	auto key = MakeElectronKey(nChar);
 //	OutputDebugStringA(("OnKeyDown(" + std::to_string(nChar) + ") -> " + ToString(key) + "\n").c_str());
 	if (key != ElectronKey::None)
-		RunElectron([this, key]() { m_electron.KeyDown(key); });
+		RunElectron(HostCommand::KeyDown(key));
 	else
 		SetMsgHandled(false);
 }
@@ -308,7 +328,7 @@ void MainFrame::OnKeyUp(UINT nChar, UINT /*nRepCnt*/, UINT /*nFlags*/)
 {
 	auto key = MakeElectronKey(nChar);
 	if (key != ElectronKey::None)
-		RunElectron([this, key]() { m_electron.KeyUp(key); });
+		RunElectron(HostCommand::KeyUp(key));
 	else
 		SetMsgHandled(false);
 }
@@ -379,16 +399,14 @@ void MainFrame::OnFileInsertRom(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 void MainFrame::OnMute(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 {
 	m_mute = !m_mute;
-	if (m_mute)
-		m_speaker.Stop();
 }
 
 void MainFrame::OnCopyScreen(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	int scale = m_image.Width() < 640 ? 1 : 2;
-	auto image = Upscale(m_image, scale * 320 / m_image.Width(), scale * 256 / m_image.Height());
-	lock.unlock();
+	if (m_rgbImage.Width() == 0)
+		return;
+	int scale = m_rgbImage.Width() < 640 ? 1 : 2;
+	auto image = Upscale(m_rgbImage, scale * 320 / m_rgbImage.Width(), scale * 256 / m_rgbImage.Height());
 	Win32::CopyToClipboard(image, *this);
 }
 
@@ -401,14 +419,32 @@ void MainFrame::OnFullScreen(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 		SetWindowed();
 }
 
+void MainFrame::OnSpeed(UINT /*uCode*/, int nID, HWND /*hwndCtrl*/)
+{
+	switch (nID)
+	{
+	case IDM_ELECTRON_SPEED_4X: m_speed = 4; break;
+	case IDM_ELECTRON_SPEED_UNLIMITED: m_speed = 0; break;
+	default: m_speed = 1; break;
+	}
+	RunElectron(HostCommand::Speed(m_speed));
+}
+
+// One frame ahead hides the keyboard scan latency of most games
+void MainFrame::OnRunAhead(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
+{
+	m_runAhead = m_runAhead > 0 ? 0 : 1;
+	RunElectron(HostCommand::RunAhead(m_runAhead));
+}
+
 void MainFrame::OnElectronBreak(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 {
-	RunElectron([this]() { m_electron.Break(); });
+	RunElectron(HostCommand::Break());
 }
 
 void MainFrame::OnElectronRestart(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 {
-	RunElectron([this]() { m_electron.Restart(); });
+	RunElectron(HostCommand::Restart());
 }
 
 void MainFrame::OnCpuException(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
@@ -418,9 +454,31 @@ void MainFrame::OnCpuException(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 
 void MainFrame::OnFrameCompleted(UINT /*uCode*/, int /*nID*/, HWND /*hwndCtrl*/)
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_imageView.Update(m_image);
-	lock.unlock();
+	// Show the last waiting frame with the lines that changed in all of them
+	m_framePosted = false;
+	ShowSpeed();
+
+	const Frame* frame = nullptr;
+	int firstLine = 0;
+	int lastLine = 0;
+	while (const Frame* next = m_electron.ReceiveFrame())
+	{
+		if (frame)
+			m_electron.ReleaseFrame(frame);
+		frame = next;
+		if (frame->changes.firstLine == frame->changes.lastLine)
+			continue;
+		firstLine = firstLine == lastLine ? frame->changes.firstLine : std::min(firstLine, frame->changes.firstLine);
+		lastLine = std::max(lastLine, frame->changes.lastLine);
+	}
+	if (!frame)
+		return;
+
+	if (firstLine != lastLine)
+		ToRgb(frame->image, firstLine, lastLine, m_rgbImage);
+	m_electron.ReleaseFrame(frame);
+	if (firstLine != lastLine)
+		m_imageView.Update(m_rgbImage, firstLine, lastLine);
 }
 
 void MainFrame::OnCapsLockChanged(UINT uCode, int /*nID*/, HWND /*hwndCtrl*/)
@@ -433,15 +491,13 @@ void MainFrame::OnCassetteMotorChanged(UINT uCode, int /*nID*/, HWND /*hwndCtrl*
 	UISetText(ID_CASSETTEMOTOR_PANE, uCode ? L"CASSETTE MOTOR" : L"");
 }
 
-void MainFrame::OnPlaySound(UINT uCode, int /*nID*/, HWND /*hwndCtrl*/)
+void MainFrame::ShowSpeed()
 {
-	if (!m_mute)
-	{
-		if (uCode == 0)
-			m_speaker.Stop();
-		else
-			m_speaker.Play(uCode);
-	}
+	std::wostringstream ss;
+	ss << std::fixed << std::setprecision(2) << m_electron.Mhz() << L" MHz, " << std::setprecision(0) << m_electron.FramesPerSecond() << L" fps";
+	if (m_runAhead > 0)
+		ss << L", run ahead " << m_electron.RunAheadCost() << L" \u00b5s";
+	UISetText(ID_SPEED_PANE, ss.str().c_str());
 }
 
 void MainFrame::SetFullscreen()
@@ -473,28 +529,33 @@ void MainFrame::SetWindowed()
 
 void MainFrame::InstallRom(const std::wstring& filename)
 {
-	RunElectron([this, filename]()
-	{
-		m_electron.InstallRom(2, Load(filename.c_str()));
-		m_electron.Break();
-	});
+	RunElectron(HostCommand::InstallRom(2, Load(filename.c_str())));
 }
 
-void MainFrame::OnFrameCompleted(const Image& image)
+// Called on the render thread, a single message shows all frames that are waiting
+void MainFrame::OnFrameCompleted()
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_image = image;
-	lock.unlock();
+	if (!m_framePosted.exchange(true))
+		PostMessage(WM_COMMAND, ID_FRAME_COMPLETED);
+}
 
-	PostMessage(WM_COMMAND, ID_FRAME_COMPLETED);
+// Called on the emulation thread, which owns the speaker
+void MainFrame::OutputSound(const int16_t* samples, size_t count)
+{
+	if (m_mute)
+		m_speaker.Stop();
+	else
+		m_speaker.Write(samples, count);
 }
 
-void MainFrame::RunElectron(std::function<void ()> fn)
+// The emulation thread empties the queue every frame. A full queue means that it has fallen behind
+// or stopped, so the command is dropped rather than blocking the UI thread.
+void MainFrame::RunElectron(HostCommand command)
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_q.push_back(std::move(fn));
-	lock.unlock();
-	m_qChanged = true;
+	if (!m_running)
+		return;
+	if (!m_electron.Post(std::move(command)))
+		OutputDebugStringA("Electron command queue is full, command dropped\n");
 }
 
 void MainFrame::Run()
@@ -503,29 +564,19 @@ void MainFrame::Run()
 	PostMessage(WM_COMMAND, MAKELONG(ID_CASSETTEMOTOR_CHANGED, m_electron.CassetteMotor()));
 
 	m_electron.Trace([](const std::string& msg) { OutputDebugStringA(msg.c_str()); });
-	m_electron.FrameCompleted([this](const Image& image) { OnFrameCompleted(image); });
+	m_electron.FrameCompleted([this]() { OnFrameCompleted(); });
+	m_electron.Rendering(FrameRendering::Auto);
 	m_electron.CapsLock([this](bool value) { PostMessage(WM_COMMAND, MAKELONG(ID_CAPSLOCK_CHANGED, value)); });
 	m_electron.CassetteMotor([this](bool value) { PostMessage(WM_COMMAND, MAKELONG(ID_CASSETTEMOTOR_CHANGED, value)); });
-	m_electron.Speaker([this](int frequency) { PostMessage(WM_COMMAND, MAKELONG(ID_PLAY_SOUND, frequency)); });
+	m_electron.SampleRate(m_speaker.SampleRate());
+	m_electron.Sound([this](const int16_t* samples, size_t count) { OutputSound(samples, count); });
 
 	m_electron.Restart();
 
 	try
 	{
-		while (!m_stop)
+		while (m_electron.RunUntilFrameEnd().reason != StopReason::Stopped)
 		{
-			if (m_qChanged.exchange(false))
-			{
-				std::vector<std::function<void ()>> q;
-				std::unique_lock<std::mutex> lock(m_mtx);
-				m_q.swap(q);
-				lock.unlock();
-				for (auto& fn : q)
-				{
-					fn();
-				}
-			}
-			m_electron.Step();
 		}
 	}
 	catch (std::exception& ex)
@@ -533,6 +584,7 @@ void MainFrame::Run()
 		m_cpuExceptionMessage = ex.what();
 		PostMessage(WM_COMMAND, ID_CPU_EXCEPTION);
 	}
+	m_running = false;
 }
 
 } // namespace DjeeDjay
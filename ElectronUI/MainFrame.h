@@ -4,8 +4,6 @@
 
 #include <atomic>
 #include <thread>
-#include <mutex>
-#include <vector>
 #include "DjeeDjay/Win32/AtlWinExt.h"
 #include "DjeeDjay/Electron.h"
 #include "DjeeDjay/Image.h"
@@ -45,21 +43,24 @@ private:
 	void OnMute(UINT uCode, int nID, HWND hwndCtrl);
 	void OnCopyScreen(UINT uCode, int nID, HWND hwndCtrl);
 	void OnFullScreen(UINT uCode, int nID, HWND hwndCtrl);
+	void OnSpeed(UINT uCode, int nID, HWND hwndCtrl);
+	void OnRunAhead(UINT uCode, int nID, HWND hwndCtrl);
 	void OnElectronBreak(UINT uCode, int nID, HWND hwndCtrl);
 	void OnElectronRestart(UINT uCode, int nID, HWND hwndCtrl);
 	void OnCpuException(UINT uCode, int nID, HWND hwndCtrl);
 	void OnFrameCompleted(UINT uCode, int nID, HWND hwndCtrl);
 	void OnCapsLockChanged(UINT uCode, int nID, HWND hwndCtrl);
 	void OnCassetteMotorChanged(UINT uCode, int nID, HWND hwndCtrl);
-	void OnPlaySound(UINT uCode, int nID, HWND hwndCtrl);
 
+	void ShowSpeed();
 	void SetFullscreen();
 	void SetWindowed();
 
 	void InstallRom(const std::wstring& filename);
 
-	void OnFrameCompleted(const Image& image);
-	void RunElectron(std::function<void ()> fn);
+	void OnFrameCompleted();
+	void OutputSound(const int16_t* samples, size_t count);
+	void RunElectron(HostCommand command);
 	void Run();
 
 	CCommandBarCtrl m_cmdBar;
@@ -69,14 +70,14 @@ private:
 	WINDOWPLACEMENT m_windowPlacement;
 	ImageView m_imageView;
 	Speaker m_speaker;
-	bool m_mute;
-	std::mutex m_mtx;
-	Image m_image;
-	bool m_stop;
+	std::atomic<bool> m_mute;
+	double m_speed;
+	int m_runAhead;
+	std::atomic<bool> m_framePosted;
+	std::atomic<bool> m_running;	// Cleared when Run() returns, nothing drains the command queue after that
+	Image m_rgbImage;		// The shown frame, used on the UI thread only
 	std::thread m_thread;
 	Electron m_electron;
-	std::vector<std::function<void ()>> m_q;
-	std::atomic<bool> m_qChanged;
 	std::string m_cpuExceptionMessage;
 };
 
@@ -4,6 +4,7 @@
 
 #define ID_CAPSLOCK_PANE        1
 #define ID_CASSETTEMOTOR_PANE   2
+#define ID_SPEED_PANE           3
 #define IDR_MAINFRAME			128
 #define IDR_CONTEXT_MENU        129
 #define IDM_FILE_INSERT_ROM     101
@@ -18,6 +19,10 @@
 #define IDI_SMALL				110
 #define IDR_OS_ROM              111
 #define IDR_BASIC_ROM           112
+#define IDM_ELECTRON_SPEED_REAL_TIME 113
+#define IDM_ELECTRON_SPEED_4X   114
+#define IDM_ELECTRON_SPEED_UNLIMITED 115
+#define IDM_ELECTRON_RUN_AHEAD  116
 #ifndef IDC_STATIC
 #define IDC_STATIC				-1
 #endif
@@ -25,7 +30,6 @@
 #define ID_FRAME_COMPLETED     1001
 #define ID_CAPSLOCK_CHANGED    1002
 #define ID_CASSETTEMOTOR_CHANGED 1003
-#define ID_PLAY_SOUND          1004
 
 
 // Next default values for new objects
@@ -37,6 +41,6 @@
 #define _APS_NEXT_RESOURCE_VALUE	129
 #define _APS_NEXT_COMMAND_VALUE		32771
 #define _APS_NEXT_CONTROL_VALUE		1005
-#define _APS_NEXT_SYMED_VALUE		113
+#define _APS_NEXT_SYMED_VALUE		117
 #endif
 #endif
@@ -1,6 +1,7 @@
 ﻿// (C) Copyright Gert-Jan de Vos 2021.
 
 #define NOMINMAX
+#include <algorithm>
 #include "DjeeDjay/Win32/ComApi.h"
 #include "Speaker.h"
 
@@ -8,10 +9,26 @@
 
 namespace DjeeDjay {
 
-Speaker::Speaker() :
-	m_dsbdesc(),
+namespace {
+
+// The buffer holds 250 ms, writes aim for Latency ahead of the play cursor and never get further ahead than MaxAhead
+constexpr DWORD BufferMs = 250;
+constexpr DWORD LatencyMs = 60;
+constexpr DWORD MaxAheadMs = 150;
+
+DWORD Bytes(const WAVEFORMATEX& wfx, DWORD ms)
+{
+	return wfx.nAvgBytesPerSec * ms / 1000 / wfx.nBlockAlign * wfx.nBlockAlign;
+}
+
+} // namespace
+
+Speaker::Speaker(int sampleRate) :
 	m_wfx(),
-	m_amplitude(0.05)
+	m_bufferBytes(0),
+	m_writePosition(0),
+	m_playing(false),
+	m_amplitude(0.1)
 {
 	Win32::ThrowFailed(DirectSoundCreate(nullptr, &m_pIDirectSound, nullptr));
 	Win32::ThrowFailed(m_pIDirectSound->SetCooperativeLevel(GetDesktopWindow(), DSSCL_NORMAL));
@@ -19,14 +36,23 @@ Speaker::Speaker() :
 	m_wfx.wFormatTag = WAVE_FORMAT_PCM;
 	m_wfx.nChannels = 1;
 	m_wfx.wBitsPerSample = 16;
-	m_wfx.nSamplesPerSec = 44100;
+	m_wfx.nSamplesPerSec = sampleRate;
 	m_wfx.nBlockAlign = m_wfx.nChannels * m_wfx.wBitsPerSample / 8;
 	m_wfx.nAvgBytesPerSec = m_wfx.nSamplesPerSec * m_wfx.nBlockAlign;
 	m_wfx.cbSize = 0;
+	m_bufferBytes = Bytes(m_wfx, BufferMs);
+
+	DSBUFFERDESC dsbdesc = {};
+	dsbdesc.dwSize = sizeof(dsbdesc);
+	dsbdesc.dwFlags = DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_GLOBALFOCUS;
+	dsbdesc.dwBufferBytes = m_bufferBytes;
+	dsbdesc.lpwfxFormat = &m_wfx;
+	Win32::ThrowFailed(m_pIDirectSound->CreateSoundBuffer(&dsbdesc, &m_pIBuffer, nullptr));
+}
 
-	m_dsbdesc.dwSize = sizeof(m_dsbdesc);
-	m_dsbdesc.dwFlags = DSBCAPS_CTRLPOSITIONNOTIFY | DSBCAPS_CTRLFREQUENCY | DSBCAPS_GLOBALFOCUS;
-	m_dsbdesc.lpwfxFormat = &m_wfx;
+int Speaker::SampleRate() const
+{
+	return m_wfx.nSamplesPerSec;
 }
 
 double Speaker::Amplitude() const
@@ -39,76 +65,73 @@ void Speaker::Amplitude(double value)
 	m_amplitude = value;
 }
 
-void Speaker::Play(int frequency)
+// Each write is followed by up to the same length of silence, so running out of samples plays silence instead of old sound.
+// Samples that do not fit in the buffer are dropped.
+void Speaker::Write(const int16_t* samples, size_t count)
 {
-	Stop();
-
-	frequency = std::min(frequency, 32767);
-	frequency = std::max(frequency, 37);
-
-	// 1/frequency = period of wave, in seconds
-	// SamplingRate / frequency = samples per wave-period
-	int halfPeriod = std::max<int>(m_wfx.nSamplesPerSec * m_wfx.nChannels / (2 * frequency), 1);
-	// The above line introduces roundoff error, which at higher
-	// frequencies is significant (>30% at the 32kHz,
-	// easily above 1% in general, not good). We will fix this below.
-
-	m_dsbdesc.dwBufferBytes = 2 * halfPeriod * m_wfx.wBitsPerSample / 8;
-	Win32::ThrowFailed(m_pIDirectSound->CreateSoundBuffer(&m_dsbdesc, &m_pIBuffer, nullptr));
-
-	// Frequency adjustment to correct for the roundoff error above.
-	DWORD playFrequency;
-	Win32::ThrowFailed(m_pIBuffer->GetFrequency(&playFrequency));
-
-	// When we set the half_period above, we rounded down, so if
-	// we play the buffer as is, it will sound higher frequency
-	// than it ought to be.
-	// To compensate, we should play the buffer at a slower speed.
-	// The slowdown factor is precisely the rounded-down period
-	// divided by the true period:
-	//   half_period / [ SamplingRate * Channels / (2*frequency) ]
-	// = 2*frequency*half_period / (SamplingRate * Channels)
-	//
-	// The adjusted frequency needs to be multiplied by this factor:
-	//   play_freq *= 2*frequency*half_period / (SamplingRate * Channels)
-	// To do this computation (in a way that works on 32-bit machines),
-	// we cannot multiply the numerator directly, since that may
-	// cause rounding problems (44100 * 2*44100*1 ~ 3.9 billion which
-	// is uncomfortable close to the upper limit of 4.3 billion).
-	// Therefore, we use MulDiv to safely (and efficiently) avoid any
-	// problems.
-	playFrequency = MulDiv(playFrequency, 2 * frequency * halfPeriod, m_wfx.nSamplesPerSec * m_wfx.nChannels);
-	Win32::ThrowFailed(m_pIBuffer->SetFrequency(playFrequency));
-
-	void* pWrite;
-	DWORD dwLen;
-	Win32::ThrowFailed(m_pIBuffer->Lock(0, m_dsbdesc.dwBufferBytes, &pWrite, &dwLen, nullptr, nullptr, DSBLOCK_ENTIREBUFFER));
-	auto p = static_cast<int16_t*>(pWrite);
-
-	int16_t amplitude = static_cast<int16_t>(m_amplitude * ((1 << (m_wfx.wBitsPerSample - 1)) - 1));
-	for (int i = 0; i < halfPeriod; ++i)
+	if (count == 0)
+		return;
+
+	if (!m_playing)
 	{
-		for (int j = 0; j < m_wfx.nChannels; ++j)
-			*p++ = -amplitude;
+		Fill(0, m_bufferBytes, nullptr, 0);
+		Win32::ThrowFailed(m_pIBuffer->SetCurrentPosition(0));
+		Win32::ThrowFailed(m_pIBuffer->Play(0, 0, DSBPLAY_LOOPING));
+		m_writePosition = Bytes(m_wfx, LatencyMs);
+		m_playing = true;
 	}
-	for (int i = 0; i < halfPeriod; ++i)
+
+	DWORD playCursor, writeCursor;
+	Win32::ThrowFailed(m_pIBuffer->GetCurrentPosition(&playCursor, &writeCursor));
+	DWORD ahead = (m_writePosition + m_bufferBytes - playCursor) % m_bufferBytes;
+	DWORD minAhead = (writeCursor + m_bufferBytes - playCursor) % m_bufferBytes;
+	if (ahead < minAhead || ahead > Bytes(m_wfx, MaxAheadMs))
 	{
-		for (int j = 0; j < m_wfx.nChannels; ++j)
-			*p++ = +amplitude;
+		m_writePosition = (playCursor + Bytes(m_wfx, LatencyMs)) % m_bufferBytes;
+		ahead = Bytes(m_wfx, LatencyMs);
 	}
 
-	Win32::ThrowFailed(m_pIBuffer->Unlock(pWrite, dwLen, nullptr, 0));
-	Win32::ThrowFailed(m_pIBuffer->SetCurrentPosition(0));
-	Win32::ThrowFailed(m_pIBuffer->Play(0, 0, DSBPLAY_LOOPING));
+	DWORD space = m_bufferBytes - ahead - m_wfx.nBlockAlign;
+	DWORD bytes = std::min(static_cast<DWORD>(count * m_wfx.nBlockAlign), space);
+	DWORD silence = std::min(bytes, space - bytes);
+	Fill(m_writePosition, bytes + silence, samples, bytes / m_wfx.nBlockAlign);
+	m_writePosition = (m_writePosition + bytes) % m_bufferBytes;
 }
 
 void Speaker::Stop()
 {
-	if (m_pIBuffer)
+	if (m_playing)
 	{
 		m_pIBuffer->Stop();
-		m_pIBuffer = nullptr;
+		m_playing = false;
 	}
 }
 
+// Writes count samples at offset and silence up to bytes
+void Speaker::Fill(DWORD offset, DWORD bytes, const int16_t* samples, size_t count)
+{
+	void* p1;
+	DWORD size1;
+	void* p2;
+	DWORD size2;
+	Win32::ThrowFailed(m_pIBuffer->Lock(offset, bytes, &p1, &size1, &p2, &size2, 0));
+
+	auto scale = [this](int16_t sample) { return static_cast<int16_t>(sample * m_amplitude); };
+	auto write = [&](void* p, DWORD size)
+	{
+		auto out = static_cast<int16_t*>(p);
+		size_t n = size / sizeof(int16_t);
+		size_t copy = std::min(n, count);
+		std::transform(samples, samples + copy, out, scale);
+		std::fill(out + copy, out + n, static_cast<int16_t>(0));
+		samples += copy;
+		count -= copy;
+	};
+	write(p1, size1);
+	if (p2)
+		write(p2, size2);
+
+	Win32::ThrowFailed(m_pIBuffer->Unlock(p1, size1, p2, size2));
+}
+
 } // namespace DjeeDjay
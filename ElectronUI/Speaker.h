@@ -2,28 +2,38 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <atlcomcli.h>
 #include <mmreg.h>
 #include <dsound.h>
 
 namespace DjeeDjay {
 
+// Streams 16 bit mono PCM through a looping DirectSound buffer
 class Speaker
 {
 public:
-	Speaker();
+	explicit Speaker(int sampleRate = 44100);
+
+	int SampleRate() const;
 
 	double Amplitude() const;
 	void Amplitude(double value);
 
-	void Play(int frequency);
+	// Starts playing when stopped. Samples that arrive late or too far ahead resynchronise the stream.
+	void Write(const int16_t* samples, size_t count);
 	void Stop();
 
 private:
+	void Fill(DWORD offset, DWORD bytes, const int16_t* samples, size_t count);
+
 	CComPtr<IDirectSound> m_pIDirectSound;
 	CComPtr<IDirectSoundBuffer> m_pIBuffer;
-	DSBUFFERDESC m_dsbdesc;
 	WAVEFORMATEX m_wfx;
+	DWORD m_bufferBytes;
+	DWORD m_writePosition;
+	bool m_playing;
 	double m_amplitude;
 };
 
@@ -0,0 +1,170 @@
+﻿// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <cstddef>
+#include "DjeeDjay/Image.h"
+#include "DjeeDjay/IndexedImage.h"
+
+// The SSSE3 conversion is compiled for every x86 target and selected at run time
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <tmmintrin.h>
+#define DJEEDJAY_SSSE3
+#define DJEEDJAY_TARGET_SSSE3
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <tmmintrin.h>
+#define DJEEDJAY_SSSE3
+#define DJEEDJAY_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
+namespace DjeeDjay {
+
+IndexedImage::IndexedImage() :
+	m_width(0),
+	m_height(0),
+	m_palette()
+{
+}
+
+void IndexedImage::Resize(int width, int height)
+{
+	if (width != m_width || height != m_height)
+	{
+		m_width = width;
+		m_height = height;
+		m_data.resize(height * width);
+	}
+}
+
+int IndexedImage::Width() const
+{
+	return m_width;
+}
+
+int IndexedImage::Height() const
+{
+	return m_height;
+}
+
+uint8_t IndexedImage::operator()(int x, int y) const
+{
+	return m_data[y * m_width + x];
+}
+
+uint8_t& IndexedImage::operator()(int x, int y)
+{
+	return m_data[y * m_width + x];
+}
+
+uint8_t* IndexedImage::Data()
+{
+	return m_data.data();
+}
+
+const uint8_t* IndexedImage::Data() const
+{
+	return m_data.data();
+}
+
+int IndexedImage::Stride() const
+{
+	return m_width;
+}
+
+const IndexedImage::PaletteType& IndexedImage::Palette() const
+{
+	return m_palette;
+}
+
+void IndexedImage::Palette(const PaletteType& palette)
+{
+	m_palette = palette;
+}
+
+namespace {
+
+void IndexToRgbScalar(const uint8_t* in, uint32_t* out, size_t size, const IndexedImage::PaletteType& palette)
+{
+	for (size_t i = 0; i < size; ++i)
+		out[i] = palette[in[i] & 0x0f];
+}
+
+#ifdef DJEEDJAY_SSSE3
+
+bool HasSsse3()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+// Looks up 16 pixels at a time: each byte of the RGB palette entries is a 16 byte shuffle table
+DJEEDJAY_TARGET_SSSE3 void IndexToRgbSsse3(const uint8_t* in, uint32_t* out, size_t size, const IndexedImage::PaletteType& palette)
+{
+	alignas(16) uint8_t planes[4][16];
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int b = 0; b < 4; ++b)
+			planes[b][i] = static_cast<uint8_t>(palette[i] >> (8 * b));
+	}
+	__m128i plane0 = _mm_load_si128(reinterpret_cast<const __m128i*>(planes[0]));
+	__m128i plane1 = _mm_load_si128(reinterpret_cast<const __m128i*>(planes[1]));
+	__m128i plane2 = _mm_load_si128(reinterpret_cast<const __m128i*>(planes[2]));
+	__m128i plane3 = _mm_load_si128(reinterpret_cast<const __m128i*>(planes[3]));
+	__m128i mask = _mm_set1_epi8(0x0f);
+
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i index = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), mask);
+		__m128i b0 = _mm_shuffle_epi8(plane0, index);
+		__m128i b1 = _mm_shuffle_epi8(plane1, index);
+		__m128i b2 = _mm_shuffle_epi8(plane2, index);
+		__m128i b3 = _mm_shuffle_epi8(plane3, index);
+		__m128i lo01 = _mm_unpacklo_epi8(b0, b1);
+		__m128i hi01 = _mm_unpackhi_epi8(b0, b1);
+		__m128i lo23 = _mm_unpacklo_epi8(b2, b3);
+		__m128i hi23 = _mm_unpackhi_epi8(b2, b3);
+		__m128i* p = reinterpret_cast<__m128i*>(out + i);
+		_mm_storeu_si128(p + 0, _mm_unpacklo_epi16(lo01, lo23));
+		_mm_storeu_si128(p + 1, _mm_unpackhi_epi16(lo01, lo23));
+		_mm_storeu_si128(p + 2, _mm_unpacklo_epi16(hi01, hi23));
+		_mm_storeu_si128(p + 3, _mm_unpackhi_epi16(hi01, hi23));
+	}
+	IndexToRgbScalar(in + i, out + i, size - i, palette);
+}
+
+#endif
+
+void IndexToRgb(const uint8_t* in, uint32_t* out, size_t size, const IndexedImage::PaletteType& palette)
+{
+#ifdef DJEEDJAY_SSSE3
+	static const bool ssse3 = HasSsse3();
+	if (ssse3)
+	{
+		IndexToRgbSsse3(in, out, size, palette);
+		return;
+	}
+#endif
+	IndexToRgbScalar(in, out, size, palette);
+}
+
+} // namespace
+
+void ToRgb(const IndexedImage& image, Image& rgb)
+{
+	ToRgb(image, 0, image.Height(), rgb);
+}
+
+// Converts lines firstLine up to lastLine, the other lines of rgb are kept when its size is unchanged
+void ToRgb(const IndexedImage& image, int firstLine, int lastLine, Image& rgb)
+{
+	rgb.Resize(image.Width(), image.Height());
+	size_t offset = static_cast<size_t>(firstLine) * image.Width();
+	IndexToRgb(image.Data() + offset, rgb.Data() + offset, static_cast<size_t>(lastLine - firstLine) * image.Width(), image.Palette());
+}
+
+} // namespace DjeeDjay
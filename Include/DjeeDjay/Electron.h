@@ -3,11 +3,19 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <functional>
 #include <chrono>
-#include "DjeeDjay/Image.h"
+#include <string>
+#include <vector>
+#include "DjeeDjay/MpscQueue.h"
 #include "DjeeDjay/MOS6502.h"
+#include "DjeeDjay/Electron/MemoryMap.h"
+#include "DjeeDjay/Electron/Scheduler.h"
 #include "DjeeDjay/Electron/Ula.h"
+#include "DjeeDjay/Electron/RenderWorker.h"
+#include "DjeeDjay/Electron/FramePacer.h"
+#include "DjeeDjay/Electron/AudioPacer.h"
 
 namespace DjeeDjay {
 
@@ -70,16 +78,89 @@ enum class ElectronKey
 	Shift
 };
 
-class Electron : public Memory
+enum class StopReason
+{
+	CycleLimit,
+	FrameEnd,
+	Predicate,
+	Breakpoint,
+	Stopped
+};
+
+enum class FrameRendering
+{
+	Always,
+	OnRequest,	// Only the frame after each RequestFrame() is drawn
+	Auto		// Frames are skipped while the emulation runs behind real time
+};
+
+enum class ClockSource
+{
+	Wall,
+	Audio		// Frames run when the consumer of the audio output needs more samples
+};
+
+struct RunResult
+{
+	uint64_t cycles;
+	StopReason reason;
+};
+
+enum class HostCommandType
+{
+	None,
+	KeyDown,
+	KeyUp,
+	Break,
+	Restart,
+	InstallRom,		// Installs rom in bank and breaks
+	Speed,
+	RunAhead,
+	Stop			// Ends the run with StopReason::Stopped
+};
+
+struct HostCommand
+{
+	static HostCommand KeyDown(ElectronKey key);
+	static HostCommand KeyUp(ElectronKey key);
+	static HostCommand Break();
+	static HostCommand Restart();
+	static HostCommand InstallRom(int bank, std::vector<uint8_t> rom);
+	static HostCommand Speed(double multiplier);
+	static HostCommand RunAhead(int frames);
+	static HostCommand Stop();
+
+	HostCommandType type;
+	ElectronKey key;
+	int bank;
+	double speed;
+	int frames;
+	std::vector<uint8_t> rom;
+};
+
+// The machine state without the ROMs and the host settings, see BasicElectron::Save()
+struct ElectronSnapshot
+{
+	MOS6502Snapshot cpu;
+	UlaSnapshot ula;
+	std::array<uint8_t, 0x8000> ram;
+};
+
+// The Policy type selects the instrumentation of the CPU and the memory bus, see Instrumentation.h
+template <typename Policy>
+class BasicElectron final : public Memory
 {
 public:
 	using TraceEvent = std::function<void (const std::string& msg)>;
-	using FrameCompletedEvent = std::function<void (const Image& image)>;
+	using FrameCompletedEvent = RenderWorker::FrameCompletedEvent;
 	using CapsLockEvent = Ula::CapsLockEvent;
 	using CassetteMotorEvent = Ula::CassetteMotorEvent;
-	using SpeakerEvent = Ula::SpeakerEvent;
+	using SoundEvent = std::function<void (const int16_t* samples, size_t count)>;
+
+	explicit BasicElectron(const std::vector<uint8_t>& rom);
 
-	explicit Electron(const std::vector<uint8_t>& rom);
+	Policy& Instrumentation();
+	const Policy& Instrumentation() const;
 
 	void InstallRom(int bank, std::vector<uint8_t> rom);
 
@@ -89,32 +170,153 @@ public:
 	void KeyDown(ElectronKey key);
 	void KeyUp(ElectronKey key);
 
+	// Can be called from any thread, returns false when the queue is full and keeps command then.
+	// Commands are executed on the emulation thread at the start of RunUntilFrameEnd() and RunFor()
+	// and at the start of RunUntil() and after each of its scheduled events.
+	bool Post(HostCommand&& command);
+
 	void Trace(TraceEvent slot);
+	// Frames are drawn on a worker thread, slot is called on that thread when a frame can be received
 	void FrameCompleted(FrameCompletedEvent slot);
 	void CapsLock(CapsLockEvent slot);
 	void CassetteMotor(CassetteMotorEvent slot);
-	void Speaker(SpeakerEvent slot);
+	// 16 bit mono PCM of the speaker, called on the emulation thread at the end of each frame
+	void Sound(SoundEvent slot);
 
 	bool CapsLock() const;
 	bool CassetteMotor() const;
 
+	// Drawn frames in order, nullptr when none is waiting. Call from a single consumer thread
+	// and release each frame when done with it, the drawing stalls while no frame is free.
+	const Frame* ReceiveFrame();
+	void ReleaseFrame(const Frame* frame);
+
+	// Translation of ROM code into blocks, Off by default
+	void Translation(TranslationMode mode);
+	TranslationMode Translation() const;
+
+	// Skipping of side effect free loops up to the next ULA event, on by default
+	void IdleSkipping(bool enable);
+	bool IdleSkipping() const;
+	uint64_t IdleCycles() const;
+
+	// Frame timing and interrupts are unaffected, skipped frames are not drawn. Always by default.
+	void Rendering(FrameRendering mode);
+	FrameRendering Rendering() const;
+	// Can be called from any thread
+	void RequestFrame();
+	uint64_t SkippedFrames() const;
+
+	// Emulation speed as a multiple of the real machine, 1 by default, 0 runs unthrottled.
+	// Pacing restarts from the current time, so a change never causes catch-up frames.
+	void Speed(double multiplier);
+	double Speed() const;
+	// Emulated clock rate in MHz and emulated frames per second, measured each second.
+	// Can be called from any thread.
+	double Mhz() const;
+	double FramesPerSecond() const;
+	// Lateness and jitter of the real time pacing, can be called from any thread
+	PacingStatistics Pacing() const;
+
+	// Sample rate of the Sound() output, 44100 by default
+	void SampleRate(int rate);
+	int SampleRate() const;
+
+	// The clock that paces the emulation, Wall by default. The audio clock ignores Speed(), it keeps
+	// AudioOutput() at its low water mark and resamples to absorb the drift of the audio clock.
+	void Clock(ClockSource source);
+	ClockSource Clock() const;
+	// The Sound() output for an audio consumer thread while paced by the audio clock
+	SampleRing& AudioOutput();
+	// 2048 samples by default
+	void AudioLowWater(size_t samples);
+
+	// Frames run ahead of the shown frame to hide the input lag of the emulated software, 0 by default.
+	// After each frame the machine is saved, runs the frames ahead unthrottled and without sound,
+	// shows the last one and is restored. Only RunUntilFrameEnd() runs ahead.
+	void RunAhead(int frames);
+	int RunAhead() const;
+	// Host time spent running ahead in microseconds per frame, measured each second.
+	// Can be called from any thread.
+	double RunAheadCost() const;
+
+	// Only valid between runs. Save() reuses the storage of snapshot, Restore() copies
+	// and invalidates only the RAM pages that differ.
+	void Save(ElectronSnapshot& snapshot) const;
+	void Restore(const ElectronSnapshot& snapshot);
+
+	// Hash of the OS and the installed sideways ROMs
+	uint64_t RomHash() const;
+	// Save state files, see SaveState.h. Loading a state of another ROM set throws std::runtime_error.
+	void SaveState(const std::string& filename) const;
+	void LoadState(const std::string& filename);
+	// Restarts and runs the OS start up to the BASIC prompt unthrottled, about 450k cycles.
+	// With a cache directory, the state after start up is loaded from a file named after RomHash(),
+	// or saved there after a cold start.
+	void Boot(const std::string& cacheDirectory = std::string());
+
 	void Step();
+	RunResult RunFor(uint64_t cycles);
+	RunResult RunUntilFrameEnd();
+	RunResult RunUntil(std::function<bool ()> predicate);
 
 	// Memory
 	uint8_t Read(uint16_t address) override;
 	void Write(uint16_t address, uint8_t value) override;
 
 private:
-	MOS6502 m_cpu;
+	bool ExecuteCommands();
+	bool RunSlice(uint64_t endCycle);
+	void CompleteFrame();
+	bool PaceFrame();
+	void RunAheadFrames(bool draw);
+	bool RenderNextFrame(bool late);
+	void ResetPacing();
+	void ResetSound();
+	void GenerateSound();
+	void MeasureRate(std::chrono::steady_clock::time_point now);
+
+	BasicMOS6502<BasicElectron, Policy> m_cpu;
 	std::array<uint8_t, 0x8000> m_ram;
 	std::array<uint8_t, 0x4000> m_os;
+	std::vector<DecodedPage> m_ramCode;
+	std::vector<DecodedPage> m_osCode;
+	MemoryMap m_memoryMap;
+	Scheduler m_scheduler;
 	Ula m_ula;
-	Image m_image;
-	std::chrono::steady_clock::time_point m_startTime;
-	uint64_t m_oneMhzCycles;
+	RenderWorker m_renderWorker;
+	bool m_frameEnded;
+	FrameRendering m_rendering;
+	std::atomic<bool> m_frameRequested;
+	int m_frameSkip;
+	uint64_t m_skippedFrames;
+	FramePacer m_pacer;
+	std::chrono::steady_clock::time_point m_drawTime;
+	std::chrono::steady_clock::time_point m_rateTime;
+	uint64_t m_rateCycles;
+	uint64_t m_rateFrames;
+	std::atomic<double> m_mhz;
+	std::atomic<double> m_fps;
+	int m_runAhead;
+	bool m_pacingDeferred;
+	bool m_runningAhead;
+	ElectronSnapshot m_runAheadState;
+	std::chrono::steady_clock::duration m_runAheadTime;
+	std::atomic<double> m_runAheadCost;
+	SoundSynthesizer m_synthesizer;
+	ClockSource m_clock;
+	AudioPacer m_audioPacer;
+	std::vector<int16_t> m_samples;
+	SoundEvent m_sound;
+	MpscQueue<HostCommand> m_commands;
 
 	TraceEvent m_trace;
-	FrameCompletedEvent m_frameCompleted;
 };
 
+using Electron = BasicElectron<FastPolicy>;
+using DebugElectron = BasicElectron<DebugPolicy>;
+
+extern template class BasicElectron<FastPolicy>;
+extern template class BasicElectron<DebugPolicy>;
+
 } // namespace DjeeDjay
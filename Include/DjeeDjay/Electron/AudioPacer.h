@@ -0,0 +1,90 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "DjeeDjay/NonCopyable.h"
+
+namespace DjeeDjay {
+
+// A lock-free ring of PCM samples from the emulation thread to one audio consumer thread
+class SampleRing : NonCopyable
+{
+public:
+	explicit SampleRing(size_t capacity);
+
+	size_t Capacity() const;
+	// Can be called from any thread
+	size_t Size() const;
+	uint64_t SamplesRead() const;
+	uint64_t Underruns() const;
+
+	// Producer, writes the samples that fit and returns their number
+	size_t Write(const int16_t* samples, size_t count);
+	// Consumer, reads count samples and fills up with silence when the ring runs empty,
+	// returns the number of samples read from the ring
+	size_t Read(int16_t* samples, size_t count);
+
+private:
+	std::vector<int16_t> m_samples;
+	std::atomic<size_t> m_head;			// Written by the consumer only
+	std::atomic<size_t> m_tail;			// Written by the producer only
+	std::atomic<uint64_t> m_read;
+	std::atomic<uint64_t> m_underruns;
+};
+
+// The time source of AudioPacer, a simulated clock makes the pacing testable without waiting
+struct PacerClock
+{
+	using Clock = std::chrono::steady_clock;
+
+	virtual Clock::time_point Now() = 0;
+	virtual void SleepUntil(Clock::time_point time) = 0;
+};
+
+// Paces the emulation by the consumer of the audio ring: a frame runs as soon as the ring holds
+// fewer samples than the low water mark. The rate of the consumer is measured against the wall clock
+// and returned as a resampling ratio, so a drifting audio clock does not change the emulation speed.
+class AudioPacer : NonCopyable
+{
+public:
+	using Clock = PacerClock::Clock;
+
+	// Paces by the steady clock
+	AudioPacer(size_t capacity, size_t lowWater);
+	AudioPacer(size_t capacity, size_t lowWater, PacerClock& clock);
+
+	SampleRing& Ring();
+
+	void LowWater(size_t samples);
+	size_t LowWater() const;
+
+	// Restarts the rate measurement
+	void Reset(int sampleRate);
+
+	// Queues the samples of a frame and waits until the ring drops below the low water mark.
+	// A consumer that stops reading delays each frame by at most 100 ms.
+	void Pace(const int16_t* samples, size_t count);
+	// Whether the ring was below the low water mark when the last samples were queued
+	bool Late() const;
+	// Consumer rate over the nominal sample rate, to be applied by the synthesiser
+	double Ratio() const;
+
+private:
+	void MeasureRate();
+
+	PacerClock& m_clock;
+	SampleRing m_ring;
+	size_t m_lowWater;
+	int m_sampleRate;
+	bool m_late;
+	double m_ratio;
+	Clock::time_point m_rateTime;
+	uint64_t m_rateRead;
+};
+
+} // namespace DjeeDjay
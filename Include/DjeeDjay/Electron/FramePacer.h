@@ -0,0 +1,90 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "DjeeDjay/NonCopyable.h"
+
+namespace DjeeDjay {
+
+// Counts values in buckets of equal width, values outside the range are counted in the first or last bucket
+class Histogram
+{
+public:
+	Histogram(int64_t first, int64_t bucketWidth, int buckets);
+
+	void Add(int64_t value);
+	void Clear();
+
+	int Buckets() const;
+	int64_t BucketStart(int bucket) const;
+	uint64_t Count(int bucket) const;
+
+	uint64_t Samples() const;
+	int64_t Min() const;
+	int64_t Max() const;
+	double Mean() const;
+
+private:
+	int64_t m_first;
+	int64_t m_bucketWidth;
+	std::vector<uint64_t> m_counts;
+	uint64_t m_samples;
+	int64_t m_min;
+	int64_t m_max;
+	int64_t m_sum;
+};
+
+// All values in microseconds
+struct PacingStatistics
+{
+	PacingStatistics();
+
+	Histogram lateness;		// Wake up time after the deadline of each frame
+	Histogram drift;		// Frame period minus the paced frame period, jitter of the presentation
+	uint64_t stalls;		// Number of times pacing restarted after running too far behind
+};
+
+// Paces emulated 2 MHz cycles to real time: sleeps most of the wait and spins the last part,
+// where the spin time follows the measured oversleep of the OS timer.
+// A frame that is more than 100 ms behind restarts the pacing instead of running to catch up.
+class FramePacer : NonCopyable
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	FramePacer();
+
+	// Multiple of real time, 0 means unthrottled, takes effect from the next Reset()
+	void Speed(double multiplier);
+	double Speed() const;
+
+	// Starts pacing from now at cycles
+	void Reset(uint64_t cycles);
+
+	Clock::time_point Deadline(uint64_t cycles) const;
+	// Waits until the deadline of cycles
+	void Wait(uint64_t cycles);
+
+	// Can be called from any thread
+	PacingStatistics Statistics() const;
+	void ClearStatistics();
+
+private:
+	void Sleep(Clock::time_point deadline);
+
+	double m_speed;
+	Clock::time_point m_startTime;
+	uint64_t m_startCycles;
+	Clock::duration m_spinTime;
+	bool m_previous;
+	Clock::time_point m_previousWake;
+	Clock::time_point m_previousDeadline;
+	mutable std::mutex m_mtx;
+	PacingStatistics m_statistics;
+};
+
+} // namespace DjeeDjay
@@ -0,0 +1,45 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "DjeeDjay/NonCopyable.h"
+#include "DjeeDjay/SpscQueue.h"
+#include "DjeeDjay/IndexedImage.h"
+#include "DjeeDjay/Electron/ScreenRenderer.h"
+
+namespace DjeeDjay {
+
+struct Frame
+{
+	IndexedImage image;
+	ScreenChanges changes;	// The lines that differ from the previous frame
+	uint64_t serial;		// Frames are numbered from 1, 0 means the buffer was never used
+};
+
+// A fixed set of frame buffers handed between one producer and one consumer thread without locks.
+// The producer draws into an acquired frame and publishes it, the consumer receives and releases it.
+class FramePool : NonCopyable
+{
+public:
+	explicit FramePool(size_t size);
+
+	size_t Size() const;
+
+	// Producer, returns nullptr while all frames are in use
+	Frame* Acquire();
+	void Publish(Frame* frame);
+
+	// Consumer, returns nullptr when no frame was published
+	const Frame* Receive();
+	void Release(const Frame* frame);
+
+private:
+	std::vector<Frame> m_frames;
+	SpscQueue<size_t> m_free;
+	SpscQueue<size_t> m_published;
+};
+
+} // namespace DjeeDjay
@@ -0,0 +1,41 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+
+namespace DjeeDjay {
+
+class MOS6502State;
+struct DecodedPage;
+
+// Maps each 256 byte page of the 6502 address space to host memory.
+// Unmapped pages have a nullptr entry and are handled by the owner's slow path.
+// The CPU's decoded instruction pages follow the same mapping.
+class MemoryMap
+{
+public:
+	explicit MemoryMap(MOS6502State& cpu);
+
+	void MapRom(int firstPage, int pageCount, const uint8_t* data, DecodedPage* code);
+	void MapRam(int firstPage, int pageCount, uint8_t* data, DecodedPage* code);
+	void Unmap(int firstPage, int pageCount);
+
+	const uint8_t* ReadPage(uint16_t address) const
+	{
+		return m_read[address >> 8];
+	}
+
+	uint8_t* WritePage(uint16_t address) const
+	{
+		return m_write[address >> 8];
+	}
+
+private:
+	MOS6502State& m_cpu;
+	std::array<const uint8_t*, 256> m_read;
+	std::array<uint8_t*, 256> m_write;
+};
+
+} // namespace DjeeDjay
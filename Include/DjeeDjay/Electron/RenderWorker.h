@@ -0,0 +1,61 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "DjeeDjay/NonCopyable.h"
+#include "DjeeDjay/Electron/ScreenRenderer.h"
+#include "DjeeDjay/Electron/FramePool.h"
+
+namespace DjeeDjay {
+
+// Draws captured frames on a worker thread, in parallel with the emulation.
+// Drawn frames are published in a FramePool, the FrameCompleted slot is called on the worker thread.
+// While the consumer holds all frames of the pool, drawn frames are combined into the next published one.
+class RenderWorker : NonCopyable
+{
+public:
+	using FrameCompletedEvent = std::function<void ()>;
+
+	// Submit() blocks while queueSize frames wait to be drawn
+	RenderWorker(size_t queueSize, size_t poolSize);
+	~RenderWorker();
+
+	void FrameCompleted(FrameCompletedEvent slot);
+
+	void Submit(ScreenFrame frame);
+	// Waits until all submitted frames are drawn and published
+	void Flush();
+
+	// Called by the consumer of the frames
+	const Frame* ReceiveFrame();
+	void ReleaseFrame(const Frame* frame);
+
+private:
+	void Run();
+	void CopyChangedLines(Frame& frame) const;
+
+	ScreenRenderer m_renderer;
+	IndexedImage m_image;
+	uint64_t m_serial;
+	std::vector<ScreenChanges> m_history;	// The changes of the last drawn frames, by serial
+	ScreenChanges m_unpublished;			// The changes since the last published frame
+	FramePool m_pool;
+	size_t m_queueSize;
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	std::deque<ScreenFrame> m_queue;
+	bool m_busy;
+	bool m_stop;
+	FrameCompletedEvent m_frameCompleted;
+	std::thread m_thread;
+};
+
+} // namespace DjeeDjay
@@ -0,0 +1,32 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "DjeeDjay/Electron.h"
+
+namespace DjeeDjay {
+
+// Save states are independent of the instrumentation policy and the host byte order.
+// Version 1, all integers little endian:
+//   "ELSS", uint32 version, uint64 ROM set hash
+//   CPU: uint64 cycle, uint16 pc, uint8 a, x, y, s, p, pending
+//   ULA: 14 keyboard columns, uint64 1 MHz cycles, video cycles, next frame cycle, next RTC cycle,
+//        uint8 nmi, irq status, irq enable, screen low, screen high, ROM bank, counter, misc control,
+//        8 palette registers, uint32 image width, frame start
+//   32 KB RAM
+// The screen capture of a frame in progress is not saved, a loaded state redraws the whole screen.
+constexpr uint32_t SaveStateVersion = 1;
+
+std::vector<uint8_t> WriteSaveState(const ElectronSnapshot& snapshot, uint64_t romHash);
+// Throws std::runtime_error for data that is not a save state of a supported version,
+// returns the ROM set hash
+uint64_t ReadSaveState(const std::vector<uint8_t>& data, ElectronSnapshot& snapshot);
+
+// Replaces filename in one step
+void SaveStateFile(const std::string& filename, const std::vector<uint8_t>& data);
+std::vector<uint8_t> LoadStateFile(const std::string& filename);
+
+} // namespace DjeeDjay
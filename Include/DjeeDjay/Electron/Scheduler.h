@@ -0,0 +1,50 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace DjeeDjay {
+
+// Min-heap of device events keyed on CPU cycle.
+// An event scheduled at cycle n fires before the first instruction that starts at or after cycle n.
+class Scheduler
+{
+public:
+	using EventHandler = std::function<void ()>;
+
+	static constexpr uint64_t Never = UINT64_MAX;
+
+	int Register(EventHandler handler);
+
+	void Schedule(int event, uint64_t cycle);
+	void Cancel(int event);
+
+	uint64_t NextEventCycle() const;
+	void Dispatch(uint64_t cycle);
+
+private:
+	struct Entry
+	{
+		uint64_t cycle;
+		int event;
+		unsigned generation;
+	};
+
+	struct Event
+	{
+		EventHandler handler;
+		unsigned generation;
+		bool scheduled;
+	};
+
+	static bool Later(const Entry& a, const Entry& b);
+	void PopStale();
+
+	std::vector<Event> m_events;
+	std::vector<Entry> m_heap;
+};
+
+} // namespace DjeeDjay
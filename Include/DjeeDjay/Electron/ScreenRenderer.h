@@ -0,0 +1,62 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <bitset>
+#include <vector>
+
+namespace DjeeDjay {
+
+class IndexedImage;
+
+// The part of the screen image that a frame redrew
+struct ScreenChanges
+{
+	uint32_t rows;		// Bit n is set when character row n was redrawn
+	int firstLine;		// Image lines firstLine up to lastLine changed, none when equal
+	int lastLine;
+};
+
+// Image lines that are drawn with the same screen mode and palette
+struct ScreenSegment
+{
+	int mode;
+	std::array<uint8_t, 16> colours;	// The physical colour of each logical colour
+	int firstLine;
+	int lastLine;
+	std::bitset<256> lines;				// The lines to draw in firstLine up to lastLine
+	int firstRow;
+	std::vector<uint8_t> ram;			// Screen memory of the character rows from firstRow, unwrapped
+};
+
+// Everything needed to draw the screen image of a frame, captured while the frame runs
+struct ScreenFrame
+{
+	std::vector<ScreenSegment> segments;
+	ScreenChanges changes;
+};
+
+class ScreenRenderer
+{
+public:
+	// The physical colours of the pixels in one screen byte, for each byte value
+	template <int BitsPerPixel>
+	using PixelTable = std::array<std::array<uint8_t, 8 / BitsPerPixel>, 256>;
+
+	ScreenRenderer();
+
+	// Draws the segments of frame over the previous frame in image
+	void Render(const ScreenFrame& frame, IndexedImage& image);
+
+private:
+	void UpdatePixelTable(int bitsPerPixel, const std::array<uint8_t, 16>& colours);
+
+	std::array<std::array<uint8_t, 16>, 3> m_tableColours;	// The colours of m_pixels1, m_pixels2 and m_pixels4
+	PixelTable<1> m_pixels1;
+	PixelTable<2> m_pixels2;
+	PixelTable<4> m_pixels4;
+};
+
+} // namespace DjeeDjay
@@ -0,0 +1,88 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "DjeeDjay/NonCopyable.h"
+
+namespace DjeeDjay {
+
+// A change of the speaker output, logged by the ULA
+struct SpeakerChange
+{
+	uint64_t cycle;		// Elapsed 2 MHz cycles, see Ula::ElapsedCycles()
+	int halfPeriod;		// Of the square wave in 2 MHz cycles, 0 when the speaker is off
+};
+
+// Turns speaker changes into 16 bit mono PCM samples.
+// Each sample is the average of the square wave over the sample period, so tones above the
+// sample rate do not alias into audible ones.
+class SoundSynthesizer
+{
+public:
+	explicit SoundSynthesizer(int sampleRate);
+
+	int SampleRate() const;
+
+	// Fraction of full scale, 0.5 by default
+	void Amplitude(double value);
+	double Amplitude() const;
+
+	// Samples per emulated second over the sample rate, for small adjustments to a drifting consumer.
+	// 1 by default.
+	void Ratio(double ratio);
+	double Ratio() const;
+
+	// Restarts at cycle with the speaker off
+	void Reset(uint64_t cycle);
+
+	// Appends the samples up to cycle, then applies change
+	void Change(const SpeakerChange& change, std::vector<int16_t>& samples);
+	// Appends the samples up to cycle
+	void Generate(uint64_t cycle, std::vector<int16_t>& samples);
+
+private:
+	int m_sampleRate;
+	int m_amplitude;
+	double m_ratio;
+	// Time is counted in ticks of 1 / (2 MHz * sample rate) s, a sample lasts m_sampleTicks
+	uint64_t m_sampleTicks;
+	uint64_t m_time;
+	uint64_t m_sampleEnd;
+	int64_t m_sum;
+	uint64_t m_halfPeriod;
+	uint64_t m_nextToggle;
+	int m_level;
+};
+
+enum class SoundFileFormat
+{
+	Wave,
+	Raw
+};
+
+// Writes 16 bit mono PCM samples to a WAV or a headerless little endian file.
+// The WAV header is completed by Close(), which the destructor calls.
+class SoundFile : NonCopyable
+{
+public:
+	SoundFile(const std::string& filename, int sampleRate, SoundFileFormat format = SoundFileFormat::Wave);
+	~SoundFile();
+
+	void Write(const int16_t* samples, size_t count);
+	void Close();
+
+private:
+	void WriteHeader();
+
+	std::ofstream m_file;
+	int m_sampleRate;
+	SoundFileFormat m_format;
+	uint64_t m_samples;
+};
+
+} // namespace DjeeDjay
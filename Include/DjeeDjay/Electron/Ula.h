@@ -4,12 +4,18 @@
 
 #include <cstdint>
 #include <array>
+#include <bitset>
 #include <functional>
+#include <vector>
+#include "DjeeDjay/MOS6502.h"
+#include "DjeeDjay/SpscQueue.h"
+#include "DjeeDjay/Electron/ScreenRenderer.h"
+#include "DjeeDjay/Electron/Sound.h"
 
 namespace DjeeDjay {
 
-class MOS6502;
-class Image;
+class MemoryMap;
+class Scheduler;
 
 struct KeyboardBit
 {
@@ -19,39 +25,87 @@ struct KeyboardBit
 	int bit;
 };
 
+// The state of the ULA, see Ula::Save().
+// The installed ROMs, the slots and the screen capture setting are not part of it.
+struct UlaSnapshot
+{
+	std::array<uint8_t, 14> keyboard;
+	uint64_t oneMHzCycles;
+	uint64_t videoCycles;
+	uint64_t nextFrameCycle;
+	uint64_t nextRtcCycle;
+	bool nmi;
+	uint8_t irqStatus;
+	uint8_t irqEnable;
+	uint8_t screenLow;
+	uint8_t screenHigh;
+	int romBankIndex;
+	uint8_t counter;
+	uint8_t miscControl;
+	std::array<uint8_t, 8> palette;
+	int imageWidth;
+	std::bitset<256> dirtyLines;
+	int capturedLines;
+	size_t frameStart;
+	ScreenFrame frame;
+};
+
 class Ula
 {
 public:
 	using TraceEvent = std::function<void (const std::string& msg)>;
 	using CapsLockEvent = std::function<void (bool)>;
 	using CassetteMotorEvent = std::function<void (bool)>;
-	using SpeakerEvent = std::function<void (int)>;
+	using FrameEndEvent = std::function<void ()>;
+
+	// The lowest screen memory address of all modes
+	static constexpr uint16_t MinScreenAddress = 0x3000;
 
-	explicit Ula(MOS6502& cpu);
+	Ula(MOS6502State& cpu, MemoryMap& memoryMap, Scheduler& scheduler);
 
 	void Trace(TraceEvent slot);
 	void CapsLock(CapsLockEvent slot);
 	void CassetteMotor(CassetteMotorEvent slot);
-	void Speaker(SpeakerEvent slot);
+	void FrameEnd(FrameEndEvent slot);
 
 	bool CapsLock() const;
 	bool CassetteMotor() const;
 
 	void InstallRom(int bank, std::vector<uint8_t> rom);
+	// The installed sideways ROMs by internal bank number, empty when none
+	const std::array<std::vector<uint8_t>, 16>& Roms() const;
 	void Restart();
 	void Reset();
 
+	// The CPU state is saved and restored separately. Restore() reschedules the ULA events
+	// and reports caps lock and cassette motor changes.
+	void Save(UlaSnapshot& snapshot) const;
+	void Restore(const UlaSnapshot& snapshot);
+
 	uint8_t ReadKeyboard(uint16_t address) const;
 	uint8_t ReadRom(uint16_t address) const;
 
 	void KeyDown(const KeyboardBit& key);
 	void KeyUp(const KeyboardBit& key);
 
-	void UpdateTimers();
 	uint64_t OneMHzCycles() const;
 	uint64_t VideoCycles() const;
-	bool ReadyForNextFrame() const;
-	void GenerateFrame(const uint8_t* ram, Image& image);
+	// The elapsed time in 2 MHz cycles, including the cycles the CPU was stalled
+	uint64_t ElapsedCycles() const;
+
+	// Speaker changes in order, logged while the CPU runs. Read them at least once per frame,
+	// changes are dropped while the log is full.
+	bool ReadSpeaker(SpeakerChange& change);
+	// The screen is captured while the frame runs: register writes first capture the lines
+	// up to the beam position. Only lines with written screen memory are captured.
+	// Physical colours are bit 0 red, bit 1 green and bit 2 blue.
+	void ConnectScreen(const uint8_t* ram);
+	// Without capture a frame leaves its changes pending and GenerateFrame() returns no segments
+	void CaptureScreen(bool enable);
+	bool CaptureScreen() const;
+	ScreenFrame GenerateFrame();
+	void ScreenWritten(uint16_t address, int size);
+	void InvalidateScreen();
 
 	uint8_t Read(uint16_t address);
 	void Write(uint16_t address, uint8_t value);
@@ -75,27 +129,41 @@ public:
 	void Palette(int index, uint8_t value);
 
 private:
+	void MapRomBank();
 	void TriggerRtcInterrupt();
+	void TriggerDisplayEndInterrupt();
 	void UpdateIrqStatus(uint8_t enable, uint8_t status);
-	uint32_t PaletteR(int index, int bit) const;
-	uint32_t PaletteG(int index, int bit) const;
-	uint32_t PaletteB(int index, int bit) const;
-	std::array<uint32_t, 2> Palette2();
-	std::array<uint32_t, 4> Palette4();
-	std::array<uint32_t, 16> Palette16();
-
-	MOS6502& m_cpu;
+	uint8_t PaletteR(int index, int bit) const;
+	uint8_t PaletteG(int index, int bit) const;
+	uint8_t PaletteB(int index, int bit) const;
+	std::array<uint8_t, 2> Palette2();
+	std::array<uint8_t, 4> Palette4();
+	std::array<uint8_t, 16> Palette16();
+	std::array<uint8_t, 16> Colours(int bitsPerPixel);
+	int BeamLine() const;
+	void CaptureLines(int lastLine);
+	int ScreenMode() const;
+	size_t ScreenStart() const;
+	int SpeakerHalfPeriod() const;
+	void LogSpeaker();
+
+	MOS6502State& m_cpu;
+	MemoryMap& m_memoryMap;
+	Scheduler& m_scheduler;
 	TraceEvent m_trace;
 	CapsLockEvent m_capsLock;
 	CassetteMotorEvent m_cassetteMotor;
-	SpeakerEvent m_speaker;
+	FrameEndEvent m_frameEnd;
 	std::array<std::vector<uint8_t>, 16> m_roms;
+	std::array<std::vector<DecodedPage>, 16> m_romCode;
 	std::array<uint8_t, 14> m_keyboard;
 
 	uint64_t m_oneMHzCycles;
 	uint64_t m_videoCycles;
 	uint64_t m_nextFrameCycle;
 	uint64_t m_nextRtcCycle;
+	int m_rtcEvent;
+	int m_displayEndEvent;
 
 	bool m_nmi;
 	uint8_t m_irqStatus;
@@ -106,6 +174,16 @@ private:
 	uint8_t m_counter;
 	uint8_t m_miscControl;
 	uint8_t m_palette[8];
+
+	const uint8_t* m_screenRam;
+	bool m_captureScreen;
+	int m_imageWidth;
+	std::bitset<256> m_dirtyLines;
+	int m_capturedLines;
+	size_t m_frameStart;		// Screen start address latched at the first line of the frame
+	ScreenFrame m_frame;
+
+	SpscQueue<SpeakerChange> m_speakerLog;
 };
 
 } // namespace DjeeDjay
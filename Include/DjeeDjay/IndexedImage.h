@@ -0,0 +1,47 @@
+﻿// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+namespace DjeeDjay {
+
+class Image;
+
+// An image of 8 bit colour indices into a 16 entry RGB palette.
+// A quarter of the size of the equivalent Image, convert with ToRgb() where RGB is needed.
+class IndexedImage
+{
+public:
+	using PaletteType = std::array<uint32_t, 16>;
+
+	IndexedImage();
+
+	void Resize(int width, int height);
+
+	int Width() const;
+	int Height() const;
+
+	uint8_t operator()(int x, int y) const;
+	uint8_t& operator()(int x, int y);
+
+	uint8_t* Data();
+	const uint8_t* Data() const;
+	int Stride() const;
+
+	const PaletteType& Palette() const;
+	void Palette(const PaletteType& palette);
+
+private:
+	int m_width;
+	int m_height;
+	std::vector<uint8_t> m_data;
+	PaletteType m_palette;
+};
+
+void ToRgb(const IndexedImage& image, Image& rgb);
+void ToRgb(const IndexedImage& image, int firstLine, int lastLine, Image& rgb);
+
+} // namespace DjeeDjay
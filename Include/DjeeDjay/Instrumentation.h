@@ -0,0 +1,88 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <functional>
+#include <vector>
+
+namespace DjeeDjay {
+
+class MOS6502State;
+
+// Instrumentation policies are a template argument of BasicMOS6502 and BasicElectron.
+// A policy provides:
+//   static constexpr bool Accelerated: run loops, idle time and translated blocks natively,
+//       the hooks then only see the instructions that are interpreted
+//   bool Break(uint16_t pc, uint64_t cycle): stop Run() before the instruction at pc
+//   void BeforeInstruction(const MOS6502State& cpu, uint8_t opcode)
+//   void IoRead(uint16_t address, uint8_t value)
+//   void IoWrite(uint16_t address, uint8_t value)
+
+// All hooks are empty, the production configuration
+struct FastPolicy
+{
+	static constexpr bool Accelerated = true;
+
+	bool Break(uint16_t, uint64_t)
+	{
+		return false;
+	}
+
+	void BeforeInstruction(const MOS6502State&, uint8_t)
+	{
+	}
+
+	void IoRead(uint16_t, uint8_t)
+	{
+	}
+
+	void IoWrite(uint16_t, uint8_t)
+	{
+	}
+};
+
+// Interprets every instruction and supports tracing, breakpoints and profiling counters
+class DebugPolicy
+{
+public:
+	static constexpr bool Accelerated = false;
+
+	using TraceEvent = std::function<void (const MOS6502State& cpu)>;
+	using IoTraceEvent = std::function<void (uint16_t address, uint8_t value, bool write)>;
+
+	DebugPolicy();
+
+	void Trace(TraceEvent slot);
+	void IoTrace(IoTraceEvent slot);
+
+	void Breakpoint(uint16_t address, bool enable);
+	bool Breakpoint(uint16_t address) const;
+	void ClearBreakpoints();
+
+	uint64_t Instructions() const;
+	uint64_t OpcodeCount(uint8_t opcode) const;
+	uint64_t IoReads() const;
+	uint64_t IoWrites() const;
+	void ClearCounters();
+
+	// A breakpoint stops once, so the next Run() continues from it
+	bool Break(uint16_t pc, uint64_t cycle);
+	void BeforeInstruction(const MOS6502State& cpu, uint8_t opcode);
+	void IoRead(uint16_t address, uint8_t value);
+	void IoWrite(uint16_t address, uint8_t value);
+
+private:
+	std::vector<bool> m_breakpoints;
+	uint64_t m_breakCycle;
+	uint64_t m_instructions;
+	std::array<uint64_t, 256> m_opcodeCounts;
+	uint64_t m_ioReads;
+	uint64_t m_ioWrites;
+
+	TraceEvent m_trace;
+	IoTraceEvent m_ioTrace;
+};
+
+} // namespace DjeeDjay
@@ -3,30 +3,138 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include "DjeeDjay/Instrumentation.h"
+
+// Translated blocks are x86-64 code, other hosts interpret all code
+#if defined(_M_X64) || defined(__x86_64__)
+#	define DJEEDJAY_X64
+#endif
 
 namespace DjeeDjay {
 
+class ExecutableMemory;
+
 struct Memory
 {
 	virtual uint8_t Read(uint16_t offset) = 0;
 	virtual void Write(uint16_t offset, uint8_t value) = 0;
 };
 
-class MOS6502
+struct MemoryReadError : std::runtime_error
+{
+	explicit MemoryReadError(uint16_t address);
+
+	uint16_t address;
+};
+
+struct MemoryWriteError : std::runtime_error
+{
+	explicit MemoryWriteError(uint16_t address);
+
+	uint16_t address;
+};
+
+struct InvalidOpcodeError : std::runtime_error
+{
+	explicit InvalidOpcodeError(uint8_t opcode);
+
+	uint8_t opcode;
+};
+
+struct TranslationError : std::runtime_error
+{
+	explicit TranslationError(uint16_t address);
+
+	uint16_t address;
+};
+
+struct DecodedInstruction
+{
+	uint8_t opcode;
+	uint8_t length;		// 0 when not decoded
+	uint16_t operand;
+	uint16_t block;		// Translated block index + 1, 0 when not translated
+	uint8_t hits;
+	uint8_t loop;		// LoopIdiom that starts here
+};
+
+// Decoded instructions of one 256 byte page, indexed by the offset of their opcode
+struct DecodedPage
+{
+	void Store(int offset, uint8_t opcode, int length, uint16_t operand, uint8_t loop);
+	void Invalidate(int first, int last);
+
+	std::array<DecodedInstruction, 256> instructions = {};
+	bool empty = true;
+	bool readOnly = false;
+	uint32_t blockGeneration = 0;	// The block indices are valid while this matches the CPU
+};
+
+// An instruction of a translated block
+struct TranslatedInstruction
+{
+	uint8_t opcode;
+	uint8_t length;
+	uint16_t operand;
+};
+
+// Memory fill and copy loops that are run natively instead of being interpreted
+enum class LoopIdiom : uint8_t
+{
+	None,
+	FillUp,			// STA (zp),Y / INY / BNE
+	FillDown,		// DEY / STA (zp),Y / BNE
+	FillDown4,		// STA (zp),Y x4 / DEY / BNE
+	CopyUp,			// LDA (zp),Y / STA (zp),Y / INY / BNE
+	FillZeroPageX,	// STA zp,X / INX / BNE
+	FillAbsoluteX	// STA abs,X / INX / BNE
+};
+
+enum class TranslationMode
+{
+	Off,
+	On,			// Runs hot ROM code as native code
+	Lockstep	// Runs translated blocks, then interprets them and checks the decoding and the resulting state
+};
+
+// The complete architectural state of the CPU, see MOS6502State::Save()
+struct MOS6502Snapshot
+{
+	uint64_t cycle;
+	uint16_t pc;
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	uint8_t s;
+	uint8_t p;
+	uint8_t pending;	// Reset, NMI and IRQ inputs
+};
+
+class MOS6502State
 {
 public:
-	explicit MOS6502(Memory& memory);
+	MOS6502State();
+	~MOS6502State();
+
+	// Save and restore are only valid between Step() and Run() calls.
+	// Restoring a snapshot restarts the idle loop detection.
+	void Save(MOS6502Snapshot& snapshot) const;
+	void Restore(const MOS6502Snapshot& snapshot);
 
 	void NMI();
 	void Reset(bool value);
 	void IRQ(bool value);
 	bool IRQ() const;
 
-	void Step();
-
 	uint16_t PC() const;
 	uint8_t A() const;
 	uint8_t X() const;
@@ -49,29 +157,39 @@ public:
 
 	uint64_t Cycles() const;
 
-private:
-	uint8_t ReadPC();
-	uint16_t ReadPC16();
-	uint16_t Read16(uint16_t address);
-	enum ImpliedType { Value };
-	ImpliedType Implied(int duration = 2);
-	uint16_t Immediate();
-	uint16_t ZeroPage();
-	uint16_t ZeroPageRW();
-	uint8_t ZeroPageX();
-	uint8_t ZeroPageXRW();
-	uint8_t ZeroPageY();
-	uint16_t Absolute(int duration = 4);
-	uint16_t AbsoluteRW();
-	uint16_t AbsoluteX(int duration = 4);
-	uint16_t AbsoluteXRW();
-	uint16_t AbsoluteY(int duration = 4);
-	uint16_t Indirect();
-	uint16_t IndirectX();
-	uint16_t IndirectY(int duration = 5);
-	void Push(uint8_t value);
-	uint8_t Pull();
+	// Instructions in pages that have a DecodedPage are decoded once and then reused.
+	// The owner of the memory must report every write to such a page through InvalidateCode().
+	// Only code in read-only pages is translated into blocks.
+	void MapCode(int page, DecodedPage* code, bool readOnly);
+
+	// Pages mapped as plain RAM may be accessed directly, bypassing the bus
+	void MapRam(int page, uint8_t* data);
+
+	// Translated code reads pages mapped as ROM directly, bypassing the bus
+	void MapRom(int page, const uint8_t* data);
 
+	// Translated code writes plain RAM below endAddress directly, so the bus must need no more of
+	// those writes than InvalidateCode(). Nothing is written directly by default. Set before translation.
+	void DirectWrites(uint16_t endAddress);
+
+	// Reports RAM that the native fill and copy loops write directly
+	using RamWriteEvent = std::function<void (uint16_t address, int size)>;
+	void RamWritten(RamWriteEvent slot);
+
+	// Loops that only touch RAM and ROM and leave the CPU state unchanged are skipped up to
+	// the end of a Run() call. Enabled by default.
+	void IdleSkipping(bool enable);
+	bool IdleSkipping() const;
+	uint64_t IdleCycles() const;
+
+	void InvalidateCode(uint16_t address)
+	{
+		DecodedPage* code = m_code[address >> 8];
+		if (code && !code->empty)
+			code->Invalidate(address & 0xff, address & 0xff);
+	}
+
+protected:
 	template <int Bit>
 	bool GetP() const
 	{
@@ -84,26 +202,249 @@ private:
 		p = (p & ~(1 << Bit)) | (value << Bit);
 	}
 
-	void CLC(ImpliedType);
-	void SEC(ImpliedType);
-	void CLI(ImpliedType);
-	void SEI(ImpliedType);
-	void CLV(ImpliedType);
-	void CLD(ImpliedType);
-	void SED(ImpliedType);
+	void P(uint8_t value)
+	{
+		p = value;
+		nResult = value;
+		zResult = ~value & 0x02;
+	}
+
+	void NZ(uint8_t value)
+	{
+		nResult = value;
+		zResult = value;
+	}
+
+	bool InterruptDue() const
+	{
+		return m_pending && ((m_pending & (PendingReset | PendingNmi)) || !I());
+	}
+
+	static bool EndsBlock(uint8_t opcode);
+	static bool Translatable(uint8_t opcode);
+
+	// Native code of a translated block. It is entered with Cycles() at most cycleLimit, the limit
+	// for jumps back into the block.
+	using NativeBlock = void (*)(MOS6502State* cpu, uint64_t cycleLimit);
+
+	// Bus accesses of native code. Bits 0-7 of the result hold the value read,
+	// bit 8 requests to leave the block after the current instruction.
+	struct NativeBus
+	{
+		uint32_t (*read)(MOS6502State* cpu, uint32_t address);
+		uint32_t (*write)(MOS6502State* cpu, uint32_t address, uint32_t value);
+	};
+
+	// Returns nullptr when the code memory is full. Blocks with loops jump back into themselves.
+	// cycles receives the maximum duration of one pass through the block.
+	NativeBlock Compile(const std::vector<TranslatedInstruction>& instructions, uint16_t address, const NativeBus& bus, bool loops, int& cycles);
+	void ClearNativeCode();
+
+	// A block is left when an interrupt is due or its page is remapped
+	bool LeaveBlock() const
+	{
+		return InterruptDue() || m_code[m_blockPage] != m_blockCode;
+	}
+
+	void ProbeRead(uint16_t address)
+	{
+		DecodedPage* code = m_code[address >> 8];
+		if (!m_ram[address >> 8] && !(code && code->readOnly))
+			m_probe.clean = false;
+	}
+
+	// Must be called before the value is written
+	void ProbeWrite(uint16_t address);
+
+	void StartIdleDetection();
+	bool SkipIdle(uint64_t endCycle);
+	void StartProbe();
+	void FailProbe();
+
+	bool IsRam(int address, int size) const;
+	void Fill(uint16_t address, int size, uint8_t value);
+	void Copy(uint16_t to, uint16_t from, int size);
+
+	static constexpr int MaxLoopSize = 11;
+	static LoopIdiom MatchLoop(const uint8_t* code, int size);
+	static int LoopSize(LoopIdiom idiom);
+
+	// Reset, NMI and IRQ are combined so Step() tests a single word per instruction
+	enum : uint8_t
+	{
+		PendingReset = 0x01,
+		PendingNmi = 0x02,
+		PendingIrq = 0x04
+	};
+
+	uint8_t m_pending = 0;
+	uint64_t cycle;
+	uint16_t pc;
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	uint8_t s;
+	uint8_t p;
+	// N and Z are evaluated lazily: N is bit 7 of nResult, Z is set when zResult is 0
+	uint8_t nResult;
+	uint8_t zResult;
+	std::array<DecodedPage*, 256> m_code = {};
+	std::array<uint8_t*, 256> m_ram = {};
+	std::array<const uint8_t*, 256> m_read = {};
+	uint16_t m_directWriteEnd = 0;
+	RamWriteEvent m_ramWritten;
+
+	std::unique_ptr<ExecutableMemory> m_nativeCode;
+	int m_blockPage = 0;
+	const DecodedPage* m_blockCode = nullptr;
+	std::exception_ptr m_nativeError;	// Thrown by the bus in native code, rethrown once the block returns
+
+	struct ProbedWrite
+	{
+		uint16_t address;
+		uint8_t value;		// Value before the first write
+	};
+
+	// A probe follows one loop iteration from pc back to pc
+	struct IdleProbe
+	{
+		uint16_t pc;
+		uint8_t a;
+		uint8_t x;
+		uint8_t y;
+		uint8_t s;
+		uint8_t p;
+		uint64_t cycle;
+		bool clean;		// Only RAM and ROM accessed
+		int writeCount;
+		std::array<ProbedWrite, 32> writes;
+	};
+
+	bool m_idleSkipping = true;
+	bool m_probing = false;
+	IdleProbe m_probe;
+	uint64_t m_nextProbeCycle = 0;
+	uint64_t m_probeBackoff = 0;
+	uint64_t m_idleCycles = 0;
+
+	static const std::array<uint8_t, 256> s_operandSize;
+};
+
+// The Bus type provides uint8_t Read(uint16_t) and void Write(uint16_t, uint8_t).
+// Binding a concrete, final bus class lets the compiler inline every memory access.
+// The Policy type selects the instrumentation, see Instrumentation.h.
+template <typename Bus, typename Policy = FastPolicy>
+class BasicMOS6502 : public MOS6502State
+{
+public:
+	explicit BasicMOS6502(Bus& bus);
+
+	Policy& Instrumentation();
+	const Policy& Instrumentation() const;
+
+	void Step();
+	// Returns false when stopped at a breakpoint before endCycle
+	bool Run(uint64_t endCycle);
+
+	void Translation(TranslationMode mode);
+	TranslationMode Translation() const;
+
+private:
+	// Instructions are called with their operand bytes already fetched
+	using Instruction = void (BasicMOS6502::*)(uint16_t operand);
+
+	template <void (BasicMOS6502::*Operation)(uint16_t), uint16_t (BasicMOS6502::*Mode)(uint16_t)>
+	void Execute(uint16_t operand)
+	{
+		(this->*Operation)((this->*Mode)(operand));
+	}
+
+	template <void (BasicMOS6502::*Operation)(), int Duration>
+	void ExecuteImplied(uint16_t)
+	{
+		cycle += Duration;
+		(this->*Operation)();
+	}
+
+	template <uint8_t Opcode>
+	void Invalid(uint16_t)
+	{
+		throw InvalidOpcodeError(Opcode);
+	}
+
+	struct Block
+	{
+		std::vector<TranslatedInstruction> instructions;
+		NativeBlock code = nullptr;
+		int cycles = 0;		// Maximum duration of one pass through the block
+	};
+
+	// Code is translated after this many block entries
+	static constexpr int HotCount = 16;
+	static constexpr size_t MaxBlockSize = 32;
+	// DecodedInstruction::block holds a 16 bit index
+	static constexpr size_t MaxBlocks = 0xffff;
+
+	bool Run(uint64_t endCycle, std::true_type accelerated);
+	bool Run(uint64_t endCycle, std::false_type accelerated);
+
+	const Block* FindBlock();
+	std::vector<TranslatedInstruction> Translate(uint16_t address);
+	void DropBlocks();
+	void RunBlock(const Block& block, uint64_t endCycle);
+	static uint32_t NativeRead(MOS6502State* cpu, uint32_t address) noexcept;
+	static uint32_t NativeWrite(MOS6502State* cpu, uint32_t address, uint32_t value) noexcept;
+	bool ShadowBlock(const Block& block, uint64_t endCycle, MOS6502Snapshot& result);
+	void CheckBlock(const Block& block, uint64_t endCycle);
+
+	LoopIdiom MatchLoop(uint16_t address);
+	bool RunLoop(uint64_t endCycle);
+	template <typename Cost> int RunIterations(int count, Cost cost, uint64_t endCycle);
+	bool FillUp(uint64_t endCycle);
+	bool FillDown(uint64_t endCycle);
+	bool FillDown4(uint64_t endCycle);
+	bool CopyUp(uint64_t endCycle);
+	bool FillZeroPageX(uint64_t endCycle);
+	bool FillAbsoluteX(uint64_t endCycle);
+
+	bool Interrupt();
+	uint8_t ReadPC();
+	uint16_t ReadPC16();
+	uint16_t ReadOperand(int size);
+	uint16_t Read16(uint16_t address);
+	uint16_t Immediate(uint16_t);
+	template <int Duration> uint16_t ZeroPage(uint16_t operand);
+	template <int Duration> uint16_t ZeroPageX(uint16_t operand);
+	uint16_t ZeroPageY(uint16_t operand);
+	template <int Duration> uint16_t Absolute(uint16_t operand);
+	template <int Duration> uint16_t AbsoluteX(uint16_t operand);
+	template <int Duration> uint16_t AbsoluteY(uint16_t operand);
+	uint16_t Indirect(uint16_t operand);
+	uint16_t IndirectX(uint16_t operand);
+	template <int Duration> uint16_t IndirectY(uint16_t operand);
+	void Push(uint8_t value);
+	uint8_t Pull();
+
+	void CLC();
+	void SEC();
+	void CLI();
+	void SEI();
+	void CLV();
+	void CLD();
+	void SED();
 	uint8_t ASL_N(uint8_t arg);
-	void ASL(ImpliedType);
+	void ASL();
 	void ASL(uint16_t addr);
 	uint8_t LSR_N(uint8_t arg);
-	void LSR(ImpliedType);
+	void LSR();
 	void LSR(uint16_t addr);
 	uint8_t ROL_N(uint8_t arg);
-	void ROL(ImpliedType);
+	void ROL();
 	void ROL(uint16_t addr);
 	uint8_t ROR_N(uint8_t arg);
-	void ROR(ImpliedType);
+	void ROR();
 	void ROR(uint16_t addr);
-	void BRK(ImpliedType);
+	void BRK();
 	void CMP(uint16_t addr);
 	void AND(uint16_t addr);
 	void BIT(uint16_t addr);
@@ -121,68 +462,1492 @@ private:
 	void LDA(uint16_t addr);
 	void LDX(uint16_t addr);
 	void LDY(uint16_t addr);
-	void NOP(ImpliedType);
-	void RTI(ImpliedType);
-	void RTS(ImpliedType);
+	void NOP();
+	void RTI();
+	void RTS();
 	void STA(uint16_t addr);
 	void STX(uint16_t addr);
 	void STY(uint16_t addr);
-	void TXS(ImpliedType);
-	void TSX(ImpliedType);
-	void PHA(ImpliedType);
-	void PLA(ImpliedType);
-	void PHP(ImpliedType);
-	void PLP(ImpliedType);
-	void TAX(ImpliedType);
-	void TXA(ImpliedType);
-	void DEX(ImpliedType);
-	void INX(ImpliedType);
-	void TAY(ImpliedType);
-	void TYA(ImpliedType);
-	void DEY(ImpliedType);
-	void INY(ImpliedType);
-	void Branch(bool condition);
+	void TXS();
+	void TSX();
+	void PHA();
+	void PLA();
+	void PHP();
+	void PLP();
+	void TAX();
+	void TXA();
+	void DEX();
+	void INX();
+	void TAY();
+	void TYA();
+	void DEY();
+	void INY();
+	template <bool (MOS6502State::*Flag)() const, bool Value>
+	void Branch(uint16_t operand)
+	{
+		Branch((this->*Flag)() == Value, static_cast<int8_t>(operand));
+	}
+	void Branch(bool condition, int8_t offset);
 	uint8_t Read(uint16_t address);
 	void Write(uint16_t address, uint8_t value);
 
-	Memory& m_memory;
+	static const std::array<Instruction, 256> s_instructions;
 
-	bool m_nmi = false;
-	bool m_reset = false;
-	bool m_irq = false;
-	uint64_t cycle;
-	uint16_t pc;
-	uint8_t a;
-	uint8_t x;
-	uint8_t y;
-	uint8_t s;
-	uint8_t p;
+	Bus& m_bus;
+	Policy m_policy;
+	TranslationMode m_translation = TranslationMode::Off;
+	std::vector<Block> m_blocks;
+	uint32_t m_blockGeneration = 0;
+
+	// A shadow run stops before it accesses memory other than RAM and ROM
+	struct ShadowAbort
+	{
+	};
+	bool m_shadowing = false;
+	std::vector<uint8_t> m_shadowRam;
 };
 
-struct MemoryReadError : std::runtime_error
+using MOS6502 = BasicMOS6502<Memory>;
+
+extern template class BasicMOS6502<Memory>;
+extern template class BasicMOS6502<Memory, DebugPolicy>;
+
+std::vector<uint8_t> Load(const std::string& path);
+
+std::string ShowRegisters(const MOS6502State& cpu);
+std::string Disassemble(Memory& memory, uint16_t addr);
+
+namespace Detail {
+
+inline uint8_t MSB(uint16_t value)
 {
-	explicit MemoryReadError(uint16_t address);
+	return value >> 8;
+}
 
-	uint16_t address;
-};
+inline uint8_t LSB(uint16_t value)
+{
+	return value & 0xFF;
+}
 
-struct MemoryWriteError : std::runtime_error
+} // namespace Detail
+
+template <typename Bus, typename Policy>
+BasicMOS6502<Bus, Policy>::BasicMOS6502(Bus& bus) :
+	m_bus(bus)
 {
-	explicit MemoryWriteError(uint16_t address);
+}
 
-	uint16_t address;
-};
+template <typename Bus, typename Policy>
+Policy& BasicMOS6502<Bus, Policy>::Instrumentation()
+{
+	return m_policy;
+}
 
-struct InvalidOpcodeError : std::runtime_error
+template <typename Bus, typename Policy>
+const Policy& BasicMOS6502<Bus, Policy>::Instrumentation() const
 {
-	explicit InvalidOpcodeError(uint8_t opcode);
+	return m_policy;
+}
 
-	uint8_t opcode;
-};
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::Step()
+{
+	if (m_pending && Interrupt())
+		return;
 
-std::vector<uint8_t> Load(const std::string& path);
+	DecodedPage* code = m_code[pc >> 8];
+	if (code)
+	{
+		const DecodedInstruction& decoded = code->instructions[pc & 0xff];
+		if (decoded.length != 0)
+		{
+			m_policy.BeforeInstruction(*this, decoded.opcode);
+			pc += decoded.length;
+			(this->*s_instructions[decoded.opcode])(decoded.operand);
+			return;
+		}
+	}
 
-std::string ShowRegisters(const MOS6502& cpu);
-std::string Disassemble(Memory& memory, uint16_t addr);
+	uint16_t address = pc;
+	uint8_t opcode = Read(pc);
+	m_policy.BeforeInstruction(*this, opcode);
+	++pc;
+	uint16_t operand = ReadOperand(s_operandSize[opcode]);
+	// Instructions that continue into the next page are never cached
+	if (code && (pc & 0xff00) == (address & 0xff00))
+		code->Store(address & 0xff, opcode, pc - address, operand, static_cast<uint8_t>(MatchLoop(address)));
+	(this->*s_instructions[opcode])(operand);
+}
+
+// Executes instructions until Cycles() reaches endCycle or a breakpoint is hit
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::Run(uint64_t endCycle)
+{
+	return Run(endCycle, std::integral_constant<bool, Policy::Accelerated>());
+}
+
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::Run(uint64_t endCycle, std::true_type)
+{
+	StartIdleDetection();
+	while (cycle < endCycle)
+	{
+		if (InterruptDue())
+		{
+			Step();
+			continue;
+		}
+		if (m_policy.Break(pc, cycle))
+			break;
+		if (m_idleSkipping && cycle >= m_nextProbeCycle && SkipIdle(endCycle))
+			continue;
+		if (RunLoop(endCycle))
+			continue;
+
+		const Block* block = m_translation != TranslationMode::Off && !m_probing ? FindBlock() : nullptr;
+		if (!block || cycle + block->cycles > endCycle)
+			Step();
+		else if (m_translation == TranslationMode::On)
+			RunBlock(*block, endCycle);
+		else
+			CheckBlock(*block, endCycle);
+	}
+	m_probing = false;
+	return cycle >= endCycle;
+}
+
+// Every instruction goes through Step() so the policy sees all of them
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::Run(uint64_t endCycle, std::false_type)
+{
+	while (cycle < endCycle)
+	{
+		if (!InterruptDue() && m_policy.Break(pc, cycle))
+			return false;
+		Step();
+	}
+	return true;
+}
+
+// Changing the mode drops the translated blocks, Lockstep blocks make a single pass
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::Translation(TranslationMode mode)
+{
+#if !defined(DJEEDJAY_X64)
+	mode = TranslationMode::Off;
+#endif
+	if (mode != m_translation)
+		DropBlocks();
+	m_translation = mode;
+}
+
+template <typename Bus, typename Policy>
+TranslationMode BasicMOS6502<Bus, Policy>::Translation() const
+{
+	return m_translation;
+}
+
+// Returns the translated block starting at pc, translating it once it has been entered HotCount times.
+// When the blocks or the code memory run out all of them are dropped, which also reclaims the blocks
+// of replaced pages. Each page clears its stale block indices when it next translates a block.
+template <typename Bus, typename Policy>
+auto BasicMOS6502<Bus, Policy>::FindBlock() -> const Block*
+{
+	DecodedPage* code = m_code[pc >> 8];
+	if (!code || !code->readOnly)
+		return nullptr;
+
+	DecodedInstruction& entry = code->instructions[pc & 0xff];
+	if (entry.block != 0 && code->blockGeneration == m_blockGeneration)
+		return &m_blocks[entry.block - 1];
+	if (++entry.hits < HotCount)
+		return nullptr;
+
+	entry.hits = 0;
+	Block block;
+	block.instructions = Translate(pc);
+	if (block.instructions.empty())
+		return nullptr;
+
+	NativeBus bus = { &BasicMOS6502::NativeRead, &BasicMOS6502::NativeWrite };
+	bool loops = m_translation == TranslationMode::On;
+	if (m_blocks.size() < MaxBlocks)
+		block.code = Compile(block.instructions, pc, bus, loops, block.cycles);
+	if (!block.code)
+	{
+		DropBlocks();
+		block.code = Compile(block.instructions, pc, bus, loops, block.cycles);
+		if (!block.code)
+			return nullptr;
+	}
+	if (code->blockGeneration != m_blockGeneration)
+	{
+		for (DecodedInstruction& instruction : code->instructions)
+			instruction.block = 0;
+		code->blockGeneration = m_blockGeneration;
+	}
+	m_blocks.push_back(std::move(block));
+	entry.block = static_cast<uint16_t>(m_blocks.size());
+	return &m_blocks.back();
+}
+
+// A block ends at a control transfer, at the end of the page, before an invalid opcode, before a
+// loop idiom, which RunLoop() runs faster, or at MaxBlockSize instructions
+template <typename Bus, typename Policy>
+auto BasicMOS6502<Bus, Policy>::Translate(uint16_t address) -> std::vector<TranslatedInstruction>
+{
+	std::vector<TranslatedInstruction> block;
+	for (;;)
+	{
+		uint8_t opcode = Read(address);
+		int size = s_operandSize[opcode];
+		if ((address & 0xff) + size > 0xff || !Translatable(opcode) || MatchLoop(address) != LoopIdiom::None)
+			break;
+
+		uint16_t operand = size == 2 ? Read16(address + 1) : size == 1 ? Read(address + 1) : 0;
+		block.push_back({ opcode, static_cast<uint8_t>(1 + size), operand });
+		address += 1 + size;
+		if (EndsBlock(opcode) || (address & 0xff) == 0 || block.size() == MaxBlockSize)
+			break;
+	}
+	return block;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::DropBlocks()
+{
+	m_blocks.clear();
+	ClearNativeCode();
+	++m_blockGeneration;
+}
+
+// The caller makes sure a pass through the block ends by endCycle. The block is left early when an
+// interrupt is due or the page is remapped.
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::RunBlock(const Block& block, uint64_t endCycle)
+{
+	m_blockPage = pc >> 8;
+	m_blockCode = m_code[pc >> 8];
+	block.code(this, endCycle - block.cycles);
+	if (m_nativeError)
+	{
+		std::exception_ptr error = m_nativeError;
+		m_nativeError = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+// No exception may unwind through native code. After an exception the block makes no more bus
+// accesses and is left after the current instruction.
+template <typename Bus, typename Policy>
+uint32_t BasicMOS6502<Bus, Policy>::NativeRead(MOS6502State* state, uint32_t address) noexcept
+{
+	auto& cpu = static_cast<BasicMOS6502&>(*state);
+	if (cpu.m_nativeError)
+		return 0x100;
+	try
+	{
+		uint8_t value = cpu.Read(static_cast<uint16_t>(address));
+		return value | (cpu.LeaveBlock() ? 0x100 : 0);
+	}
+	catch (...)
+	{
+		cpu.m_nativeError = std::current_exception();
+		return 0x100;
+	}
+}
+
+template <typename Bus, typename Policy>
+uint32_t BasicMOS6502<Bus, Policy>::NativeWrite(MOS6502State* state, uint32_t address, uint32_t value) noexcept
+{
+	auto& cpu = static_cast<BasicMOS6502&>(*state);
+	if (cpu.m_nativeError)
+		return 0x100;
+	try
+	{
+		cpu.Write(static_cast<uint16_t>(address), static_cast<uint8_t>(value));
+		return cpu.LeaveBlock() ? 0x100 : 0;
+	}
+	catch (...)
+	{
+		cpu.m_nativeError = std::current_exception();
+		return 0x100;
+	}
+}
+
+// Runs the block translated without lasting effects and returns the resulting state.
+// The RAM writes through the bus are journalled by the idle probe and undone, the direct writes are
+// undone from a copy of their pages, the CPU state is restored.
+// Returns false when the block accesses memory other than RAM and ROM, which is not run twice.
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::ShadowBlock(const Block& block, uint64_t endCycle, MOS6502Snapshot& result)
+{
+	MOS6502Snapshot start;
+	Save(start);
+	bool probing = m_probing;
+	IdleProbe probe = m_probe;
+	uint64_t nextProbeCycle = m_nextProbeCycle;
+	uint64_t probeBackoff = m_probeBackoff;
+
+	int directPages = (m_directWriteEnd + 0xff) >> 8;
+	m_shadowRam.resize(0x100 * directPages);
+	for (int page = 0; page < directPages; ++page)
+	{
+		if (m_ram[page])
+			std::copy(m_ram[page], m_ram[page] + 0x100, m_shadowRam.data() + 0x100 * page);
+	}
+
+	auto undo = [&]()
+	{
+		for (int i = 0; i < m_probe.writeCount; ++i)
+		{
+			uint16_t address = m_probe.writes[i].address;
+			m_ram[address >> 8][address & 0xff] = m_probe.writes[i].value;
+		}
+		for (int page = 0; page < directPages; ++page)
+		{
+			if (m_ram[page])
+				std::copy(m_shadowRam.data() + 0x100 * page, m_shadowRam.data() + 0x100 * (page + 1), m_ram[page]);
+		}
+		m_shadowing = false;
+		Restore(start);
+		m_probing = probing;
+		m_probe = probe;
+		m_nextProbeCycle = nextProbeCycle;
+		m_probeBackoff = probeBackoff;
+	};
+
+	m_probing = true;
+	m_shadowing = true;
+	m_probe.clean = true;
+	m_probe.writeCount = 0;
+	bool completed = true;
+	try
+	{
+		RunBlock(block, endCycle);
+	}
+	catch (ShadowAbort&)
+	{
+		completed = false;
+	}
+	catch (...)
+	{
+		undo();
+		throw;
+	}
+	Save(result);
+	undo();
+	return completed;
+}
+
+// Interprets the block and checks it against the decoding of the translation and against the
+// registers, flags and cycle count of a translated run
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CheckBlock(const Block& block, uint64_t endCycle)
+{
+	uint16_t start = pc;
+	MOS6502Snapshot translated;
+	bool shadowed = ShadowBlock(block, endCycle, translated);
+
+	const DecodedPage* code = m_code[pc >> 8];
+	for (const TranslatedInstruction& instruction : block.instructions)
+	{
+		uint16_t address = pc;
+		uint8_t opcode = Read(address);
+		int size = s_operandSize[opcode];
+		uint16_t operand = size == 2 ? Read16(address + 1) : size == 1 ? Read(address + 1) : 0;
+		if (instruction.opcode != opcode || instruction.operand != operand || instruction.length != 1 + size)
+			throw TranslationError(address);
+
+		Step();
+		if (cycle >= endCycle || InterruptDue() || m_code[pc >> 8] != code)
+			break;
+		if (&instruction != &block.instructions.back() && pc != static_cast<uint16_t>(address + instruction.length))
+			throw TranslationError(address);
+	}
+
+	if (!shadowed)
+		return;
+	MOS6502Snapshot interpreted;
+	Save(interpreted);
+	if (interpreted.cycle != translated.cycle || interpreted.pc != translated.pc ||
+		interpreted.a != translated.a || interpreted.x != translated.x || interpreted.y != translated.y ||
+		interpreted.s != translated.s || interpreted.p != translated.p || interpreted.pending != translated.pending)
+		throw TranslationError(start);
+}
+
+template <typename Bus, typename Policy>
+LoopIdiom BasicMOS6502<Bus, Policy>::MatchLoop(uint16_t address)
+{
+	std::array<uint8_t, MaxLoopSize> code;
+	int size = std::min(MaxLoopSize, 0x100 - (address & 0xff));
+	for (int i = 0; i < size; ++i)
+		code[i] = Read(address + i);
+	return MOS6502State::MatchLoop(code.data(), size);
+}
+
+// Runs the loop idiom at pc natively when its memory is plain RAM that holds neither the loop
+// nor its pointers. Only the iterations that complete by endCycle are run.
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::RunLoop(uint64_t endCycle)
+{
+	DecodedPage* code = m_code[pc >> 8];
+	if (!code)
+		return false;
+
+	auto idiom = static_cast<LoopIdiom>(code->instructions[pc & 0xff].loop);
+	if (idiom == LoopIdiom::None || (!code->readOnly && MatchLoop(pc) != idiom))
+		return false;
+
+	switch (idiom)
+	{
+	case LoopIdiom::FillUp: return FillUp(endCycle);
+	case LoopIdiom::FillDown: return FillDown(endCycle);
+	case LoopIdiom::FillDown4: return FillDown4(endCycle);
+	case LoopIdiom::CopyUp: return CopyUp(endCycle);
+	case LoopIdiom::FillZeroPageX: return FillZeroPageX(endCycle);
+	case LoopIdiom::FillAbsoluteX: return FillAbsoluteX(endCycle);
+	default: return false;
+	}
+}
+
+// Advances cycle over the iterations that complete by endCycle and returns their number.
+// cost(i) is the duration of iteration i without the closing branch back to pc.
+template <typename Bus, typename Policy>
+template <typename Cost>
+int BasicMOS6502<Bus, Policy>::RunIterations(int count, Cost cost, uint64_t endCycle)
+{
+	DecodedPage* code = m_code[pc >> 8];
+	uint16_t exit = pc + LoopSize(static_cast<LoopIdiom>(code->instructions[pc & 0xff].loop));
+	int taken = ((exit ^ pc) & 0xff00) != 0 ? 4 : 3;
+
+	int i = 0;
+	for (; i < count; ++i)
+	{
+		uint64_t next = cycle + cost(i) + (i + 1 < count ? taken : 2);
+		if (next > endCycle)
+			break;
+		cycle = next;
+	}
+	if (i == count)
+		pc = exit;
+	return i;
+}
+
+namespace Detail {
+
+inline bool Overlaps(int address, int size, int first, int count)
+{
+	return address < first + count && first < address + size;
+}
+
+} // namespace Detail
+
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::FillUp(uint64_t endCycle)
+{
+	uint8_t zp = Read(pc + 1);
+	int address = Read16(zp) + y;
+	int count = 0x100 - y;
+	if (!IsRam(address, count) || Detail::Overlaps(address, count, zp, 2) || Detail::Overlaps(address, count, pc, 5))
+		return false;
+
+	int done = RunIterations(count, [](int) { return 8; }, endCycle);
+	if (done == 0)
+		return false;
+
+	Fill(address, done, a);
+	y += done;
+	NZ(y);
+	return true;
+}
+
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::FillDown(uint64_t endCycle)
+{
+	uint8_t zp = Read(pc + 2);
+	int base = Read16(zp);
+	int count = y == 0 ? 0x100 : y;
+	if (!IsRam(base, count) || Detail::Overlaps(base, count, zp, 2) || Detail::Overlaps(base, count, pc, 5))
+		return false;
+
+	int done = RunIterations(count, [](int) { return 8; }, endCycle);
+	if (done == 0)
+		return false;
+
+	Fill(base + count - done, done, a);
+	y = static_cast<uint8_t>(count - done);
+	NZ(y);
+	return true;
+}
+
+// The first iteration stores at y, so y == 0 covers offsets 0 and then 255 down to 1
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::FillDown4(uint64_t endCycle)
+{
+	int count = y == 0 ? 0x100 : y;
+	int first = y == 0 ? 0 : 1;
+	std::array<int, 4> bases;
+	for (int i = 0; i < 4; ++i)
+	{
+		uint8_t zp = Read(pc + 1 + 2 * i);
+		bases[i] = Read16(zp);
+		if (!IsRam(bases[i] + first, count) || Detail::Overlaps(bases[i] + first, count, pc, 11))
+			return false;
+		for (int j = 0; j < 4; ++j)
+		{
+			if (Detail::Overlaps(bases[i] + first, count, Read(pc + 1 + 2 * j), 2))
+				return false;
+		}
+	}
+
+	int done = RunIterations(count, [](int) { return 26; }, endCycle);
+	if (done == 0)
+		return false;
+
+	for (int base : bases)
+	{
+		if (y == 0)
+		{
+			Fill(base, 1, a);
+			Fill(base + 0x101 - done, done - 1, a);
+		}
+		else
+		{
+			Fill(base + y + 1 - done, done, a);
+		}
+	}
+	y -= done;
+	NZ(y);
+	return true;
+}
+
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::CopyUp(uint64_t endCycle)
+{
+	uint8_t fromZp = Read(pc + 1);
+	uint8_t toZp = Read(pc + 3);
+	uint16_t fromBase = Read16(fromZp);
+	int from = fromBase + y;
+	int to = Read16(toZp) + y;
+	int count = 0x100 - y;
+	if (!IsRam(from, count) || !IsRam(to, count) ||
+		Detail::Overlaps(to, count, fromZp, 2) || Detail::Overlaps(to, count, toZp, 2) || Detail::Overlaps(to, count, pc, 7))
+		return false;
+
+	uint8_t index = y;
+	int done = RunIterations(count, [fromBase, index](int i) { return 13 + (((fromBase & 0xff) + index + i) >> 8); }, endCycle);
+	if (done == 0)
+		return false;
+
+	Copy(to, from, done);
+	a = Read(to + done - 1);
+	y += done;
+	NZ(y);
+	return true;
+}
+
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::FillZeroPageX(uint64_t endCycle)
+{
+	int address = static_cast<uint8_t>(Read(pc + 1) + x);
+	int count = 0x100 - x;
+	if (!IsRam(0x0000, 0x100) || (pc >> 8) == 0)
+		return false;
+
+	int done = RunIterations(count, [](int) { return 6; }, endCycle);
+	if (done == 0)
+		return false;
+
+	int size = std::min(done, 0x100 - address);
+	Fill(address, size, a);
+	Fill(0x0000, done - size, a);
+	x += done;
+	NZ(x);
+	return true;
+}
+
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::FillAbsoluteX(uint64_t endCycle)
+{
+	int address = Read16(pc + 1) + x;
+	int count = 0x100 - x;
+	if (!IsRam(address, count) || Detail::Overlaps(address, count, pc, 6))
+		return false;
+
+	int done = RunIterations(count, [](int) { return 7; }, endCycle);
+	if (done == 0)
+		return false;
+
+	Fill(address, done, a);
+	x += done;
+	NZ(x);
+	return true;
+}
+
+template <typename Bus, typename Policy>
+bool BasicMOS6502<Bus, Policy>::Interrupt()
+{
+	if (m_pending & PendingReset)
+	{
+		cycle = 0;
+		pc = Read16(0xfffc);
+		P(0x00);
+		s = 0xff;
+		return true;
+	}
+	if (m_pending & PendingNmi)
+	{
+		Push(Detail::MSB(pc));
+		Push(Detail::LSB(pc));
+		Push((P() & 0xcf) | 0x20);
+		m_pending &= ~PendingNmi;
+		pc = Read16(0xfffa);
+		cycle += 7;
+		return true;
+	}
+	if ((m_pending & PendingIrq) && !I())
+	{
+		Push(Detail::MSB(pc));
+		Push(Detail::LSB(pc));
+		Push((P() & 0xcf) | 0x20);
+		I(true);
+		pc = Read16(0xfffe);
+		cycle += 7;
+		return true;
+	}
+	return false;
+}
+
+template <typename Bus, typename Policy>
+uint8_t BasicMOS6502<Bus, Policy>::ReadPC()
+{
+	return Read(pc++);
+}
+
+template <typename Bus, typename Policy>
+uint16_t BasicMOS6502<Bus, Policy>::ReadPC16()
+{
+	uint16_t lsb = ReadPC();
+	uint16_t msb = ReadPC();
+	return (msb << 8) | lsb;
+}
+
+template <typename Bus, typename Policy>
+uint16_t BasicMOS6502<Bus, Policy>::ReadOperand(int size)
+{
+	return size == 2 ? ReadPC16() : size == 1 ? ReadPC() : 0;
+}
+
+template <typename Bus, typename Policy>
+uint16_t BasicMOS6502<Bus, Policy>::Read16(uint16_t address)
+{
+	uint16_t lsb = Read(address);
+	uint16_t msb = Read(address + 1);
+	return (msb << 8) | lsb;
+}
+
+template <typename Bus, typename Policy>
+uint16_t BasicMOS6502<Bus, Policy>::Immediate(uint16_t)
+{
+	cycle += 2;
+	return pc - 1;
+}
+
+template <typename Bus, typename Policy>
+template <int Duration>
+uint16_t BasicMOS6502<Bus, Policy>::ZeroPage(uint16_t operand)
+{
+	cycle += Duration;
+	return operand;
+}
+
+template <typename Bus, typename Policy>
+template <int Duration>
+uint16_t BasicMOS6502<Bus, Policy>::ZeroPageX(uint16_t operand)
+{
+	cycle += Duration;
+	return static_cast<uint8_t>(operand + x);
+}
+
+template <typename Bus, typename Policy>
+uint16_t BasicMOS6502<Bus, Policy>::ZeroPageY(uint16_t operand)
+{
+	cycle += 4;
+	return static_cast<uint8_t>(operand + y);
+}
+
+template <typename Bus, typename Policy>
+template <int Duration>
+uint16_t BasicMOS6502<Bus, Policy>::Absolute(uint16_t operand)
+{
+	cycle += Duration;
+	return operand;
+}
+
+// Only the 4 cycle read instructions take an extra cycle on a page crossing
+template <typename Bus, typename Policy>
+template <int Duration>
+uint16_t BasicMOS6502<Bus, Policy>::AbsoluteX(uint16_t operand)
+{
+	uint16_t lsb = (operand & 0xff) + x;
+
+	cycle += Duration == 4 ? Duration + (lsb >> 8) : Duration;
+	return (operand & 0xff00) + lsb;
+}
+
+template <typename Bus, typename Policy>
+template <int Duration>
+uint16_t BasicMOS6502<Bus, Policy>::AbsoluteY(uint16_t operand)
+{
+	uint16_t lsb = (operand & 0xff) + y;
+
+	cycle += Duration == 4 ? Duration + (lsb >> 8) : Duration;
+	return (operand & 0xff00) + lsb;
+}
+
+template <typename Bus, typename Policy>
+uint16_t BasicMOS6502<Bus, Policy>::Indirect(uint16_t operand)
+{
+	cycle += 5;
+	uint8_t a0 = Detail::LSB(operand);
+	uint8_t a1 = Detail::MSB(operand);
+	uint8_t addr0 = Read((a1 << 8) | a0);
+	uint8_t addr1 = Read((a1 << 8) | (a0 + 1));
+	return (addr1 << 8) | addr0;
+}
+
+template <typename Bus, typename Policy>
+uint16_t BasicMOS6502<Bus, Policy>::IndirectX(uint16_t operand)
+{
+	cycle += 6;
+	return Read16(static_cast<uint8_t>(operand + x));
+}
+
+template <typename Bus, typename Policy>
+template <int Duration>
+uint16_t BasicMOS6502<Bus, Policy>::IndirectY(uint16_t operand)
+{
+	uint16_t addr = operand;
+	uint16_t lsb = Read(addr) + y;
+	uint16_t msb = Read(addr + 1);
+
+	cycle += Duration == 5 ? Duration + (lsb >> 8) : Duration;
+	return (msb << 8) + lsb;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::Push(uint8_t value)
+{
+	Write(0x0100 | s, value);
+	--s;
+}
+
+template <typename Bus, typename Policy>
+uint8_t BasicMOS6502<Bus, Policy>::Pull()
+{
+	++s;
+	return Read(0x0100 | s);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CLC()
+{
+	C(false);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::SEC()
+{
+	C(true);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CLI()
+{
+	I(false);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::SEI()
+{
+	I(true);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CLV()
+{
+	V(false);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CLD()
+{
+	D(false);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::SED()
+{
+	D(true);
+}
+
+template <typename Bus, typename Policy>
+uint8_t BasicMOS6502<Bus, Policy>::ASL_N(uint8_t arg)
+{
+	C(arg & 0x80);
+	arg = arg << 1;
+	NZ(arg);
+	return arg;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ASL()
+{
+	a = ASL_N(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ASL(uint16_t addr)
+{
+	Write(addr, ASL_N(Read(addr)));
+}
+
+template <typename Bus, typename Policy>
+uint8_t BasicMOS6502<Bus, Policy>::LSR_N(uint8_t arg)
+{
+	C(arg & 0x01);
+	arg = arg >> 1;
+	NZ(arg);
+	return arg;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::LSR()
+{
+	a = LSR_N(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::LSR(uint16_t addr)
+{
+	Write(addr, LSR_N(Read(addr)));
+}
+
+template <typename Bus, typename Policy>
+uint8_t BasicMOS6502<Bus, Policy>::ROL_N(uint8_t arg)
+{
+	uint8_t c = C();
+	uint8_t result = (arg << 1) | c;
+	C(arg & 0x80);
+	NZ(result);
+	return result;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ROL()
+{
+	a = ROL_N(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ROL(uint16_t addr)
+{
+	Write(addr, ROL_N(Read(addr)));
+}
+
+template <typename Bus, typename Policy>
+uint8_t BasicMOS6502<Bus, Policy>::ROR_N(uint8_t arg)
+{
+	uint8_t c = C();
+	uint8_t result = (c << 7) | (arg >> 1);
+	C(arg & 0x01);
+	NZ(result);
+	return result;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ROR()
+{
+	a = ROR_N(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ROR(uint16_t addr)
+{
+	Write(addr, ROR_N(Read(addr)));
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::BRK()
+{
+	pc += 1;
+	Push(Detail::MSB(pc));
+	Push(Detail::LSB(pc));
+	Push(P() | 0x30);
+	I(true);
+	pc = Read16(0xfffe);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CMP(uint16_t addr)
+{
+	uint8_t arg = Read(addr);
+	C(a >= arg);
+	NZ(a - arg);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::AND(uint16_t addr)
+{
+	a &= Read(addr);
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::BIT(uint16_t addr)
+{
+	auto arg = Read(addr);
+	nResult = arg;
+	V(arg & 0x40);
+	zResult = arg & a;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ORA(uint16_t addr)
+{
+	a |= Read(addr);
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ADC_N(uint8_t arg)
+{
+	uint16_t sum = a + arg + C();
+	C(sum > 255);
+	V((a ^ sum) & (arg ^ sum) & 0x80);
+	a = static_cast<uint8_t>(sum);
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::ADC(uint16_t addr)
+{
+	ADC_N(Read(addr));
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::SBC(uint16_t addr)
+{
+	ADC_N(~Read(addr));
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CPX(uint16_t addr)
+{
+	uint8_t arg = Read(addr);
+	C(x >= arg);
+	NZ(x - arg);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::CPY(uint16_t addr)
+{
+	uint8_t arg = Read(addr);
+	C(y >= arg);
+	NZ(y - arg);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::DEC(uint16_t addr)
+{
+	uint8_t value = Read(addr) - 1;
+	NZ(value);
+	Write(addr, value);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::EOR(uint16_t addr)
+{
+	a ^= Read(addr);
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::INC(uint16_t addr)
+{
+	uint8_t value = Read(addr) + 1;
+	Write(addr, value);
+	NZ(value);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::JMP(uint16_t addr)
+{
+	pc = addr;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::JSR(uint16_t addr)
+{
+	uint16_t next = pc - 1;
+	Push(Detail::MSB(next));
+	Push(Detail::LSB(next));
+	pc = addr;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::LDA(uint16_t addr)
+{
+	a = Read(addr);
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::LDX(uint16_t addr)
+{
+	x = Read(addr);
+	NZ(x);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::LDY(uint16_t addr)
+{
+	y = Read(addr);
+	NZ(y);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::NOP()
+{
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::RTI()
+{
+	P(Pull() & 0xcf);
+	uint16_t addr = Pull();
+	addr |= Pull() << 8;
+	pc = addr;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::RTS()
+{
+	uint16_t addr = Pull();
+	addr |= Pull() << 8;
+	pc = addr + 1;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::STA(uint16_t addr)
+{
+	Write(addr, a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::STX(uint16_t addr)
+{
+	Write(addr, x);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::STY(uint16_t addr)
+{
+	Write(addr, y);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::TXS()
+{
+	s = x;
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::TSX()
+{
+	x = s;
+	NZ(x);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::PHA()
+{
+	Push(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::PLA()
+{
+	a = Pull();
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::PHP()
+{
+	Push(P() | 0x30);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::PLP()
+{
+	P(Pull() & 0xcf);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::TAX()
+{
+	x = a;
+	NZ(x);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::TXA()
+{
+	a = x;
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::DEX()
+{
+	--x;
+	NZ(x);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::INX()
+{
+	++x;
+	NZ(x);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::TAY()
+{
+	y = a;
+	NZ(y);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::TYA()
+{
+	a = y;
+	NZ(a);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::DEY()
+{
+	--y;
+	NZ(y);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::INY()
+{
+	++y;
+	NZ(y);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::Branch(bool condition, int8_t offset)
+{
+	if (condition)
+	{
+		uint16_t dst = pc + offset;
+		if ((dst & 0xff00) != (pc & 0xff00))
+			cycle += 1;
+		pc = dst;
+		cycle += 1;
+	}
+	cycle += 2;
+}
+
+template <typename Bus, typename Policy>
+uint8_t BasicMOS6502<Bus, Policy>::Read(uint16_t address)
+{
+	if (m_probing)
+	{
+		ProbeRead(address);
+		if (m_shadowing && !m_probe.clean)
+			throw ShadowAbort();
+	}
+	return m_bus.Read(address);
+}
+
+template <typename Bus, typename Policy>
+void BasicMOS6502<Bus, Policy>::Write(uint16_t address, uint8_t value)
+{
+	if (m_probing)
+	{
+		ProbeWrite(address);
+		if (m_shadowing && !m_probe.clean)
+			throw ShadowAbort();
+	}
+	m_bus.Write(address, value);
+}
+
+template <typename Bus, typename Policy>
+const std::array<typename BasicMOS6502<Bus, Policy>::Instruction, 256> BasicMOS6502<Bus, Policy>::s_instructions =
+{{
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::BRK, 7>, // 00
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::IndirectX>, // 01
+	&BasicMOS6502::Invalid<0x02>, // 02
+	&BasicMOS6502::Invalid<0x03>, // 03
+	&BasicMOS6502::Invalid<0x04>, // 04
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::ZeroPage<3>>, // 05
+	&BasicMOS6502::Execute<&BasicMOS6502::ASL, &BasicMOS6502::ZeroPage<5>>, // 06
+	&BasicMOS6502::Invalid<0x07>, // 07
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::PHP, 3>, // 08
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::Immediate>, // 09
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::ASL, 2>, // 0a
+	&BasicMOS6502::Invalid<0x0b>, // 0b
+	&BasicMOS6502::Invalid<0x0c>, // 0c
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::Absolute<4>>, // 0d
+	&BasicMOS6502::Execute<&BasicMOS6502::ASL, &BasicMOS6502::Absolute<6>>, // 0e
+	&BasicMOS6502::Invalid<0x0f>, // 0f
+	&BasicMOS6502::Branch<&MOS6502State::N, false>, // 10
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::IndirectY<5>>, // 11
+	&BasicMOS6502::Invalid<0x12>, // 12
+	&BasicMOS6502::Invalid<0x13>, // 13
+	&BasicMOS6502::Invalid<0x14>, // 14
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::ZeroPageX<4>>, // 15
+	&BasicMOS6502::Execute<&BasicMOS6502::ASL, &BasicMOS6502::ZeroPageX<6>>, // 16
+	&BasicMOS6502::Invalid<0x17>, // 17
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::CLC, 2>, // 18
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::AbsoluteY<4>>, // 19
+	&BasicMOS6502::Invalid<0x1a>, // 1a
+	&BasicMOS6502::Invalid<0x1b>, // 1b
+	&BasicMOS6502::Invalid<0x1c>, // 1c
+	&BasicMOS6502::Execute<&BasicMOS6502::ORA, &BasicMOS6502::AbsoluteX<4>>, // 1d
+	&BasicMOS6502::Execute<&BasicMOS6502::ASL, &BasicMOS6502::AbsoluteX<7>>, // 1e
+	&BasicMOS6502::Invalid<0x1f>, // 1f
+	&BasicMOS6502::Execute<&BasicMOS6502::JSR, &BasicMOS6502::Absolute<6>>, // 20
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::IndirectX>, // 21
+	&BasicMOS6502::Invalid<0x22>, // 22
+	&BasicMOS6502::Invalid<0x23>, // 23
+	&BasicMOS6502::Execute<&BasicMOS6502::BIT, &BasicMOS6502::ZeroPage<3>>, // 24
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::ZeroPage<3>>, // 25
+	&BasicMOS6502::Execute<&BasicMOS6502::ROL, &BasicMOS6502::ZeroPage<5>>, // 26
+	&BasicMOS6502::Invalid<0x27>, // 27
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::PLP, 4>, // 28
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::Immediate>, // 29
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::ROL, 2>, // 2a
+	&BasicMOS6502::Invalid<0x2b>, // 2b
+	&BasicMOS6502::Execute<&BasicMOS6502::BIT, &BasicMOS6502::Absolute<4>>, // 2c
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::Absolute<4>>, // 2d
+	&BasicMOS6502::Execute<&BasicMOS6502::ROL, &BasicMOS6502::Absolute<6>>, // 2e
+	&BasicMOS6502::Invalid<0x2f>, // 2f
+	&BasicMOS6502::Branch<&MOS6502State::N, true>, // 30
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::IndirectY<5>>, // 31
+	&BasicMOS6502::Invalid<0x32>, // 32
+	&BasicMOS6502::Invalid<0x33>, // 33
+	&BasicMOS6502::Invalid<0x34>, // 34
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::ZeroPageX<4>>, // 35
+	&BasicMOS6502::Execute<&BasicMOS6502::ROL, &BasicMOS6502::ZeroPageX<6>>, // 36
+	&BasicMOS6502::Invalid<0x37>, // 37
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::SEC, 2>, // 38
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::AbsoluteY<4>>, // 39
+	&BasicMOS6502::Invalid<0x3a>, // 3a
+	&BasicMOS6502::Invalid<0x3b>, // 3b
+	&BasicMOS6502::Invalid<0x3c>, // 3c
+	&BasicMOS6502::Execute<&BasicMOS6502::AND, &BasicMOS6502::AbsoluteX<4>>, // 3d
+	&BasicMOS6502::Execute<&BasicMOS6502::ROL, &BasicMOS6502::AbsoluteX<7>>, // 3e
+	&BasicMOS6502::Invalid<0x3f>, // 3f
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::RTI, 6>, // 40
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::IndirectX>, // 41
+	&BasicMOS6502::Invalid<0x42>, // 42
+	&BasicMOS6502::Invalid<0x43>, // 43
+	&BasicMOS6502::Invalid<0x44>, // 44
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::ZeroPage<3>>, // 45
+	&BasicMOS6502::Execute<&BasicMOS6502::LSR, &BasicMOS6502::ZeroPage<5>>, // 46
+	&BasicMOS6502::Invalid<0x47>, // 47
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::PHA, 3>, // 48
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::Immediate>, // 49
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::LSR, 2>, // 4a
+	&BasicMOS6502::Invalid<0x4b>, // 4b
+	&BasicMOS6502::Execute<&BasicMOS6502::JMP, &BasicMOS6502::Absolute<3>>, // 4c
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::Absolute<4>>, // 4d
+	&BasicMOS6502::Execute<&BasicMOS6502::LSR, &BasicMOS6502::Absolute<6>>, // 4e
+	&BasicMOS6502::Invalid<0x4f>, // 4f
+	&BasicMOS6502::Branch<&MOS6502State::V, false>, // 50
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::IndirectY<5>>, // 51
+	&BasicMOS6502::Invalid<0x52>, // 52
+	&BasicMOS6502::Invalid<0x53>, // 53
+	&BasicMOS6502::Invalid<0x54>, // 54
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::ZeroPageX<4>>, // 55
+	&BasicMOS6502::Execute<&BasicMOS6502::LSR, &BasicMOS6502::ZeroPageX<6>>, // 56
+	&BasicMOS6502::Invalid<0x57>, // 57
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::CLI, 2>, // 58
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::AbsoluteY<4>>, // 59
+	&BasicMOS6502::Invalid<0x5a>, // 5a
+	&BasicMOS6502::Invalid<0x5b>, // 5b
+	&BasicMOS6502::Invalid<0x5c>, // 5c
+	&BasicMOS6502::Execute<&BasicMOS6502::EOR, &BasicMOS6502::AbsoluteX<4>>, // 5d
+	&BasicMOS6502::Execute<&BasicMOS6502::LSR, &BasicMOS6502::AbsoluteX<7>>, // 5e
+	&BasicMOS6502::Invalid<0x5f>, // 5f
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::RTS, 6>, // 60
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::IndirectX>, // 61
+	&BasicMOS6502::Invalid<0x62>, // 62
+	&BasicMOS6502::Invalid<0x63>, // 63
+	&BasicMOS6502::Invalid<0x64>, // 64
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::ZeroPage<3>>, // 65
+	&BasicMOS6502::Execute<&BasicMOS6502::ROR, &BasicMOS6502::ZeroPage<5>>, // 66
+	&BasicMOS6502::Invalid<0x67>, // 67
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::PLA, 4>, // 68
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::Immediate>, // 69
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::ROR, 2>, // 6a
+	&BasicMOS6502::Invalid<0x6b>, // 6b
+	&BasicMOS6502::Execute<&BasicMOS6502::JMP, &BasicMOS6502::Indirect>, // 6c
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::Absolute<4>>, // 6d
+	&BasicMOS6502::Execute<&BasicMOS6502::ROR, &BasicMOS6502::Absolute<6>>, // 6e
+	&BasicMOS6502::Invalid<0x6f>, // 6f
+	&BasicMOS6502::Branch<&MOS6502State::V, true>, // 70
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::IndirectY<5>>, // 71
+	&BasicMOS6502::Invalid<0x72>, // 72
+	&BasicMOS6502::Invalid<0x73>, // 73
+	&BasicMOS6502::Invalid<0x74>, // 74
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::ZeroPageX<4>>, // 75
+	&BasicMOS6502::Execute<&BasicMOS6502::ROR, &BasicMOS6502::ZeroPageX<6>>, // 76
+	&BasicMOS6502::Invalid<0x77>, // 77
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::SEI, 2>, // 78
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::AbsoluteY<4>>, // 79
+	&BasicMOS6502::Invalid<0x7a>, // 7a
+	&BasicMOS6502::Invalid<0x7b>, // 7b
+	&BasicMOS6502::Invalid<0x7c>, // 7c
+	&BasicMOS6502::Execute<&BasicMOS6502::ADC, &BasicMOS6502::AbsoluteX<4>>, // 7d
+	&BasicMOS6502::Execute<&BasicMOS6502::ROR, &BasicMOS6502::AbsoluteX<7>>, // 7e
+	&BasicMOS6502::Invalid<0x7f>, // 7f
+	&BasicMOS6502::Invalid<0x80>, // 80
+	&BasicMOS6502::Execute<&BasicMOS6502::STA, &BasicMOS6502::IndirectX>, // 81
+	&BasicMOS6502::Invalid<0x82>, // 82
+	&BasicMOS6502::Invalid<0x83>, // 83
+	&BasicMOS6502::Execute<&BasicMOS6502::STY, &BasicMOS6502::ZeroPage<3>>, // 84
+	&BasicMOS6502::Execute<&BasicMOS6502::STA, &BasicMOS6502::ZeroPage<3>>, // 85
+	&BasicMOS6502::Execute<&BasicMOS6502::STX, &BasicMOS6502::ZeroPage<3>>, // 86
+	&BasicMOS6502::Invalid<0x87>, // 87
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::DEY, 2>, // 88
+	&BasicMOS6502::Invalid<0x89>, // 89
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::TXA, 2>, // 8a
+	&BasicMOS6502::Invalid<0x8b>, // 8b
+	&BasicMOS6502::Execute<&BasicMOS6502::STY, &BasicMOS6502::Absolute<4>>, // 8c
+	&BasicMOS6502::Execute<&BasicMOS6502::STA, &BasicMOS6502::Absolute<4>>, // 8d
+	&BasicMOS6502::Execute<&BasicMOS6502::STX, &BasicMOS6502::Absolute<4>>, // 8e
+	&BasicMOS6502::Invalid<0x8f>, // 8f
+	&BasicMOS6502::Branch<&MOS6502State::C, false>, // 90
+	&BasicMOS6502::Execute<&BasicMOS6502::STA, &BasicMOS6502::IndirectY<6>>, // 91
+	&BasicMOS6502::Invalid<0x92>, // 92
+	&BasicMOS6502::Invalid<0x93>, // 93
+	&BasicMOS6502::Execute<&BasicMOS6502::STY, &BasicMOS6502::ZeroPageX<4>>, // 94
+	&BasicMOS6502::Execute<&BasicMOS6502::STA, &BasicMOS6502::ZeroPageX<4>>, // 95
+	&BasicMOS6502::Execute<&BasicMOS6502::STX, &BasicMOS6502::ZeroPageY>, // 96
+	&BasicMOS6502::Invalid<0x97>, // 97
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::TYA, 2>, // 98
+	&BasicMOS6502::Execute<&BasicMOS6502::STA, &BasicMOS6502::AbsoluteY<5>>, // 99
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::TXS, 2>, // 9a
+	&BasicMOS6502::Invalid<0x9b>, // 9b
+	&BasicMOS6502::Invalid<0x9c>, // 9c
+	&BasicMOS6502::Execute<&BasicMOS6502::STA, &BasicMOS6502::AbsoluteX<5>>, // 9d
+	&BasicMOS6502::Invalid<0x9e>, // 9e
+	&BasicMOS6502::Invalid<0x9f>, // 9f
+	&BasicMOS6502::Execute<&BasicMOS6502::LDY, &BasicMOS6502::Immediate>, // a0
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::IndirectX>, // a1
+	&BasicMOS6502::Execute<&BasicMOS6502::LDX, &BasicMOS6502::Immediate>, // a2
+	&BasicMOS6502::Invalid<0xa3>, // a3
+	&BasicMOS6502::Execute<&BasicMOS6502::LDY, &BasicMOS6502::ZeroPage<3>>, // a4
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::ZeroPage<3>>, // a5
+	&BasicMOS6502::Execute<&BasicMOS6502::LDX, &BasicMOS6502::ZeroPage<3>>, // a6
+	&BasicMOS6502::Invalid<0xa7>, // a7
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::TAY, 2>, // a8
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::Immediate>, // a9
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::TAX, 2>, // aa
+	&BasicMOS6502::Invalid<0xab>, // ab
+	&BasicMOS6502::Execute<&BasicMOS6502::LDY, &BasicMOS6502::Absolute<4>>, // ac
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::Absolute<4>>, // ad
+	&BasicMOS6502::Execute<&BasicMOS6502::LDX, &BasicMOS6502::Absolute<4>>, // ae
+	&BasicMOS6502::Invalid<0xaf>, // af
+	&BasicMOS6502::Branch<&MOS6502State::C, true>, // b0
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::IndirectY<5>>, // b1
+	&BasicMOS6502::Invalid<0xb2>, // b2
+	&BasicMOS6502::Invalid<0xb3>, // b3
+	&BasicMOS6502::Execute<&BasicMOS6502::LDY, &BasicMOS6502::ZeroPageX<4>>, // b4
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::ZeroPageX<4>>, // b5
+	&BasicMOS6502::Execute<&BasicMOS6502::LDX, &BasicMOS6502::ZeroPageY>, // b6
+	&BasicMOS6502::Invalid<0xb7>, // b7
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::CLV, 2>, // b8
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::AbsoluteY<4>>, // b9
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::TSX, 2>, // ba
+	&BasicMOS6502::Invalid<0xbb>, // bb
+	&BasicMOS6502::Execute<&BasicMOS6502::LDY, &BasicMOS6502::AbsoluteX<4>>, // bc
+	&BasicMOS6502::Execute<&BasicMOS6502::LDA, &BasicMOS6502::AbsoluteX<4>>, // bd
+	&BasicMOS6502::Execute<&BasicMOS6502::LDX, &BasicMOS6502::AbsoluteY<4>>, // be
+	&BasicMOS6502::Invalid<0xbf>, // bf
+	&BasicMOS6502::Execute<&BasicMOS6502::CPY, &BasicMOS6502::Immediate>, // c0
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::IndirectX>, // c1
+	&BasicMOS6502::Invalid<0xc2>, // c2
+	&BasicMOS6502::Invalid<0xc3>, // c3
+	&BasicMOS6502::Execute<&BasicMOS6502::CPY, &BasicMOS6502::ZeroPage<3>>, // c4
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::ZeroPage<3>>, // c5
+	&BasicMOS6502::Execute<&BasicMOS6502::DEC, &BasicMOS6502::ZeroPage<5>>, // c6
+	&BasicMOS6502::Invalid<0xc7>, // c7
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::INY, 2>, // c8
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::Immediate>, // c9
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::DEX, 2>, // ca
+	&BasicMOS6502::Invalid<0xcb>, // cb
+	&BasicMOS6502::Execute<&BasicMOS6502::CPY, &BasicMOS6502::Absolute<4>>, // cc
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::Absolute<4>>, // cd
+	&BasicMOS6502::Execute<&BasicMOS6502::DEC, &BasicMOS6502::Absolute<6>>, // ce
+	&BasicMOS6502::Invalid<0xcf>, // cf
+	&BasicMOS6502::Branch<&MOS6502State::Z, false>, // d0
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::IndirectY<5>>, // d1
+	&BasicMOS6502::Invalid<0xd2>, // d2
+	&BasicMOS6502::Invalid<0xd3>, // d3
+	&BasicMOS6502::Invalid<0xd4>, // d4
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::ZeroPageX<4>>, // d5
+	&BasicMOS6502::Execute<&BasicMOS6502::DEC, &BasicMOS6502::ZeroPageX<6>>, // d6
+	&BasicMOS6502::Invalid<0xd7>, // d7
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::CLD, 2>, // d8
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::AbsoluteY<4>>, // d9
+	&BasicMOS6502::Invalid<0xda>, // da
+	&BasicMOS6502::Invalid<0xdb>, // db
+	&BasicMOS6502::Invalid<0xdc>, // dc
+	&BasicMOS6502::Execute<&BasicMOS6502::CMP, &BasicMOS6502::AbsoluteX<4>>, // dd
+	&BasicMOS6502::Execute<&BasicMOS6502::DEC, &BasicMOS6502::AbsoluteX<7>>, // de
+	&BasicMOS6502::Invalid<0xdf>, // df
+	&BasicMOS6502::Execute<&BasicMOS6502::CPX, &BasicMOS6502::Immediate>, // e0
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::IndirectX>, // e1
+	&BasicMOS6502::Invalid<0xe2>, // e2
+	&BasicMOS6502::Invalid<0xe3>, // e3
+	&BasicMOS6502::Execute<&BasicMOS6502::CPX, &BasicMOS6502::ZeroPage<3>>, // e4
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::ZeroPage<3>>, // e5
+	&BasicMOS6502::Execute<&BasicMOS6502::INC, &BasicMOS6502::ZeroPage<5>>, // e6
+	&BasicMOS6502::Invalid<0xe7>, // e7
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::INX, 2>, // e8
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::Immediate>, // e9
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::NOP, 2>, // ea
+	&BasicMOS6502::Invalid<0xeb>, // eb
+	&BasicMOS6502::Execute<&BasicMOS6502::CPX, &BasicMOS6502::Absolute<4>>, // ec
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::Absolute<4>>, // ed
+	&BasicMOS6502::Execute<&BasicMOS6502::INC, &BasicMOS6502::Absolute<6>>, // ee
+	&BasicMOS6502::Invalid<0xef>, // ef
+	&BasicMOS6502::Branch<&MOS6502State::Z, true>, // f0
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::IndirectY<5>>, // f1
+	&BasicMOS6502::Invalid<0xf2>, // f2
+	&BasicMOS6502::Invalid<0xf3>, // f3
+	&BasicMOS6502::Invalid<0xf4>, // f4
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::ZeroPageX<4>>, // f5
+	&BasicMOS6502::Execute<&BasicMOS6502::INC, &BasicMOS6502::ZeroPageX<6>>, // f6
+	&BasicMOS6502::Invalid<0xf7>, // f7
+	&BasicMOS6502::ExecuteImplied<&BasicMOS6502::SED, 2>, // f8
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::AbsoluteY<4>>, // f9
+	&BasicMOS6502::Invalid<0xfa>, // fa
+	&BasicMOS6502::Invalid<0xfb>, // fb
+	&BasicMOS6502::Invalid<0xfc>, // fc
+	&BasicMOS6502::Execute<&BasicMOS6502::SBC, &BasicMOS6502::AbsoluteX<4>>, // fd
+	&BasicMOS6502::Execute<&BasicMOS6502::INC, &BasicMOS6502::AbsoluteX<7>>, // fe
+	&BasicMOS6502::Invalid<0xff>, // ff
+}};
 
 } // namespace DjeeDjay
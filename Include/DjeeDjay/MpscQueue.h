@@ -0,0 +1,83 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include "DjeeDjay/NonCopyable.h"
+
+namespace DjeeDjay {
+
+// A fixed size lock-free queue for any number of producer threads and one consumer thread.
+// Each slot carries a sequence number that tells whose turn it is to use it, a producer
+// claims a slot by advancing m_tail and publishes the item by advancing the sequence.
+template <typename T>
+class MpscQueue : NonCopyable
+{
+public:
+	// capacity must be a power of 2
+	explicit MpscQueue(size_t capacity) :
+		m_slots(new Slot[capacity]),
+		m_mask(capacity - 1),
+		m_head(0),
+		m_tail(0)
+	{
+		for (size_t i = 0; i < capacity; ++i)
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// Any thread, returns false when the queue is full and leaves item untouched then
+	bool Push(T&& item)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Slot& slot = m_slots[tail & m_mask];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence == tail)
+			{
+				if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				{
+					slot.item = std::move(item);
+					slot.sequence.store(tail + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (sequence < tail)
+			{
+				return false;
+			}
+			else
+			{
+				tail = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Consumer, returns false when the queue is empty
+	bool Pop(T& item)
+	{
+		Slot& slot = m_slots[m_head & m_mask];
+		if (slot.sequence.load(std::memory_order_acquire) != m_head + 1)
+			return false;
+		item = std::move(slot.item);
+		slot.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+		++m_head;
+		return true;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		T item;
+	};
+
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_mask;
+	size_t m_head;					// Used by the consumer only
+	std::atomic<size_t> m_tail;
+};
+
+} // namespace DjeeDjay
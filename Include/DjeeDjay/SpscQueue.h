@@ -0,0 +1,58 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "DjeeDjay/NonCopyable.h"
+
+namespace DjeeDjay {
+
+// A fixed size lock-free queue for one producer thread and one consumer thread
+template <typename T>
+class SpscQueue : NonCopyable
+{
+public:
+	explicit SpscQueue(size_t capacity) :
+		m_items(capacity + 1),
+		m_head(0),
+		m_tail(0)
+	{
+	}
+
+	// Producer, returns false when the queue is full
+	bool Push(T item)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		size_t next = Next(tail);
+		if (next == m_head.load(std::memory_order_acquire))
+			return false;
+		m_items[tail] = std::move(item);
+		m_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer, returns false when the queue is empty
+	bool Pop(T& item)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+		item = std::move(m_items[head]);
+		m_head.store(Next(head), std::memory_order_release);
+		return true;
+	}
+
+private:
+	size_t Next(size_t index) const
+	{
+		return index + 1 == m_items.size() ? 0 : index + 1;
+	}
+
+	std::vector<T> m_items;
+	std::atomic<size_t> m_head;		// Written by the consumer only
+	std::atomic<size_t> m_tail;		// Written by the producer only
+};
+
+} // namespace DjeeDjay
@@ -0,0 +1,125 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "DjeeDjay/NonCopyable.h"
+
+namespace DjeeDjay {
+
+enum class X64Reg : uint8_t
+{
+	Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Memory operand [base + index * scale + displacement]
+struct X64Mem
+{
+	explicit X64Mem(X64Reg base, int32_t displacement = 0);
+	X64Mem(X64Reg base, X64Reg index, int scale, int32_t displacement = 0);
+
+	X64Reg base;
+	X64Reg index;
+	bool indexed;
+	uint8_t scale;
+	int32_t displacement;
+};
+
+enum class X64Cond : uint8_t
+{
+	O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G
+};
+
+// Encodes the x86-64 instructions that the block translator emits. Operand sizes are 1, 2, 4 or 8 bytes,
+// byte registers are the low bytes of the 16 general purpose registers. All jumps are rel32, Finish()
+// resolves them, so the code is position independent and can be copied into ExecutableMemory.
+class X64Assembler
+{
+public:
+	using Label = int;
+
+	enum class Alu : uint8_t
+	{
+		Add, Or, Adc, Sbb, And, Sub, Xor, Cmp
+	};
+
+	enum class Shift : uint8_t
+	{
+		Rol, Ror, Rcl, Rcr, Shl, Shr, Sal, Sar
+	};
+
+	Label NewLabel();
+	void Bind(Label label);
+
+	void Mov(int size, X64Reg dst, X64Reg src);
+	void Mov(int size, X64Reg dst, const X64Mem& src);
+	void Mov(int size, const X64Mem& dst, X64Reg src);
+	void Mov(int size, const X64Mem& dst, int32_t value);
+	void Mov(X64Reg dst, uint64_t value);
+	void MovzxByte(X64Reg dst, X64Reg src);
+	void MovzxByte(X64Reg dst, const X64Mem& src);
+	void Lea(int size, X64Reg dst, const X64Mem& src);
+	void Op(Alu op, int size, X64Reg dst, X64Reg src);
+	void Op(Alu op, int size, X64Reg dst, const X64Mem& src);
+	void Op(Alu op, int size, X64Reg dst, int32_t value);
+	void Op(Alu op, int size, const X64Mem& dst, int32_t value);
+	void Op(Alu op, int size, const X64Mem& dst, X64Reg src);
+	void Test(int size, X64Reg reg, X64Reg other);
+	void Test(int size, X64Reg reg, int32_t value);
+	void Test(int size, const X64Mem& mem, int32_t value);
+	void Op(Shift op, int size, X64Reg reg, int count);
+	void Not(int size, X64Reg reg);
+	void Set(X64Cond cond, X64Reg dst);
+	void Jump(X64Cond cond, Label label);
+	void Jump(Label label);
+	void Call(X64Reg target);
+	void Push(X64Reg reg);
+	void Pop(X64Reg reg);
+	void Ret();
+
+	std::vector<uint8_t> Finish();
+
+private:
+	void Emit(uint8_t byte);
+	void Emit32(uint32_t value);
+	void Rex(int size, int reg, bool byteReg, int index, int base, bool byteBase);
+	void Encode(int size, uint8_t opcode, int reg, bool byteReg, X64Reg rm);
+	void Encode(int size, uint8_t opcode, int reg, bool byteReg, const X64Mem& rm);
+	void Encode2(int size, uint8_t opcode, int reg, bool byteReg, X64Reg rm, bool byteRm);
+	void Encode2(int size, uint8_t opcode, int reg, bool byteReg, const X64Mem& rm);
+	void ModRm(int reg, const X64Mem& rm);
+	void Immediate(int size, int32_t value);
+
+	struct Fixup
+	{
+		size_t offset;		// Of the rel32 field
+		Label label;
+	};
+
+	std::vector<uint8_t> m_code;
+	std::vector<ptrdiff_t> m_labels;
+	std::vector<Fixup> m_fixups;
+};
+
+// Host memory for generated code. Add() writes the code while the memory is writable and makes
+// it executable again afterwards, the memory is never writable and executable at the same time.
+class ExecutableMemory : NonCopyable
+{
+public:
+	explicit ExecutableMemory(size_t size);
+	~ExecutableMemory();
+
+	// Returns the address of the copied code, nullptr when it does not fit
+	const uint8_t* Add(const std::vector<uint8_t>& code);
+	void Clear();
+
+private:
+	uint8_t* m_data;
+	size_t m_size;
+	size_t m_used;
+};
+
+} // namespace DjeeDjay
@@ -0,0 +1,1233 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include "DjeeDjay/MOS6502.h"
+#include "DjeeDjay/X64Assembler.h"
+
+namespace DjeeDjay {
+
+namespace {
+
+enum class Operation : uint8_t
+{
+	Invalid,
+	Adc, And, Asl, Bcc, Bcs, Beq, Bit, Bmi, Bne, Bpl, Brk, Bvc, Bvs, Clc, Cld, Cli, Clv, Cmp, Cpx, Cpy,
+	Dec, Dex, Dey, Eor, Inc, Inx, Iny, Jmp, Jsr, Lda, Ldx, Ldy, Lsr, Nop, Ora, Pha, Php, Pla, Plp,
+	Rol, Ror, Rti, Rts, Sbc, Sec, Sed, Sei, Sta, Stx, Sty, Tax, Tay, Tsx, Txa, Txs, Tya
+};
+
+enum class Mode : uint8_t
+{
+	Implied,
+	Immediate,
+	ZeroPage,
+	ZeroPageX,
+	ZeroPageY,
+	Absolute,
+	AbsoluteX,
+	AbsoluteY,
+	Indirect,
+	IndirectX,
+	IndirectY,
+	Relative
+};
+
+// The instruction table of BasicMOS6502 in the terms of the translator
+struct Opcode
+{
+	Operation operation;
+	Mode mode;
+	uint8_t cycles;		// Without page crossings and taken branches
+};
+
+const std::array<Opcode, 256> opcodes =
+{{
+	{ Operation::Brk, Mode::Implied, 7 }, // 00
+	{ Operation::Ora, Mode::IndirectX, 6 }, // 01
+	{ Operation::Invalid, Mode::Implied, 0 }, // 02
+	{ Operation::Invalid, Mode::Implied, 0 }, // 03
+	{ Operation::Invalid, Mode::Implied, 0 }, // 04
+	{ Operation::Ora, Mode::ZeroPage, 3 }, // 05
+	{ Operation::Asl, Mode::ZeroPage, 5 }, // 06
+	{ Operation::Invalid, Mode::Implied, 0 }, // 07
+	{ Operation::Php, Mode::Implied, 3 }, // 08
+	{ Operation::Ora, Mode::Immediate, 2 }, // 09
+	{ Operation::Asl, Mode::Implied, 2 }, // 0a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 0b
+	{ Operation::Invalid, Mode::Implied, 0 }, // 0c
+	{ Operation::Ora, Mode::Absolute, 4 }, // 0d
+	{ Operation::Asl, Mode::Absolute, 6 }, // 0e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 0f
+	{ Operation::Bpl, Mode::Relative, 2 }, // 10
+	{ Operation::Ora, Mode::IndirectY, 5 }, // 11
+	{ Operation::Invalid, Mode::Implied, 0 }, // 12
+	{ Operation::Invalid, Mode::Implied, 0 }, // 13
+	{ Operation::Invalid, Mode::Implied, 0 }, // 14
+	{ Operation::Ora, Mode::ZeroPageX, 4 }, // 15
+	{ Operation::Asl, Mode::ZeroPageX, 6 }, // 16
+	{ Operation::Invalid, Mode::Implied, 0 }, // 17
+	{ Operation::Clc, Mode::Implied, 2 }, // 18
+	{ Operation::Ora, Mode::AbsoluteY, 4 }, // 19
+	{ Operation::Invalid, Mode::Implied, 0 }, // 1a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 1b
+	{ Operation::Invalid, Mode::Implied, 0 }, // 1c
+	{ Operation::Ora, Mode::AbsoluteX, 4 }, // 1d
+	{ Operation::Asl, Mode::AbsoluteX, 7 }, // 1e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 1f
+	{ Operation::Jsr, Mode::Absolute, 6 }, // 20
+	{ Operation::And, Mode::IndirectX, 6 }, // 21
+	{ Operation::Invalid, Mode::Implied, 0 }, // 22
+	{ Operation::Invalid, Mode::Implied, 0 }, // 23
+	{ Operation::Bit, Mode::ZeroPage, 3 }, // 24
+	{ Operation::And, Mode::ZeroPage, 3 }, // 25
+	{ Operation::Rol, Mode::ZeroPage, 5 }, // 26
+	{ Operation::Invalid, Mode::Implied, 0 }, // 27
+	{ Operation::Plp, Mode::Implied, 4 }, // 28
+	{ Operation::And, Mode::Immediate, 2 }, // 29
+	{ Operation::Rol, Mode::Implied, 2 }, // 2a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 2b
+	{ Operation::Bit, Mode::Absolute, 4 }, // 2c
+	{ Operation::And, Mode::Absolute, 4 }, // 2d
+	{ Operation::Rol, Mode::Absolute, 6 }, // 2e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 2f
+	{ Operation::Bmi, Mode::Relative, 2 }, // 30
+	{ Operation::And, Mode::IndirectY, 5 }, // 31
+	{ Operation::Invalid, Mode::Implied, 0 }, // 32
+	{ Operation::Invalid, Mode::Implied, 0 }, // 33
+	{ Operation::Invalid, Mode::Implied, 0 }, // 34
+	{ Operation::And, Mode::ZeroPageX, 4 }, // 35
+	{ Operation::Rol, Mode::ZeroPageX, 6 }, // 36
+	{ Operation::Invalid, Mode::Implied, 0 }, // 37
+	{ Operation::Sec, Mode::Implied, 2 }, // 38
+	{ Operation::And, Mode::AbsoluteY, 4 }, // 39
+	{ Operation::Invalid, Mode::Implied, 0 }, // 3a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 3b
+	{ Operation::Invalid, Mode::Implied, 0 }, // 3c
+	{ Operation::And, Mode::AbsoluteX, 4 }, // 3d
+	{ Operation::Rol, Mode::AbsoluteX, 7 }, // 3e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 3f
+	{ Operation::Rti, Mode::Implied, 6 }, // 40
+	{ Operation::Eor, Mode::IndirectX, 6 }, // 41
+	{ Operation::Invalid, Mode::Implied, 0 }, // 42
+	{ Operation::Invalid, Mode::Implied, 0 }, // 43
+	{ Operation::Invalid, Mode::Implied, 0 }, // 44
+	{ Operation::Eor, Mode::ZeroPage, 3 }, // 45
+	{ Operation::Lsr, Mode::ZeroPage, 5 }, // 46
+	{ Operation::Invalid, Mode::Implied, 0 }, // 47
+	{ Operation::Pha, Mode::Implied, 3 }, // 48
+	{ Operation::Eor, Mode::Immediate, 2 }, // 49
+	{ Operation::Lsr, Mode::Implied, 2 }, // 4a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 4b
+	{ Operation::Jmp, Mode::Absolute, 3 }, // 4c
+	{ Operation::Eor, Mode::Absolute, 4 }, // 4d
+	{ Operation::Lsr, Mode::Absolute, 6 }, // 4e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 4f
+	{ Operation::Bvc, Mode::Relative, 2 }, // 50
+	{ Operation::Eor, Mode::IndirectY, 5 }, // 51
+	{ Operation::Invalid, Mode::Implied, 0 }, // 52
+	{ Operation::Invalid, Mode::Implied, 0 }, // 53
+	{ Operation::Invalid, Mode::Implied, 0 }, // 54
+	{ Operation::Eor, Mode::ZeroPageX, 4 }, // 55
+	{ Operation::Lsr, Mode::ZeroPageX, 6 }, // 56
+	{ Operation::Invalid, Mode::Implied, 0 }, // 57
+	{ Operation::Cli, Mode::Implied, 2 }, // 58
+	{ Operation::Eor, Mode::AbsoluteY, 4 }, // 59
+	{ Operation::Invalid, Mode::Implied, 0 }, // 5a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 5b
+	{ Operation::Invalid, Mode::Implied, 0 }, // 5c
+	{ Operation::Eor, Mode::AbsoluteX, 4 }, // 5d
+	{ Operation::Lsr, Mode::AbsoluteX, 7 }, // 5e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 5f
+	{ Operation::Rts, Mode::Implied, 6 }, // 60
+	{ Operation::Adc, Mode::IndirectX, 6 }, // 61
+	{ Operation::Invalid, Mode::Implied, 0 }, // 62
+	{ Operation::Invalid, Mode::Implied, 0 }, // 63
+	{ Operation::Invalid, Mode::Implied, 0 }, // 64
+	{ Operation::Adc, Mode::ZeroPage, 3 }, // 65
+	{ Operation::Ror, Mode::ZeroPage, 5 }, // 66
+	{ Operation::Invalid, Mode::Implied, 0 }, // 67
+	{ Operation::Pla, Mode::Implied, 4 }, // 68
+	{ Operation::Adc, Mode::Immediate, 2 }, // 69
+	{ Operation::Ror, Mode::Implied, 2 }, // 6a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 6b
+	{ Operation::Jmp, Mode::Indirect, 5 }, // 6c
+	{ Operation::Adc, Mode::Absolute, 4 }, // 6d
+	{ Operation::Ror, Mode::Absolute, 6 }, // 6e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 6f
+	{ Operation::Bvs, Mode::Relative, 2 }, // 70
+	{ Operation::Adc, Mode::IndirectY, 5 }, // 71
+	{ Operation::Invalid, Mode::Implied, 0 }, // 72
+	{ Operation::Invalid, Mode::Implied, 0 }, // 73
+	{ Operation::Invalid, Mode::Implied, 0 }, // 74
+	{ Operation::Adc, Mode::ZeroPageX, 4 }, // 75
+	{ Operation::Ror, Mode::ZeroPageX, 6 }, // 76
+	{ Operation::Invalid, Mode::Implied, 0 }, // 77
+	{ Operation::Sei, Mode::Implied, 2 }, // 78
+	{ Operation::Adc, Mode::AbsoluteY, 4 }, // 79
+	{ Operation::Invalid, Mode::Implied, 0 }, // 7a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 7b
+	{ Operation::Invalid, Mode::Implied, 0 }, // 7c
+	{ Operation::Adc, Mode::AbsoluteX, 4 }, // 7d
+	{ Operation::Ror, Mode::AbsoluteX, 7 }, // 7e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 7f
+	{ Operation::Invalid, Mode::Implied, 0 }, // 80
+	{ Operation::Sta, Mode::IndirectX, 6 }, // 81
+	{ Operation::Invalid, Mode::Implied, 0 }, // 82
+	{ Operation::Invalid, Mode::Implied, 0 }, // 83
+	{ Operation::Sty, Mode::ZeroPage, 3 }, // 84
+	{ Operation::Sta, Mode::ZeroPage, 3 }, // 85
+	{ Operation::Stx, Mode::ZeroPage, 3 }, // 86
+	{ Operation::Invalid, Mode::Implied, 0 }, // 87
+	{ Operation::Dey, Mode::Implied, 2 }, // 88
+	{ Operation::Invalid, Mode::Implied, 0 }, // 89
+	{ Operation::Txa, Mode::Implied, 2 }, // 8a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 8b
+	{ Operation::Sty, Mode::Absolute, 4 }, // 8c
+	{ Operation::Sta, Mode::Absolute, 4 }, // 8d
+	{ Operation::Stx, Mode::Absolute, 4 }, // 8e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 8f
+	{ Operation::Bcc, Mode::Relative, 2 }, // 90
+	{ Operation::Sta, Mode::IndirectY, 6 }, // 91
+	{ Operation::Invalid, Mode::Implied, 0 }, // 92
+	{ Operation::Invalid, Mode::Implied, 0 }, // 93
+	{ Operation::Sty, Mode::ZeroPageX, 4 }, // 94
+	{ Operation::Sta, Mode::ZeroPageX, 4 }, // 95
+	{ Operation::Stx, Mode::ZeroPageY, 4 }, // 96
+	{ Operation::Invalid, Mode::Implied, 0 }, // 97
+	{ Operation::Tya, Mode::Implied, 2 }, // 98
+	{ Operation::Sta, Mode::AbsoluteY, 5 }, // 99
+	{ Operation::Txs, Mode::Implied, 2 }, // 9a
+	{ Operation::Invalid, Mode::Implied, 0 }, // 9b
+	{ Operation::Invalid, Mode::Implied, 0 }, // 9c
+	{ Operation::Sta, Mode::AbsoluteX, 5 }, // 9d
+	{ Operation::Invalid, Mode::Implied, 0 }, // 9e
+	{ Operation::Invalid, Mode::Implied, 0 }, // 9f
+	{ Operation::Ldy, Mode::Immediate, 2 }, // a0
+	{ Operation::Lda, Mode::IndirectX, 6 }, // a1
+	{ Operation::Ldx, Mode::Immediate, 2 }, // a2
+	{ Operation::Invalid, Mode::Implied, 0 }, // a3
+	{ Operation::Ldy, Mode::ZeroPage, 3 }, // a4
+	{ Operation::Lda, Mode::ZeroPage, 3 }, // a5
+	{ Operation::Ldx, Mode::ZeroPage, 3 }, // a6
+	{ Operation::Invalid, Mode::Implied, 0 }, // a7
+	{ Operation::Tay, Mode::Implied, 2 }, // a8
+	{ Operation::Lda, Mode::Immediate, 2 }, // a9
+	{ Operation::Tax, Mode::Implied, 2 }, // aa
+	{ Operation::Invalid, Mode::Implied, 0 }, // ab
+	{ Operation::Ldy, Mode::Absolute, 4 }, // ac
+	{ Operation::Lda, Mode::Absolute, 4 }, // ad
+	{ Operation::Ldx, Mode::Absolute, 4 }, // ae
+	{ Operation::Invalid, Mode::Implied, 0 }, // af
+	{ Operation::Bcs, Mode::Relative, 2 }, // b0
+	{ Operation::Lda, Mode::IndirectY, 5 }, // b1
+	{ Operation::Invalid, Mode::Implied, 0 }, // b2
+	{ Operation::Invalid, Mode::Implied, 0 }, // b3
+	{ Operation::Ldy, Mode::ZeroPageX, 4 }, // b4
+	{ Operation::Lda, Mode::ZeroPageX, 4 }, // b5
+	{ Operation::Ldx, Mode::ZeroPageY, 4 }, // b6
+	{ Operation::Invalid, Mode::Implied, 0 }, // b7
+	{ Operation::Clv, Mode::Implied, 2 }, // b8
+	{ Operation::Lda, Mode::AbsoluteY, 4 }, // b9
+	{ Operation::Tsx, Mode::Implied, 2 }, // ba
+	{ Operation::Invalid, Mode::Implied, 0 }, // bb
+	{ Operation::Ldy, Mode::AbsoluteX, 4 }, // bc
+	{ Operation::Lda, Mode::AbsoluteX, 4 }, // bd
+	{ Operation::Ldx, Mode::AbsoluteY, 4 }, // be
+	{ Operation::Invalid, Mode::Implied, 0 }, // bf
+	{ Operation::Cpy, Mode::Immediate, 2 }, // c0
+	{ Operation::Cmp, Mode::IndirectX, 6 }, // c1
+	{ Operation::Invalid, Mode::Implied, 0 }, // c2
+	{ Operation::Invalid, Mode::Implied, 0 }, // c3
+	{ Operation::Cpy, Mode::ZeroPage, 3 }, // c4
+	{ Operation::Cmp, Mode::ZeroPage, 3 }, // c5
+	{ Operation::Dec, Mode::ZeroPage, 5 }, // c6
+	{ Operation::Invalid, Mode::Implied, 0 }, // c7
+	{ Operation::Iny, Mode::Implied, 2 }, // c8
+	{ Operation::Cmp, Mode::Immediate, 2 }, // c9
+	{ Operation::Dex, Mode::Implied, 2 }, // ca
+	{ Operation::Invalid, Mode::Implied, 0 }, // cb
+	{ Operation::Cpy, Mode::Absolute, 4 }, // cc
+	{ Operation::Cmp, Mode::Absolute, 4 }, // cd
+	{ Operation::Dec, Mode::Absolute, 6 }, // ce
+	{ Operation::Invalid, Mode::Implied, 0 }, // cf
+	{ Operation::Bne, Mode::Relative, 2 }, // d0
+	{ Operation::Cmp, Mode::IndirectY, 5 }, // d1
+	{ Operation::Invalid, Mode::Implied, 0 }, // d2
+	{ Operation::Invalid, Mode::Implied, 0 }, // d3
+	{ Operation::Invalid, Mode::Implied, 0 }, // d4
+	{ Operation::Cmp, Mode::ZeroPageX, 4 }, // d5
+	{ Operation::Dec, Mode::ZeroPageX, 6 }, // d6
+	{ Operation::Invalid, Mode::Implied, 0 }, // d7
+	{ Operation::Cld, Mode::Implied, 2 }, // d8
+	{ Operation::Cmp, Mode::AbsoluteY, 4 }, // d9
+	{ Operation::Invalid, Mode::Implied, 0 }, // da
+	{ Operation::Invalid, Mode::Implied, 0 }, // db
+	{ Operation::Invalid, Mode::Implied, 0 }, // dc
+	{ Operation::Cmp, Mode::AbsoluteX, 4 }, // dd
+	{ Operation::Dec, Mode::AbsoluteX, 7 }, // de
+	{ Operation::Invalid, Mode::Implied, 0 }, // df
+	{ Operation::Cpx, Mode::Immediate, 2 }, // e0
+	{ Operation::Sbc, Mode::IndirectX, 6 }, // e1
+	{ Operation::Invalid, Mode::Implied, 0 }, // e2
+	{ Operation::Invalid, Mode::Implied, 0 }, // e3
+	{ Operation::Cpx, Mode::ZeroPage, 3 }, // e4
+	{ Operation::Sbc, Mode::ZeroPage, 3 }, // e5
+	{ Operation::Inc, Mode::ZeroPage, 5 }, // e6
+	{ Operation::Invalid, Mode::Implied, 0 }, // e7
+	{ Operation::Inx, Mode::Implied, 2 }, // e8
+	{ Operation::Sbc, Mode::Immediate, 2 }, // e9
+	{ Operation::Nop, Mode::Implied, 2 }, // ea
+	{ Operation::Invalid, Mode::Implied, 0 }, // eb
+	{ Operation::Cpx, Mode::Absolute, 4 }, // ec
+	{ Operation::Sbc, Mode::Absolute, 4 }, // ed
+	{ Operation::Inc, Mode::Absolute, 6 }, // ee
+	{ Operation::Invalid, Mode::Implied, 0 }, // ef
+	{ Operation::Beq, Mode::Relative, 2 }, // f0
+	{ Operation::Sbc, Mode::IndirectY, 5 }, // f1
+	{ Operation::Invalid, Mode::Implied, 0 }, // f2
+	{ Operation::Invalid, Mode::Implied, 0 }, // f3
+	{ Operation::Invalid, Mode::Implied, 0 }, // f4
+	{ Operation::Sbc, Mode::ZeroPageX, 4 }, // f5
+	{ Operation::Inc, Mode::ZeroPageX, 6 }, // f6
+	{ Operation::Invalid, Mode::Implied, 0 }, // f7
+	{ Operation::Sed, Mode::Implied, 2 }, // f8
+	{ Operation::Sbc, Mode::AbsoluteY, 4 }, // f9
+	{ Operation::Invalid, Mode::Implied, 0 }, // fa
+	{ Operation::Invalid, Mode::Implied, 0 }, // fb
+	{ Operation::Invalid, Mode::Implied, 0 }, // fc
+	{ Operation::Sbc, Mode::AbsoluteX, 4 }, // fd
+	{ Operation::Inc, Mode::AbsoluteX, 7 }, // fe
+	{ Operation::Invalid, Mode::Implied, 0 }, // ff
+}};
+
+using Reg = X64Reg;
+using Cond = X64Cond;
+using Alu = X64Assembler::Alu;
+using Shift = X64Assembler::Shift;
+using Label = X64Assembler::Label;
+
+// While a block runs RBX points to the CPU state, the 6502 registers and the cycle count stay in
+// callee saved registers and EBP collects the requests to leave the block
+const Reg State = Reg::Rbx;
+const Reg Leave = Reg::Rbp;
+const Reg A = Reg::R12;
+const Reg X = Reg::R13;
+const Reg Y = Reg::R14;
+const Reg Cycle = Reg::R15;
+// Computed addresses are passed in EDX, values written in R8D
+const Reg Address = Reg::Rdx;
+const Reg Value = Reg::R8;
+
+#if defined(_WIN32)
+const Reg Arguments[] = { Reg::Rcx, Reg::Rdx, Reg::R8 };
+#else
+const Reg Arguments[] = { Reg::Rdi, Reg::Rsi, Reg::Rdx };
+#endif // _WIN32
+
+// The frame holds the Win64 home area of the called functions and three slots.
+// With the six saved registers RSP stays 16 byte aligned at calls.
+const int32_t CycleLimitSlot = 32;
+const int32_t AddressSlot = 40;
+const int32_t ValueSlot = 48;
+const int32_t FrameSize = 56;
+
+// Room for the code of several thousand blocks
+const size_t NativeCodeSize = 8 << 20;
+
+// Where native code finds the CPU state and the functions it calls
+struct StateLayout
+{
+	int32_t pending;
+	int32_t cycle;
+	int32_t pc;
+	int32_t a;
+	int32_t x;
+	int32_t y;
+	int32_t s;
+	int32_t p;
+	int32_t nResult;
+	int32_t zResult;
+	int32_t code;
+	int32_t ram;
+	int32_t read;
+	int32_t codeEmpty;			// Offset of DecodedPage::empty
+	int32_t pendingResetNmi;
+	int32_t directWriteEnd;
+	uint64_t readFunction;
+	uint64_t writeFunction;
+	uint64_t invalidateFunction;
+};
+
+struct Operand
+{
+	enum Kind
+	{
+		Immediate,
+		Fixed,		// Address in value
+		Dynamic		// Address in EDX
+	};
+
+	Kind kind;
+	uint16_t value;
+};
+
+void NativeInvalidate(MOS6502State* cpu, uint32_t address)
+{
+	cpu->InvalidateCode(static_cast<uint16_t>(address));
+}
+
+int MaxCycles(const TranslatedInstruction& instruction)
+{
+	const Opcode& opcode = opcodes[instruction.opcode];
+	switch (opcode.mode)
+	{
+	case Mode::AbsoluteX:
+	case Mode::AbsoluteY:
+		return opcode.cycles == 4 ? 5 : opcode.cycles;
+	case Mode::IndirectY:
+		return opcode.cycles == 5 ? 6 : opcode.cycles;
+	case Mode::Relative:
+		return opcode.cycles + 2;
+	default:
+		return opcode.cycles;
+	}
+}
+
+// Generates the native code of one block with the cycle counts and memory accesses of the interpreter.
+// Memory that the CPU maps directly is accessed in line, the bus is called out of line.
+class BlockCompiler
+{
+public:
+	BlockCompiler(const StateLayout& layout, bool loops);
+
+	std::vector<uint8_t> Compile(const std::vector<TranslatedInstruction>& instructions, uint16_t address);
+
+private:
+	bool Instruction(const TranslatedInstruction& instruction, uint16_t address, uint16_t next);
+	void Prologue();
+	void Epilogue();
+	X64Mem Field(int32_t offset) const;
+	X64Mem Slot(int32_t offset) const;
+	void Cycles(int count);
+	Operand Effective(Mode mode, int cycles, uint16_t operand);
+	void Read(const Operand& operand);
+	void ReadAddress(uint16_t low, uint16_t high);
+	void Write(const Operand& operand, Reg value);
+	void CallRead(const Operand& operand);
+	void CallWrite(const Operand& operand, Reg value);
+	void Call(uint64_t function, int arguments);
+	void Push(Reg value);
+	void Pull();
+	void PullAddress();
+	void NZ(Reg reg);
+	void CarryIn();
+	void CarryOut();
+	void GetP(Reg reg);
+	void SetP(Reg reg);
+	void AddWithCarry();
+	void Compare(Reg reg);
+	void ShiftOp(Operation operation, Reg reg);
+	void CheckInterrupt(uint16_t next);
+	void Branch(Cond taken, uint16_t next, uint16_t target);
+	void Transfer(uint16_t target);
+	void ExitDynamic();
+	Label ExitLabel(uint16_t pc);
+	void Cold(std::function<void ()> code);
+
+	StateLayout m_layout;
+	bool m_loops;
+	X64Assembler m_asm;
+	std::map<uint16_t, Label> m_instructions;
+	std::map<uint16_t, Label> m_exits;
+	std::vector<std::function<void ()>> m_cold;
+	Label m_epilogue;
+	bool m_calls;		// The current instruction may call the bus
+};
+
+BlockCompiler::BlockCompiler(const StateLayout& layout, bool loops) :
+	m_layout(layout),
+	m_loops(loops),
+	m_epilogue(m_asm.NewLabel()),
+	m_calls(false)
+{
+}
+
+// The calls to the bus and the exits follow the instructions, so the common path runs straight through
+std::vector<uint8_t> BlockCompiler::Compile(const std::vector<TranslatedInstruction>& instructions, uint16_t address)
+{
+	uint16_t pc = address;
+	for (const TranslatedInstruction& instruction : instructions)
+	{
+		m_instructions[pc] = m_asm.NewLabel();
+		pc += instruction.length;
+	}
+
+	Prologue();
+	pc = address;
+	bool transfer = false;
+	for (const TranslatedInstruction& instruction : instructions)
+	{
+		auto next = static_cast<uint16_t>(pc + instruction.length);
+		m_asm.Bind(m_instructions[pc]);
+		m_calls = false;
+		transfer = Instruction(instruction, pc, next);
+		if (!transfer && m_calls)
+		{
+			m_asm.Test(4, Leave, Leave);
+			m_asm.Jump(Cond::NE, ExitLabel(next));
+		}
+		pc = next;
+	}
+	if (!transfer)
+		m_asm.Jump(ExitLabel(pc));
+
+	for (size_t i = 0; i < m_cold.size(); ++i)
+		m_cold[i]();
+	for (auto& exit : m_exits)
+	{
+		m_asm.Bind(exit.second);
+		m_asm.Mov(2, Field(m_layout.pc), exit.first);
+		m_asm.Jump(m_epilogue);
+	}
+	Epilogue();
+	return m_asm.Finish();
+}
+
+// Returns true when the instruction transfers control
+bool BlockCompiler::Instruction(const TranslatedInstruction& instruction, uint16_t address, uint16_t next)
+{
+	const Opcode& opcode = opcodes[instruction.opcode];
+	uint16_t operand = instruction.operand;
+	switch (opcode.operation)
+	{
+	case Operation::Adc:
+	case Operation::Sbc:
+		Read(Effective(opcode.mode, opcode.cycles, operand));
+		if (opcode.operation == Operation::Sbc)
+			m_asm.Not(4, Reg::Rax);
+		AddWithCarry();
+		return false;
+	case Operation::And:
+	case Operation::Ora:
+	case Operation::Eor:
+		Read(Effective(opcode.mode, opcode.cycles, operand));
+		m_asm.Op(opcode.operation == Operation::And ? Alu::And : opcode.operation == Operation::Ora ? Alu::Or : Alu::Xor, 1, A, Reg::Rax);
+		NZ(A);
+		return false;
+	case Operation::Bit:
+		Read(Effective(opcode.mode, opcode.cycles, operand));
+		m_asm.Mov(1, Field(m_layout.nResult), Reg::Rax);
+		m_asm.Mov(4, Reg::Rcx, Reg::Rax);
+		m_asm.Op(Alu::And, 4, Reg::Rcx, A);
+		m_asm.Mov(1, Field(m_layout.zResult), Reg::Rcx);
+		m_asm.Op(Alu::And, 4, Reg::Rax, 0x40);
+		m_asm.Op(Alu::And, 1, Field(m_layout.p), 0xbf);
+		m_asm.Op(Alu::Or, 1, Field(m_layout.p), Reg::Rax);
+		return false;
+	case Operation::Cmp:
+	case Operation::Cpx:
+	case Operation::Cpy:
+		Read(Effective(opcode.mode, opcode.cycles, operand));
+		Compare(opcode.operation == Operation::Cmp ? A : opcode.operation == Operation::Cpx ? X : Y);
+		return false;
+	case Operation::Lda:
+	case Operation::Ldx:
+	case Operation::Ldy:
+	{
+		Reg reg = opcode.operation == Operation::Lda ? A : opcode.operation == Operation::Ldx ? X : Y;
+		Read(Effective(opcode.mode, opcode.cycles, operand));
+		m_asm.Mov(4, reg, Reg::Rax);
+		NZ(reg);
+		return false;
+	}
+	case Operation::Sta:
+	case Operation::Stx:
+	case Operation::Sty:
+		Write(Effective(opcode.mode, opcode.cycles, operand), opcode.operation == Operation::Sta ? A : opcode.operation == Operation::Stx ? X : Y);
+		return false;
+	case Operation::Asl:
+	case Operation::Lsr:
+	case Operation::Rol:
+	case Operation::Ror:
+	{
+		if (opcode.mode == Mode::Implied)
+		{
+			Cycles(opcode.cycles);
+			ShiftOp(opcode.operation, A);
+			return false;
+		}
+		Operand target = Effective(opcode.mode, opcode.cycles, operand);
+		Read(target);
+		m_asm.Mov(4, Value, Reg::Rax);
+		ShiftOp(opcode.operation, Value);
+		Write(target, Value);
+		return false;
+	}
+	case Operation::Inc:
+	case Operation::Dec:
+	{
+		Operand target = Effective(opcode.mode, opcode.cycles, operand);
+		Read(target);
+		m_asm.Mov(4, Value, Reg::Rax);
+		m_asm.Op(opcode.operation == Operation::Inc ? Alu::Add : Alu::Sub, 1, Value, 1);
+		NZ(Value);
+		Write(target, Value);
+		return false;
+	}
+	case Operation::Inx:
+	case Operation::Dex:
+	case Operation::Iny:
+	case Operation::Dey:
+	{
+		Reg reg = opcode.operation == Operation::Inx || opcode.operation == Operation::Dex ? X : Y;
+		Cycles(opcode.cycles);
+		m_asm.Op(opcode.operation == Operation::Inx || opcode.operation == Operation::Iny ? Alu::Add : Alu::Sub, 1, reg, 1);
+		NZ(reg);
+		return false;
+	}
+	case Operation::Tax:
+	case Operation::Tay:
+	case Operation::Txa:
+	case Operation::Tya:
+	{
+		Reg from = opcode.operation == Operation::Txa ? X : opcode.operation == Operation::Tya ? Y : A;
+		Reg to = opcode.operation == Operation::Tax ? X : opcode.operation == Operation::Tay ? Y : A;
+		Cycles(opcode.cycles);
+		m_asm.Mov(4, to, from);
+		NZ(to);
+		return false;
+	}
+	case Operation::Tsx:
+		Cycles(opcode.cycles);
+		m_asm.MovzxByte(X, Field(m_layout.s));
+		NZ(X);
+		return false;
+	case Operation::Txs:
+		Cycles(opcode.cycles);
+		m_asm.Mov(1, Field(m_layout.s), X);
+		return false;
+	case Operation::Clc:
+	case Operation::Cld:
+	case Operation::Cli:
+	case Operation::Clv:
+		Cycles(opcode.cycles);
+		m_asm.Op(Alu::And, 1, Field(m_layout.p), opcode.operation == Operation::Clc ? 0xfe :
+			opcode.operation == Operation::Cld ? 0xf7 : opcode.operation == Operation::Cli ? 0xfb : 0xbf);
+		if (opcode.operation == Operation::Cli)
+			CheckInterrupt(next);
+		return false;
+	case Operation::Sec:
+	case Operation::Sed:
+	case Operation::Sei:
+		Cycles(opcode.cycles);
+		m_asm.Op(Alu::Or, 1, Field(m_layout.p), opcode.operation == Operation::Sec ? 0x01 : opcode.operation == Operation::Sed ? 0x08 : 0x04);
+		return false;
+	case Operation::Nop:
+		Cycles(opcode.cycles);
+		return false;
+	case Operation::Pha:
+		Cycles(opcode.cycles);
+		Push(A);
+		return false;
+	case Operation::Php:
+		Cycles(opcode.cycles);
+		GetP(Value);
+		m_asm.Op(Alu::Or, 4, Value, 0x30);
+		Push(Value);
+		return false;
+	case Operation::Pla:
+		Cycles(opcode.cycles);
+		Pull();
+		m_asm.Mov(4, A, Reg::Rax);
+		NZ(A);
+		return false;
+	case Operation::Plp:
+		Cycles(opcode.cycles);
+		Pull();
+		m_asm.Op(Alu::And, 4, Reg::Rax, 0xcf);
+		SetP(Reg::Rax);
+		CheckInterrupt(next);
+		return false;
+	case Operation::Jsr:
+	{
+		auto ret = static_cast<uint16_t>(next - 1);
+		Cycles(opcode.cycles);
+		m_asm.Mov(Value, ret >> 8);
+		Push(Value);
+		m_asm.Mov(Value, ret & 0xff);
+		Push(Value);
+		Transfer(operand);
+		return true;
+	}
+	case Operation::Jmp:
+		Cycles(opcode.cycles);
+		if (opcode.mode == Mode::Absolute)
+		{
+			Transfer(operand);
+			return true;
+		}
+		// The high byte address is formed as the interpreter does
+		ReadAddress(operand, static_cast<uint16_t>((operand & 0xff00) | ((operand & 0xff) + 1)));
+		ExitDynamic();
+		return true;
+	case Operation::Rts:
+		Cycles(opcode.cycles);
+		PullAddress();
+		m_asm.Op(Alu::Add, 4, Address, 1);
+		m_asm.Op(Alu::And, 4, Address, 0xffff);
+		ExitDynamic();
+		return true;
+	case Operation::Rti:
+		Cycles(opcode.cycles);
+		Pull();
+		m_asm.Op(Alu::And, 4, Reg::Rax, 0xcf);
+		SetP(Reg::Rax);
+		PullAddress();
+		ExitDynamic();
+		return true;
+	case Operation::Brk:
+	{
+		auto ret = static_cast<uint16_t>(address + 2);
+		Cycles(opcode.cycles);
+		m_asm.Mov(Value, ret >> 8);
+		Push(Value);
+		m_asm.Mov(Value, ret & 0xff);
+		Push(Value);
+		GetP(Value);
+		m_asm.Op(Alu::Or, 4, Value, 0x30);
+		Push(Value);
+		m_asm.Op(Alu::Or, 1, Field(m_layout.p), 0x04);
+		ReadAddress(0xfffe, 0xffff);
+		ExitDynamic();
+		return true;
+	}
+	case Operation::Bpl:
+	case Operation::Bmi:
+		m_asm.Test(1, Field(m_layout.nResult), 0x80);
+		Branch(opcode.operation == Operation::Bmi ? Cond::NE : Cond::E, next, static_cast<uint16_t>(next + static_cast<int8_t>(operand)));
+		return true;
+	case Operation::Bvc:
+	case Operation::Bvs:
+		m_asm.Test(1, Field(m_layout.p), 0x40);
+		Branch(opcode.operation == Operation::Bvs ? Cond::NE : Cond::E, next, static_cast<uint16_t>(next + static_cast<int8_t>(operand)));
+		return true;
+	case Operation::Bcc:
+	case Operation::Bcs:
+		m_asm.Test(1, Field(m_layout.p), 0x01);
+		Branch(opcode.operation == Operation::Bcs ? Cond::NE : Cond::E, next, static_cast<uint16_t>(next + static_cast<int8_t>(operand)));
+		return true;
+	case Operation::Bne:
+	case Operation::Beq:
+		m_asm.Op(Alu::Cmp, 1, Field(m_layout.zResult), 0);
+		Branch(opcode.operation == Operation::Beq ? Cond::E : Cond::NE, next, static_cast<uint16_t>(next + static_cast<int8_t>(operand)));
+		return true;
+	default:
+		// Left to the interpreter
+		m_asm.Jump(ExitLabel(address));
+		return true;
+	}
+}
+
+void BlockCompiler::Prologue()
+{
+	for (Reg reg : { State, Leave, A, X, Y, Cycle })
+		m_asm.Push(reg);
+	m_asm.Op(Alu::Sub, 8, Reg::Rsp, FrameSize);
+	m_asm.Mov(8, State, Arguments[0]);
+	m_asm.Mov(8, Slot(CycleLimitSlot), Arguments[1]);
+	m_asm.MovzxByte(A, Field(m_layout.a));
+	m_asm.MovzxByte(X, Field(m_layout.x));
+	m_asm.MovzxByte(Y, Field(m_layout.y));
+	m_asm.Mov(8, Cycle, Field(m_layout.cycle));
+	m_asm.Op(Alu::Xor, 4, Leave, Leave);
+}
+
+void BlockCompiler::Epilogue()
+{
+	m_asm.Bind(m_epilogue);
+	m_asm.Mov(1, Field(m_layout.a), A);
+	m_asm.Mov(1, Field(m_layout.x), X);
+	m_asm.Mov(1, Field(m_layout.y), Y);
+	m_asm.Mov(8, Field(m_layout.cycle), Cycle);
+	m_asm.Op(Alu::Add, 8, Reg::Rsp, FrameSize);
+	for (Reg reg : { Cycle, Y, X, A, Leave, State })
+		m_asm.Pop(reg);
+	m_asm.Ret();
+}
+
+X64Mem BlockCompiler::Field(int32_t offset) const
+{
+	return X64Mem(State, offset);
+}
+
+X64Mem BlockCompiler::Slot(int32_t offset) const
+{
+	return X64Mem(Reg::Rsp, offset);
+}
+
+void BlockCompiler::Cycles(int count)
+{
+	if (count != 0)
+		m_asm.Op(Alu::Add, 8, Cycle, count);
+}
+
+// Adds the cycles of the addressing mode where the interpreter does
+Operand BlockCompiler::Effective(Mode mode, int cycles, uint16_t operand)
+{
+	switch (mode)
+	{
+	case Mode::Immediate:
+		Cycles(cycles);
+		return { Operand::Immediate, static_cast<uint16_t>(operand & 0xff) };
+	case Mode::ZeroPage:
+	case Mode::Absolute:
+		Cycles(cycles);
+		return { Operand::Fixed, operand };
+	case Mode::ZeroPageX:
+	case Mode::ZeroPageY:
+		Cycles(cycles);
+		m_asm.Lea(4, Address, X64Mem(mode == Mode::ZeroPageX ? X : Y, operand));
+		m_asm.MovzxByte(Address, Address);
+		return { Operand::Dynamic, 0 };
+	case Mode::AbsoluteX:
+	case Mode::AbsoluteY:
+	{
+		Reg index = mode == Mode::AbsoluteX ? X : Y;
+		Cycles(cycles);
+		// Only the 4 cycle read instructions take an extra cycle on a page crossing
+		if (cycles == 4)
+		{
+			m_asm.Lea(4, Reg::Rax, X64Mem(index, operand & 0xff));
+			m_asm.Op(Shift::Shr, 4, Reg::Rax, 8);
+			m_asm.Op(Alu::Add, 8, Cycle, Reg::Rax);
+		}
+		m_asm.Lea(4, Address, X64Mem(index, operand));
+		m_asm.Op(Alu::And, 4, Address, 0xffff);
+		return { Operand::Dynamic, 0 };
+	}
+	case Mode::IndirectX:
+		Cycles(cycles);
+		m_asm.Lea(4, Address, X64Mem(X, operand));
+		m_asm.MovzxByte(Address, Address);
+		Read({ Operand::Dynamic, 0 });
+		m_asm.Mov(4, Slot(ValueSlot), Reg::Rax);
+		m_asm.Op(Alu::Add, 4, Address, 1);
+		Read({ Operand::Dynamic, 0 });
+		m_asm.Op(Shift::Shl, 4, Reg::Rax, 8);
+		m_asm.Op(Alu::Or, 4, Reg::Rax, Slot(ValueSlot));
+		m_asm.Mov(4, Address, Reg::Rax);
+		return { Operand::Dynamic, 0 };
+	case Mode::IndirectY:
+		// The pointer is read before the cycles are added
+		Read({ Operand::Fixed, operand });
+		m_asm.Mov(4, Slot(ValueSlot), Reg::Rax);
+		Read({ Operand::Fixed, static_cast<uint16_t>(operand + 1) });
+		m_asm.Mov(4, Reg::Rcx, Slot(ValueSlot));
+		m_asm.Op(Alu::Add, 4, Reg::Rcx, Y);
+		if (cycles == 5)
+		{
+			m_asm.Mov(4, Address, Reg::Rcx);
+			m_asm.Op(Shift::Shr, 4, Address, 8);
+			m_asm.Op(Alu::Add, 8, Cycle, Address);
+		}
+		Cycles(cycles);
+		m_asm.Op(Shift::Shl, 4, Reg::Rax, 8);
+		m_asm.Lea(4, Address, X64Mem(Reg::Rax, Reg::Rcx, 1));
+		m_asm.Op(Alu::And, 4, Address, 0xffff);
+		return { Operand::Dynamic, 0 };
+	default:
+		Cycles(cycles);
+		return { Operand::Immediate, 0 };
+	}
+}
+
+// Leaves the value in EAX and keeps EDX
+void BlockCompiler::Read(const Operand& operand)
+{
+	if (operand.kind == Operand::Immediate)
+	{
+		m_asm.Mov(Reg::Rax, operand.value);
+		return;
+	}
+
+	Label slow = m_asm.NewLabel();
+	Label done = m_asm.NewLabel();
+	if (operand.kind == Operand::Fixed)
+	{
+		m_asm.Mov(8, Reg::Rax, Field(m_layout.read + 8 * (operand.value >> 8)));
+		m_asm.Test(8, Reg::Rax, Reg::Rax);
+		m_asm.Jump(Cond::E, slow);
+		m_asm.MovzxByte(Reg::Rax, X64Mem(Reg::Rax, operand.value & 0xff));
+	}
+	else
+	{
+		m_asm.Mov(4, Reg::Rax, Address);
+		m_asm.Op(Shift::Shr, 4, Reg::Rax, 8);
+		m_asm.Mov(8, Reg::Rax, X64Mem(State, Reg::Rax, 8, m_layout.read));
+		m_asm.Test(8, Reg::Rax, Reg::Rax);
+		m_asm.Jump(Cond::E, slow);
+		m_asm.MovzxByte(Reg::Rcx, Address);
+		m_asm.MovzxByte(Reg::Rax, X64Mem(Reg::Rax, Reg::Rcx, 1));
+	}
+	m_asm.Bind(done);
+	Cold([this, operand, slow, done]()
+	{
+		m_asm.Bind(slow);
+		CallRead(operand);
+		m_asm.Jump(done);
+	});
+	m_calls = true;
+}
+
+// Reads a little endian address into EDX
+void BlockCompiler::ReadAddress(uint16_t low, uint16_t high)
+{
+	Read({ Operand::Fixed, low });
+	m_asm.Mov(4, Slot(ValueSlot), Reg::Rax);
+	Read({ Operand::Fixed, high });
+	m_asm.Op(Shift::Shl, 4, Reg::Rax, 8);
+	m_asm.Op(Alu::Or, 4, Reg::Rax, Slot(ValueSlot));
+	m_asm.Mov(4, Address, Reg::Rax);
+}
+
+// Stores to direct RAM in line and invalidates decoded code when the page has any.
+// The value register must not be EAX, ECX or EDX.
+void BlockCompiler::Write(const Operand& operand, Reg value)
+{
+	m_calls = true;
+	if (operand.kind == Operand::Fixed && operand.value >= m_layout.directWriteEnd)
+	{
+		CallWrite(operand, value);
+		return;
+	}
+
+	Label slow = m_asm.NewLabel();
+	Label invalidate = m_asm.NewLabel();
+	Label done = m_asm.NewLabel();
+	if (operand.kind == Operand::Fixed)
+	{
+		int page = operand.value >> 8;
+		m_asm.Mov(8, Reg::Rax, Field(m_layout.ram + 8 * page));
+		m_asm.Test(8, Reg::Rax, Reg::Rax);
+		m_asm.Jump(Cond::E, slow);
+		m_asm.Mov(1, X64Mem(Reg::Rax, operand.value & 0xff), value);
+		m_asm.Mov(8, Reg::Rax, Field(m_layout.code + 8 * page));
+	}
+	else
+	{
+		m_asm.Op(Alu::Cmp, 4, Address, m_layout.directWriteEnd);
+		m_asm.Jump(Cond::AE, slow);
+		m_asm.Mov(4, Reg::Rcx, Address);
+		m_asm.Op(Shift::Shr, 4, Reg::Rcx, 8);
+		m_asm.Mov(8, Reg::Rax, X64Mem(State, Reg::Rcx, 8, m_layout.ram));
+		m_asm.Test(8, Reg::Rax, Reg::Rax);
+		m_asm.Jump(Cond::E, slow);
+		m_asm.MovzxByte(Reg::R9, Address);
+		m_asm.Mov(1, X64Mem(Reg::Rax, Reg::R9, 1), value);
+		m_asm.Mov(8, Reg::Rax, X64Mem(State, Reg::Rcx, 8, m_layout.code));
+	}
+	m_asm.Test(8, Reg::Rax, Reg::Rax);
+	m_asm.Jump(Cond::E, done);
+	m_asm.Op(Alu::Cmp, 1, X64Mem(Reg::Rax, m_layout.codeEmpty), 0);
+	m_asm.Jump(Cond::E, invalidate);
+	m_asm.Bind(done);
+	Cold([this, operand, value, slow, invalidate, done]()
+	{
+		m_asm.Bind(slow);
+		CallWrite(operand, value);
+		m_asm.Jump(done);
+		m_asm.Bind(invalidate);
+		if (operand.kind == Operand::Fixed)
+			m_asm.Mov(Address, operand.value);
+		Call(m_layout.invalidateFunction, 2);
+		m_asm.Jump(done);
+	});
+}
+
+// The bus sees the current cycle count
+void BlockCompiler::CallRead(const Operand& operand)
+{
+	m_asm.Mov(8, Field(m_layout.cycle), Cycle);
+	m_asm.Mov(4, Slot(AddressSlot), Address);
+	if (operand.kind == Operand::Fixed)
+		m_asm.Mov(Address, operand.value);
+	Call(m_layout.readFunction, 2);
+	m_asm.Mov(4, Reg::Rcx, Reg::Rax);
+	m_asm.Op(Shift::Shr, 4, Reg::Rcx, 8);
+	m_asm.Op(Alu::Or, 4, Leave, Reg::Rcx);
+	m_asm.MovzxByte(Reg::Rax, Reg::Rax);
+	m_asm.Mov(4, Address, Slot(AddressSlot));
+}
+
+void BlockCompiler::CallWrite(const Operand& operand, Reg value)
+{
+	m_asm.Mov(8, Field(m_layout.cycle), Cycle);
+	if (value != Value)
+		m_asm.Mov(4, Value, value);
+	if (operand.kind == Operand::Fixed)
+		m_asm.Mov(Address, operand.value);
+	Call(m_layout.writeFunction, 3);
+	m_asm.Op(Shift::Shr, 4, Reg::Rax, 8);
+	m_asm.Op(Alu::Or, 4, Leave, Reg::Rax);
+}
+
+// Passes the CPU state, EDX and R8D, in this order
+void BlockCompiler::Call(uint64_t function, int arguments)
+{
+	if (arguments > 1 && Arguments[1] != Address)
+		m_asm.Mov(4, Arguments[1], Address);
+	if (arguments > 2 && Arguments[2] != Value)
+		m_asm.Mov(4, Arguments[2], Value);
+	m_asm.Mov(8, Arguments[0], State);
+	m_asm.Mov(Reg::Rax, function);
+	m_asm.Call(Reg::Rax);
+}
+
+void BlockCompiler::Push(Reg value)
+{
+	m_asm.MovzxByte(Address, Field(m_layout.s));
+	m_asm.Op(Alu::Or, 4, Address, 0x100);
+	Write({ Operand::Dynamic, 0 }, value);
+	m_asm.Op(Alu::Sub, 1, Field(m_layout.s), 1);
+}
+
+void BlockCompiler::Pull()
+{
+	m_asm.MovzxByte(Address, Field(m_layout.s));
+	m_asm.Op(Alu::Add, 1, Address, 1);
+	m_asm.Mov(1, Field(m_layout.s), Address);
+	m_asm.Op(Alu::Or, 4, Address, 0x100);
+	Read({ Operand::Dynamic, 0 });
+}
+
+// Pulls a little endian address into EDX
+void BlockCompiler::PullAddress()
+{
+	Pull();
+	m_asm.Mov(4, Slot(ValueSlot), Reg::Rax);
+	Pull();
+	m_asm.Op(Shift::Shl, 4, Reg::Rax, 8);
+	m_asm.Op(Alu::Or, 4, Reg::Rax, Slot(ValueSlot));
+	m_asm.Mov(4, Address, Reg::Rax);
+}
+
+void BlockCompiler::NZ(Reg reg)
+{
+	m_asm.Mov(1, Field(m_layout.nResult), reg);
+	m_asm.Mov(1, Field(m_layout.zResult), reg);
+}
+
+// Loads C into the host carry flag
+void BlockCompiler::CarryIn()
+{
+	m_asm.MovzxByte(Reg::Rcx, Field(m_layout.p));
+	m_asm.Op(Shift::Shr, 4, Reg::Rcx, 1);
+}
+
+// Stores the host carry flag in C
+void BlockCompiler::CarryOut()
+{
+	m_asm.Set(Cond::B, Reg::Rcx);
+	m_asm.Op(Alu::And, 1, Field(m_layout.p), 0xfe);
+	m_asm.Op(Alu::Or, 1, Field(m_layout.p), Reg::Rcx);
+}
+
+// MOS6502State::P()
+void BlockCompiler::GetP(Reg reg)
+{
+	m_asm.MovzxByte(reg, Field(m_layout.p));
+	m_asm.Op(Alu::And, 4, reg, 0x7d);
+	m_asm.MovzxByte(Reg::Rcx, Field(m_layout.nResult));
+	m_asm.Op(Alu::And, 4, Reg::Rcx, 0x80);
+	m_asm.Op(Alu::Or, 4, reg, Reg::Rcx);
+	m_asm.Op(Alu::Xor, 4, Reg::Rcx, Reg::Rcx);
+	m_asm.Op(Alu::Cmp, 1, Field(m_layout.zResult), 0);
+	m_asm.Set(Cond::E, Reg::Rcx);
+	m_asm.Op(Alu::Add, 4, Reg::Rcx, Reg::Rcx);
+	m_asm.Op(Alu::Or, 4, reg, Reg::Rcx);
+}
+
+// MOS6502State::P(uint8_t), changes reg
+void BlockCompiler::SetP(Reg reg)
+{
+	m_asm.Mov(1, Field(m_layout.p), reg);
+	m_asm.Mov(1, Field(m_layout.nResult), reg);
+	m_asm.Not(4, reg);
+	m_asm.Op(Alu::And, 4, reg, 0x02);
+	m_asm.Mov(1, Field(m_layout.zResult), reg);
+}
+
+// Adds EAX with carry to A, the host flags give C and V
+void BlockCompiler::AddWithCarry()
+{
+	CarryIn();
+	m_asm.Op(Alu::Adc, 1, A, Reg::Rax);
+	m_asm.Set(Cond::B, Reg::Rcx);
+	m_asm.Set(Cond::O, Reg::Rdx);
+	m_asm.Op(Shift::Shl, 1, Reg::Rdx, 6);
+	m_asm.Op(Alu::Or, 1, Reg::Rcx, Reg::Rdx);
+	m_asm.Op(Alu::And, 1, Field(m_layout.p), 0xbe);
+	m_asm.Op(Alu::Or, 1, Field(m_layout.p), Reg::Rcx);
+	NZ(A);
+}
+
+// Compares reg with EAX, C is set when there is no borrow
+void BlockCompiler::Compare(Reg reg)
+{
+	m_asm.Mov(4, Reg::Rcx, reg);
+	m_asm.Op(Alu::Sub, 1, Reg::Rcx, Reg::Rax);
+	m_asm.Set(Cond::AE, Reg::Rdx);
+	m_asm.Op(Alu::And, 1, Field(m_layout.p), 0xfe);
+	m_asm.Op(Alu::Or, 1, Field(m_layout.p), Reg::Rdx);
+	NZ(Reg::Rcx);
+}
+
+void BlockCompiler::ShiftOp(Operation operation, Reg reg)
+{
+	switch (operation)
+	{
+	case Operation::Asl:
+		m_asm.Op(Shift::Shl, 1, reg, 1);
+		break;
+	case Operation::Lsr:
+		m_asm.Op(Shift::Shr, 1, reg, 1);
+		break;
+	case Operation::Rol:
+		CarryIn();
+		m_asm.Op(Shift::Rcl, 1, reg, 1);
+		break;
+	default:
+		CarryIn();
+		m_asm.Op(Shift::Rcr, 1, reg, 1);
+		break;
+	}
+	CarryOut();
+	NZ(reg);
+}
+
+// After I is cleared the block is left when the interrupt is due
+void BlockCompiler::CheckInterrupt(uint16_t next)
+{
+	Label check = m_asm.NewLabel();
+	Label done = m_asm.NewLabel();
+	m_asm.Op(Alu::Cmp, 1, Field(m_layout.pending), 0);
+	m_asm.Jump(Cond::NE, check);
+	m_asm.Bind(done);
+	Cold([this, check, done, next]()
+	{
+		m_asm.Bind(check);
+		m_asm.Test(1, Field(m_layout.pending), m_layout.pendingResetNmi);
+		m_asm.Jump(Cond::NE, ExitLabel(next));
+		m_asm.Test(1, Field(m_layout.p), 0x04);
+		m_asm.Jump(Cond::E, ExitLabel(next));
+		m_asm.Jump(done);
+	});
+}
+
+// Called with the host flags set to test the condition
+void BlockCompiler::Branch(Cond taken, uint16_t next, uint16_t target)
+{
+	Label jump = m_asm.NewLabel();
+	m_asm.Jump(taken, jump);
+	Cycles(2);
+	Transfer(next);
+	m_asm.Bind(jump);
+	Cycles((target & 0xff00) != (next & 0xff00) ? 4 : 3);
+	Transfer(target);
+}
+
+// Jumps to a target in the block while one more pass ends by the cycle limit, otherwise leaves the block
+void BlockCompiler::Transfer(uint16_t target)
+{
+	if (m_calls)
+	{
+		m_asm.Test(4, Leave, Leave);
+		m_asm.Jump(Cond::NE, ExitLabel(target));
+	}
+	auto it = m_instructions.find(target);
+	if (m_loops && it != m_instructions.end())
+	{
+		m_asm.Op(Alu::Cmp, 8, Cycle, Slot(CycleLimitSlot));
+		m_asm.Jump(Cond::BE, it->second);
+	}
+	m_asm.Jump(ExitLabel(target));
+}
+
+// Leaves the block at the pc in EDX
+void BlockCompiler::ExitDynamic()
+{
+	m_asm.Mov(2, Field(m_layout.pc), Address);
+	m_asm.Jump(m_epilogue);
+}
+
+// Each exit stores its pc and goes to the epilogue
+Label BlockCompiler::ExitLabel(uint16_t pc)
+{
+	auto it = m_exits.find(pc);
+	if (it != m_exits.end())
+		return it->second;
+	Label label = m_asm.NewLabel();
+	m_exits[pc] = label;
+	return label;
+}
+
+void BlockCompiler::Cold(std::function<void ()> code)
+{
+	m_cold.push_back(code);
+}
+
+} // namespace
+
+bool MOS6502State::Translatable(uint8_t opcode)
+{
+	return opcodes[opcode].operation != Operation::Invalid;
+}
+
+// Field offsets are taken from this object, MOS6502State is not a standard layout class
+auto MOS6502State::Compile(const std::vector<TranslatedInstruction>& instructions, uint16_t address, const NativeBus& bus, bool loops, int& cycles) -> NativeBlock
+{
+	auto offset = [this](const void* field)
+	{
+		return static_cast<int32_t>(static_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(this));
+	};
+
+	StateLayout layout;
+	layout.pending = offset(&m_pending);
+	layout.cycle = offset(&cycle);
+	layout.pc = offset(&pc);
+	layout.a = offset(&a);
+	layout.x = offset(&x);
+	layout.y = offset(&y);
+	layout.s = offset(&s);
+	layout.p = offset(&p);
+	layout.nResult = offset(&nResult);
+	layout.zResult = offset(&zResult);
+	layout.code = offset(m_code.data());
+	layout.ram = offset(m_ram.data());
+	layout.read = offset(m_read.data());
+	layout.codeEmpty = static_cast<int32_t>(offsetof(DecodedPage, empty));
+	layout.pendingResetNmi = PendingReset | PendingNmi;
+	layout.directWriteEnd = m_directWriteEnd;
+	layout.readFunction = reinterpret_cast<uint64_t>(bus.read);
+	layout.writeFunction = reinterpret_cast<uint64_t>(bus.write);
+	layout.invalidateFunction = reinterpret_cast<uint64_t>(&NativeInvalidate);
+
+	cycles = 0;
+	for (const TranslatedInstruction& instruction : instructions)
+		cycles += MaxCycles(instruction);
+
+	if (!m_nativeCode)
+		m_nativeCode = std::make_unique<ExecutableMemory>(NativeCodeSize);
+	const uint8_t* code = m_nativeCode->Add(BlockCompiler(layout, loops).Compile(instructions, address));
+	return reinterpret_cast<NativeBlock>(const_cast<uint8_t*>(code));
+}
+
+void MOS6502State::ClearNativeCode()
+{
+	if (m_nativeCode)
+		m_nativeCode->Clear();
+}
+
+} // namespace DjeeDjay
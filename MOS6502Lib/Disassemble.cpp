@@ -134,7 +134,7 @@ std::string Unknown(Memory& memory, uint16_t addr)
 	return Binary(addr, b0) + " ???";
 }
 
-std::string Status(const MOS6502& cpu)
+std::string Status(const MOS6502State& cpu)
 {
 	return std::string() +
 		(cpu.N() ? "N" : "-") +
@@ -149,7 +149,7 @@ std::string Status(const MOS6502& cpu)
 
 } // namespace
 
-std::string ShowRegisters(const MOS6502& cpu)
+std::string ShowRegisters(const MOS6502State& cpu)
 {
 	return "A=" + Hex8(cpu.A()) + " X=" + Hex8(cpu.X()) + " Y=" + Hex8(cpu.Y()) + " " + Status(cpu);
 }
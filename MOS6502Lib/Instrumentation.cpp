@@ -0,0 +1,100 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include "DjeeDjay/Instrumentation.h"
+
+namespace DjeeDjay {
+
+DebugPolicy::DebugPolicy() :
+	m_breakpoints(0x10000),
+	m_breakCycle(~0ull),
+	m_instructions(0),
+	m_opcodeCounts(),
+	m_ioReads(0),
+	m_ioWrites(0)
+{
+}
+
+void DebugPolicy::Trace(TraceEvent slot)
+{
+	m_trace = slot;
+}
+
+void DebugPolicy::IoTrace(IoTraceEvent slot)
+{
+	m_ioTrace = slot;
+}
+
+void DebugPolicy::Breakpoint(uint16_t address, bool enable)
+{
+	m_breakpoints[address] = enable;
+}
+
+bool DebugPolicy::Breakpoint(uint16_t address) const
+{
+	return m_breakpoints[address];
+}
+
+void DebugPolicy::ClearBreakpoints()
+{
+	m_breakpoints.assign(m_breakpoints.size(), false);
+}
+
+uint64_t DebugPolicy::Instructions() const
+{
+	return m_instructions;
+}
+
+uint64_t DebugPolicy::OpcodeCount(uint8_t opcode) const
+{
+	return m_opcodeCounts[opcode];
+}
+
+uint64_t DebugPolicy::IoReads() const
+{
+	return m_ioReads;
+}
+
+uint64_t DebugPolicy::IoWrites() const
+{
+	return m_ioWrites;
+}
+
+void DebugPolicy::ClearCounters()
+{
+	m_instructions = 0;
+	m_opcodeCounts.fill(0);
+	m_ioReads = 0;
+	m_ioWrites = 0;
+}
+
+bool DebugPolicy::Break(uint16_t pc, uint64_t cycle)
+{
+	if (!m_breakpoints[pc] || cycle == m_breakCycle)
+		return false;
+	m_breakCycle = cycle;
+	return true;
+}
+
+void DebugPolicy::BeforeInstruction(const MOS6502State& cpu, uint8_t opcode)
+{
+	++m_instructions;
+	++m_opcodeCounts[opcode];
+	if (m_trace)
+		m_trace(cpu);
+}
+
+void DebugPolicy::IoRead(uint16_t address, uint8_t value)
+{
+	++m_ioReads;
+	if (m_ioTrace)
+		m_ioTrace(address, value, false);
+}
+
+void DebugPolicy::IoWrite(uint16_t address, uint8_t value)
+{
+	++m_ioWrites;
+	if (m_ioTrace)
+		m_ioTrace(address, value, true);
+}
+
+} // namespace DjeeDjay
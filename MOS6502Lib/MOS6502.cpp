@@ -1,23 +1,12 @@
 // (C) Copyright Gert-Jan de Vos 2021.
 
 #include "DjeeDjay/MOS6502.h"
+#include "DjeeDjay/X64Assembler.h"
+#include <algorithm>
+#include <cstring>
 
 namespace DjeeDjay {
 
-namespace {
-
-uint8_t MSB(uint16_t value)
-{
-	return value >> 8;
-}
-
-uint8_t LSB(uint16_t value)
-{
-	return value & 0xFF;
-}
-
-} // namespace
-
 MemoryReadError::MemoryReadError(uint16_t address) :
 	std::runtime_error("Read error"),
 	address(address)
@@ -36,860 +25,465 @@ InvalidOpcodeError::InvalidOpcodeError(uint8_t opcode) :
 {
 }
 
-MOS6502::MOS6502(Memory& memory) :
-	m_memory(memory)
-{
-}
-
-void MOS6502::NMI()
-{
-	m_nmi = true;
-}
-
-void MOS6502::Reset(bool value)
-{
-	m_reset = value;
-}
-
-void MOS6502::IRQ(bool value)
-{
-	m_irq = value;
-}
-
-bool MOS6502::IRQ() const
-{
-	return m_irq;
-}
-
-void MOS6502::Step()
-{
-	if (m_reset)
-	{
-		cycle = 0;
-		pc = Read16(0xfffc);
-		p = 0x00;
-		s = 0xff;
-		return;
-	}
-	if (m_nmi)
-	{
-		Push(MSB(pc));
-		Push(LSB(pc));
-		Push((p & 0xcf) | 0x20);
-		m_nmi = false;
-		pc = Read16(0xfffa);
-		cycle += 7;
-		return;
-	}
-	if (!I() && m_irq)
-	{
-		Push(MSB(pc));
-		Push(LSB(pc));
-		Push((p & 0xcf) | 0x20);
-		I(true);
-		pc = Read16(0xfffe);
-		cycle += 7;
-		return;
-	}
-
-	uint8_t opcode = ReadPC();
-	switch (opcode)
-	{
-	case 0x00: return BRK(Implied(7));
-	case 0x01: return ORA(IndirectX());
-	case 0x05: return ORA(ZeroPage());
-	case 0x06: return ASL(ZeroPageRW());
-	case 0x08: return PHP(Implied(3));
-	case 0x09: return ORA(Immediate());
-	case 0x0d: return ORA(Absolute());
-	case 0x0e: return ASL(AbsoluteRW());
-	case 0x0a: return ASL(Implied());
-	case 0x10: return Branch(!N());
-	case 0x11: return ORA(IndirectY());
-	case 0x15: return ORA(ZeroPageX());
-	case 0x16: return ASL(ZeroPageXRW());
-	case 0x18: return CLC(Implied());
-	case 0x19: return ORA(AbsoluteY());
-	case 0x1d: return ORA(AbsoluteX());
-	case 0x1e: return ASL(AbsoluteXRW());
-	case 0x20: return JSR(Absolute(6));
-	case 0x21: return AND(IndirectX());
-	case 0x24: return BIT(ZeroPage());
-	case 0x25: return AND(ZeroPage());
-	case 0x26: return ROL(ZeroPageRW());
-	case 0x28: return PLP(Implied(4));
-	case 0x29: return AND(Immediate());
-	case 0x2a: return ROL(Implied());
-	case 0x2c: return BIT(Absolute());
-	case 0x2d: return AND(Absolute());
-	case 0x2e: return ROL(AbsoluteRW());
-	case 0x30: return Branch(N());
-	case 0x31: return AND(IndirectY());
-	case 0x35: return AND(ZeroPageX());
-	case 0x36: return ROL(ZeroPageXRW());
-	case 0x38: return SEC(Implied());
-	case 0x39: return AND(AbsoluteY());
-	case 0x3d: return AND(AbsoluteX());
-	case 0x3e: return ROL(AbsoluteXRW());
-	case 0x40: return RTI(Implied(6));
-	case 0x41: return EOR(IndirectX());
-	case 0x45: return EOR(ZeroPage());
-	case 0x46: return LSR(ZeroPageRW());
-	case 0x48: return PHA(Implied(3));
-	case 0x49: return EOR(Immediate());
-	case 0x4a: return LSR(Implied());
-	case 0x4c: return JMP(Absolute(3));
-	case 0x4d: return EOR(Absolute());
-	case 0x4e: return LSR(AbsoluteRW());
-	case 0x50: return Branch(!V());
-	case 0x51: return EOR(IndirectY());
-	case 0x55: return EOR(ZeroPageX());
-	case 0x59: return EOR(AbsoluteY());
-	case 0x5d: return EOR(AbsoluteX());
-	case 0x56: return LSR(ZeroPageXRW());
-	case 0x58: return CLI(Implied());
-	case 0x5e: return LSR(AbsoluteXRW());
-	case 0x60: return RTS(Implied(6));
-	case 0x61: return ADC(IndirectX());
-	case 0x65: return ADC(ZeroPage());
-	case 0x66: return ROR(ZeroPageRW());
-	case 0x68: return PLA(Implied(4));
-	case 0x69: return ADC(Immediate());
-	case 0x6a: return ROR(Implied());
-	case 0x6c: return JMP(Indirect());
-	case 0x6d: return ADC(Absolute());
-	case 0x6e: return ROR(AbsoluteRW());
-	case 0x70: return Branch(V());
-	case 0x71: return ADC(IndirectY());
-	case 0x75: return ADC(ZeroPageX());
-	case 0x76: return ROR(ZeroPageXRW());
-	case 0x78: return SEI(Implied());
-	case 0x79: return ADC(AbsoluteY());
-	case 0x7d: return ADC(AbsoluteX());
-	case 0x7e: return ROR(AbsoluteXRW());
-	case 0x81: return STA(IndirectX());
-	case 0x84: return STY(ZeroPage());
-	case 0x85: return STA(ZeroPage());
-	case 0x86: return STX(ZeroPage());
-	case 0x88: return DEY(Implied());
-	case 0x8a: return TXA(Implied());
-	case 0x8c: return STY(Absolute());
-	case 0x8d: return STA(Absolute());
-	case 0x8e: return STX(Absolute());
-	case 0x90: return Branch(!C());
-	case 0x91: return STA(IndirectY(6));
-	case 0x94: return STY(ZeroPageX());
-	case 0x95: return STA(ZeroPageX());
-	case 0x96: return STX(ZeroPageY());
-	case 0x98: return TYA(Implied());
-	case 0x9a: return TXS(Implied());
-	case 0x99: return STA(AbsoluteY(5));
-	case 0x9d: return STA(AbsoluteX(5));
-	case 0xa0: return LDY(Immediate());
-	case 0xa1: return LDA(IndirectX());
-	case 0xa2: return LDX(Immediate());
-	case 0xa4: return LDY(ZeroPage());
-	case 0xa5: return LDA(ZeroPage());
-	case 0xa6: return LDX(ZeroPage());
-	case 0xa8: return TAY(Implied());
-	case 0xa9: return LDA(Immediate());
-	case 0xaa: return TAX(Implied());
-	case 0xac: return LDY(Absolute());
-	case 0xad: return LDA(Absolute());
-	case 0xae: return LDX(Absolute());
-	case 0xb0: return Branch(C());
-	case 0xb1: return LDA(IndirectY());
-	case 0xb4: return LDY(ZeroPageX());
-	case 0xb5: return LDA(ZeroPageX());
-	case 0xb6: return LDX(ZeroPageY());
-	case 0xb8: return CLV(Implied());
-	case 0xb9: return LDA(AbsoluteY());
-	case 0xba: return TSX(Implied());
-	case 0xbc: return LDY(AbsoluteX());
-	case 0xbd: return LDA(AbsoluteX());
-	case 0xbe: return LDX(AbsoluteY());
-	case 0xc0: return CPY(Immediate());
-	case 0xc1: return CMP(IndirectX());
-	case 0xc4: return CPY(ZeroPage());
-	case 0xc5: return CMP(ZeroPage());
-	case 0xc6: return DEC(ZeroPageRW());
-	case 0xc8: return INY(Implied());
-	case 0xc9: return CMP(Immediate());
-	case 0xca: return DEX(Implied());
-	case 0xcc: return CPY(Absolute());
-	case 0xcd: return CMP(Absolute());
-	case 0xce: return DEC(AbsoluteRW());
-	case 0xd0: return Branch(!Z());
-	case 0xd1: return CMP(IndirectY());
-	case 0xd5: return CMP(ZeroPageX());
-	case 0xd6: return DEC(ZeroPageXRW());
-	case 0xd8: return CLD(Implied());
-	case 0xd9: return CMP(AbsoluteY());
-	case 0xdd: return CMP(AbsoluteX());
-	case 0xde: return DEC(AbsoluteXRW());
-	case 0xe0: return CPX(Immediate());
-	case 0xe1: return SBC(IndirectX());
-	case 0xe4: return CPX(ZeroPage());
-	case 0xe5: return SBC(ZeroPage());
-	case 0xe6: return INC(ZeroPageRW());
-	case 0xe8: return INX(Implied());
-	case 0xe9: return SBC(Immediate());
-	case 0xea: return NOP(Implied(2));
-	case 0xec: return CPX(Absolute());
-	case 0xed: return SBC(Absolute());
-	case 0xee: return INC(AbsoluteRW());
-	case 0xf0: return Branch(Z());
-	case 0xf1: return SBC(IndirectY());
-	case 0xf5: return SBC(ZeroPageX());
-	case 0xf6: return INC(ZeroPageXRW());
-	case 0xf8: return SED(Implied());
-	case 0xf9: return SBC(AbsoluteY());
-	case 0xfd: return SBC(AbsoluteX());
-	case 0xfe: return INC(AbsoluteXRW());
-	default: throw InvalidOpcodeError(opcode);
-	}
-}
-
-uint16_t MOS6502::PC() const
-{
-	return pc;
-}
-
-uint8_t MOS6502::A() const
-{
-	return a;
-}
-
-uint8_t MOS6502::X() const
-{
-	return x;
-}
-
-uint8_t MOS6502::Y() const
-{
-	return y;
-}
-
-uint8_t MOS6502::P() const
-{
-	return p;
-}
-
-uint8_t MOS6502::S() const
-{
-	return s;
-}
-
-bool MOS6502::N() const
-{
-	return GetP<7>();
-}
-
-void MOS6502::N(bool value)
-{
-	SetP<7>(value);
-}
-
-bool MOS6502::V() const
-{
-	return GetP<6>();
-}
-
-void MOS6502::V(bool value)
-{
-	SetP<6>(value);
-}
-
-bool MOS6502::B() const
-{
-	return GetP<4>();
-}
-
-bool MOS6502::D() const
-{
-	return GetP<3>();
-}
-
-void MOS6502::D(bool value)
-{
-	SetP<3>(value);
-}
-
-bool MOS6502::I() const
-{
-	return GetP<2>();
-}
-
-void MOS6502::I(bool value)
-{
-	SetP<2>(value);
-}
-
-bool MOS6502::Z() const
-{
-	return GetP<1>();
-}
-
-void MOS6502::Z(bool value)
-{
-	SetP<1>(value);
-}
-
-bool MOS6502::C() const
-{
-	return GetP<0>();
-}
-
-void MOS6502::C(bool value)
-{
-	SetP<0>(value);
-}
-
-uint64_t MOS6502::Cycles() const
-{
-	return cycle;
-}
-
-uint8_t MOS6502::ReadPC()
-{
-	return Read(pc++);
-}
-
-uint16_t MOS6502::ReadPC16()
-{
-	uint16_t lsb = ReadPC();
-	uint16_t msb = ReadPC();
-	return (msb << 8) | lsb;
-}
-
-uint16_t MOS6502::Read16(uint16_t address)
-{
-	uint16_t lsb = Read(address);
-	uint16_t msb = Read(address + 1);
-	return (msb << 8) | lsb;
-}
-
-MOS6502::ImpliedType MOS6502::Implied(int duration)
-{
-	cycle += duration;
-	return ImpliedType::Value;
-}
-
-uint16_t MOS6502::Immediate()
-{
-	cycle += 2;
-	return pc++;
-}
-
-uint16_t MOS6502::ZeroPage()
-{
-	cycle += 3;
-	return ReadPC();
-}
-
-uint16_t MOS6502::ZeroPageRW()
-{
-	cycle += 5;
-	return ReadPC();
-}
-
-uint8_t MOS6502::ZeroPageX()
-{
-	cycle += 4;
-	return ReadPC() + x;
-}
-
-uint8_t MOS6502::ZeroPageXRW()
-{
-	cycle += 6;
-	return ReadPC() + x;
-}
-
-uint8_t MOS6502::ZeroPageY()
-{
-	cycle += 4;
-	return ReadPC() + y;
-}
-
-uint16_t MOS6502::Absolute(int duration)
-{
-	cycle += duration;
-	return ReadPC16();
-}
-
-uint16_t MOS6502::AbsoluteRW()
-{
-	cycle += 6;
-	return ReadPC16();
-}
-
-uint16_t MOS6502::AbsoluteX(int duration)
-{
-	uint16_t lsb = ReadPC() + x;
-	uint16_t msb = ReadPC();
-
-	if (lsb > 0xff && duration == 4)
-		duration = 5;
-
-	cycle += duration;
-	return (msb << 8) + lsb;
-}
-
-uint16_t MOS6502::AbsoluteXRW()
-{
-	cycle += 7;
-	return ReadPC16() + x;
-}
-
-uint16_t MOS6502::AbsoluteY(int duration)
-{
-	uint16_t lsb = ReadPC() + y;
-	uint16_t msb = ReadPC();
-
-	if (lsb > 0xff && duration == 4)
-		duration = 5;
-
-	cycle += duration;
-	return (msb << 8) + lsb;
-}
-
-uint16_t MOS6502::Indirect()
-{
-	cycle += 5;
-	uint8_t a0 = ReadPC();
-	uint8_t a1 = ReadPC();
-	uint8_t addr0 = Read((a1 << 8) | a0);
-	uint8_t addr1 = Read((a1 << 8) | (a0 + 1));
-	return (addr1 << 8) | addr0;
-}
-
-uint16_t MOS6502::IndirectX()
-{
-	cycle += 6;
-	return Read16(static_cast<uint8_t>(Read(pc++) + x));
-}
-
-uint16_t MOS6502::IndirectY(int duration)
-{
-	uint16_t addr = Read(pc++);
-	uint16_t lsb = Read(addr) + y;
-	uint16_t msb = Read(addr + 1);
-
-	if (lsb > 0xff && duration == 5)
-		duration = 6;
-
-	cycle += duration;
-	return (msb << 8) + lsb;
-}
-
-void MOS6502::Push(uint8_t value)
-{
-	Write(0x0100 | s, value);
-	--s;
-}
-
-uint8_t MOS6502::Pull()
+TranslationError::TranslationError(uint16_t address) :
+	std::runtime_error("Translation error"),
+	address(address)
 {
-	++s;
-	return Read(0x0100 | s);
 }
 
-void MOS6502::CLC(ImpliedType)
+void DecodedPage::Store(int offset, uint8_t opcode, int length, uint16_t operand, uint8_t loop)
 {
-	C(false);
+	DecodedInstruction& decoded = instructions[offset];
+	decoded.opcode = opcode;
+	decoded.length = static_cast<uint8_t>(length);
+	decoded.operand = operand;
+	decoded.loop = loop;
+	empty = false;
 }
 
-void MOS6502::SEC(ImpliedType)
+// Drops the instructions that can include a byte from first to last.
+// Instructions never continue into the next page, so these start at most two bytes earlier.
+void DecodedPage::Invalidate(int first, int last)
 {
-	C(true);
+	for (int i = std::max(first - 2, 0); i <= last; ++i)
+		instructions[i].length = 0;
 }
 
-void MOS6502::CLI(ImpliedType)
-{
-	I(false);
-}
+// Number of operand bytes fetched before an instruction executes.
+// The byte following BRK is skipped by the instruction itself.
+const std::array<uint8_t, 256> MOS6502State::s_operandSize =
+{{
+//	x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 xa xb xc xd xe xf
+	0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 2, 2, 0, // 0x
+	1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, // 1x
+	2, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, // 2x
+	1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, // 3x
+	0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, // 4x
+	1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, // 5x
+	0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, // 6x
+	1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, // 7x
+	0, 1, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 2, 2, 2, 0, // 8x
+	1, 1, 0, 0, 1, 1, 1, 0, 0, 2, 0, 0, 0, 2, 0, 0, // 9x
+	1, 1, 1, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, // ax
+	1, 1, 0, 0, 1, 1, 1, 0, 0, 2, 0, 0, 2, 2, 2, 0, // bx
+	1, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, // cx
+	1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, // dx
+	1, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 2, 2, 2, 0, // ex
+	1, 1, 0, 0, 0, 1, 1, 0, 0, 2, 0, 0, 0, 2, 2, 0, // fx
+}};
 
-void MOS6502::SEI(ImpliedType)
-{
-	I(true);
-}
+MOS6502State::MOS6502State() = default;
 
-void MOS6502::CLV(ImpliedType)
-{
-	V(false);
-}
+MOS6502State::~MOS6502State() = default;
 
-void MOS6502::CLD(ImpliedType)
+void MOS6502State::NMI()
 {
-	D(false);
+	m_pending |= PendingNmi;
 }
 
-void MOS6502::SED(ImpliedType)
+void MOS6502State::Save(MOS6502Snapshot& snapshot) const
 {
-	D(true);
+	snapshot.cycle = cycle;
+	snapshot.pc = pc;
+	snapshot.a = a;
+	snapshot.x = x;
+	snapshot.y = y;
+	snapshot.s = s;
+	snapshot.p = P();
+	snapshot.pending = m_pending;
 }
 
-uint8_t MOS6502::ASL_N(uint8_t arg)
+void MOS6502State::Restore(const MOS6502Snapshot& snapshot)
 {
-	C(arg & 0x80);
-	arg = arg << 1;
-	N(arg & 0x80);
-	Z(arg == 0);
-	return arg;
+	cycle = snapshot.cycle;
+	pc = snapshot.pc;
+	a = snapshot.a;
+	x = snapshot.x;
+	y = snapshot.y;
+	s = snapshot.s;
+	P(snapshot.p);
+	m_pending = snapshot.pending;
+	StartIdleDetection();
 }
 
-void MOS6502::ASL(ImpliedType)
+void MOS6502State::Reset(bool value)
 {
-	a = ASL_N(a);
+	if (value)
+		m_pending |= PendingReset;
+	else
+		m_pending &= ~PendingReset;
 }
 
-void MOS6502::ASL(uint16_t addr)
+void MOS6502State::IRQ(bool value)
 {
-	Write(addr, ASL_N(Read(addr)));
+	if (value)
+		m_pending |= PendingIrq;
+	else
+		m_pending &= ~PendingIrq;
 }
 
-uint8_t MOS6502::LSR_N(uint8_t arg)
+bool MOS6502State::IRQ() const
 {
-	C(arg & 0x01);
-	arg = arg >> 1;
-	N(arg & 0x80);
-	Z(arg == 0);
-	return arg;
+	return (m_pending & PendingIrq) != 0;
 }
 
-void MOS6502::LSR(ImpliedType)
+void MOS6502State::MapCode(int page, DecodedPage* code, bool readOnly)
 {
-	a = LSR_N(a);
+	m_code[page] = code;
+	if (code)
+		code->readOnly = readOnly;
 }
 
-void MOS6502::LSR(uint16_t addr)
+void MOS6502State::MapRam(int page, uint8_t* data)
 {
-	Write(addr, LSR_N(Read(addr)));
+	m_ram[page] = data;
+	m_read[page] = data;
 }
 
-uint8_t MOS6502::ROL_N(uint8_t arg)
+void MOS6502State::MapRom(int page, const uint8_t* data)
 {
-	uint8_t c = C();
-	uint8_t result = (arg << 1) | c;
-	C(arg & 0x80);
-	N(result & 0x80);
-	Z(result == 0);
-	return result;
+	m_ram[page] = nullptr;
+	m_read[page] = data;
 }
 
-void MOS6502::ROL(ImpliedType)
+void MOS6502State::DirectWrites(uint16_t endAddress)
 {
-	a = ROL_N(a);
+	m_directWriteEnd = endAddress;
 }
 
-void MOS6502::ROL(uint16_t addr)
+void MOS6502State::RamWritten(RamWriteEvent slot)
 {
-	Write(addr, ROL_N(Read(addr)));
+	m_ramWritten = slot;
 }
 
-uint8_t MOS6502::ROR_N(uint8_t arg)
+void MOS6502State::IdleSkipping(bool enable)
 {
-	uint8_t c = C();
-	uint8_t result = (c << 7) | (arg >> 1);
-	C(arg & 0x01);
-	N(result & 0x80);
-	Z(result == 0);
-	return result;
+	m_idleSkipping = enable;
 }
 
-void MOS6502::ROR(ImpliedType)
+bool MOS6502State::IdleSkipping() const
 {
-	a = ROR_N(a);
+	return m_idleSkipping;
 }
 
-void MOS6502::ROR(uint16_t addr)
+uint64_t MOS6502State::IdleCycles() const
 {
-	Write(addr, ROR_N(Read(addr)));
+	return m_idleCycles;
 }
 
-void MOS6502::BRK(ImpliedType)
-{
-	pc += 1;
-	Push(MSB(pc));
-	Push(LSB(pc));
-	Push(p | 0x30);
-	I(true);
-	pc = Read16(0xfffe);
-}
+namespace {
 
-void MOS6502::CMP(uint16_t addr)
-{
-	uint8_t arg = Read(addr);
-	N((a - arg) & 0x80);
-	C(a >= arg);
-	Z(a == arg);
-}
+// An idle loop iteration must return to its first instruction within this many cycles
+const uint64_t MaxIdleLoopCycles = 1024;
+const uint64_t MinProbeBackoff = 256;
+const uint64_t MaxProbeBackoff = 65536;
 
-void MOS6502::AND(uint16_t addr)
-{
-	a &= Read(addr);
-	N(a & 0x80);
-	Z(a == 0);
-}
+} // namespace
 
-void MOS6502::BIT(uint16_t addr)
+void MOS6502State::StartIdleDetection()
 {
-	auto arg = Read(addr);
-	N(arg & 0x80);
-	V(arg & 0x40);
-	Z((arg & a) == 0);
+	m_probing = false;
+	m_nextProbeCycle = cycle;
+	m_probeBackoff = MinProbeBackoff;
 }
 
-void MOS6502::ORA(uint16_t addr)
+// Called at instruction boundaries. When an iteration from the probe pc comes back to the same
+// state without side effects, every later iteration is identical, so the whole iterations that
+// end by endCycle are skipped.
+bool MOS6502State::SkipIdle(uint64_t endCycle)
 {
-	a |= Read(addr);
-	N(a & 0x80);
-	Z(a == 0);
-}
+	if (!m_probing)
+	{
+		StartProbe();
+		return false;
+	}
+	if (!m_probe.clean || cycle - m_probe.cycle > MaxIdleLoopCycles)
+	{
+		FailProbe();
+		return false;
+	}
+	if (pc != m_probe.pc)
+		return false;
+	if (a != m_probe.a || x != m_probe.x || y != m_probe.y || s != m_probe.s || P() != m_probe.p)
+	{
+		FailProbe();
+		return false;
+	}
+	for (int i = 0; i < m_probe.writeCount; ++i)
+	{
+		uint16_t address = m_probe.writes[i].address;
+		if (m_ram[address >> 8][address & 0xff] != m_probe.writes[i].value)
+		{
+			FailProbe();
+			return false;
+		}
+	}
 
-void MOS6502::ADC_N(uint8_t arg)
-{
-	uint16_t sum = a + arg + C();
-	C(sum > 255);
-	V((a ^ sum) & (arg ^ sum) & 0x80);
-	a = static_cast<uint8_t>(sum);
-	Z(a == 0);
-	N(a & 0x80);
+	uint64_t period = cycle - m_probe.cycle;
+	uint64_t skip = (endCycle - cycle) / period * period;
+	cycle += skip;
+	m_idleCycles += skip;
+	m_probing = false;
+	m_nextProbeCycle = endCycle;
+	return skip != 0;
 }
 
-void MOS6502::ADC(uint16_t addr)
+void MOS6502State::StartProbe()
 {
-	ADC_N(Read(addr));
+	m_probing = true;
+	m_probe.pc = pc;
+	m_probe.a = a;
+	m_probe.x = x;
+	m_probe.y = y;
+	m_probe.s = s;
+	m_probe.p = P();
+	m_probe.cycle = cycle;
+	m_probe.clean = true;
+	m_probe.writeCount = 0;
 }
 
-void MOS6502::SBC(uint16_t addr)
+// Writes may change RAM temporarily, like a stack slot that is pushed to by JSR and later by PHA
+void MOS6502State::ProbeWrite(uint16_t address)
 {
-	ADC_N(~Read(addr));
+	uint8_t* page = m_ram[address >> 8];
+	if (!page)
+	{
+		m_probe.clean = false;
+		return;
+	}
+	for (int i = 0; i < m_probe.writeCount; ++i)
+	{
+		if (m_probe.writes[i].address == address)
+			return;
+	}
+	if (m_probe.writeCount == static_cast<int>(m_probe.writes.size()))
+	{
+		m_probe.clean = false;
+		return;
+	}
+	m_probe.writes[m_probe.writeCount++] = { address, page[address & 0xff] };
 }
 
-void MOS6502::CPX(uint16_t addr)
+void MOS6502State::FailProbe()
 {
-	uint8_t arg = Read(addr);
-	N((x - arg) & 0x80);
-	C(x >= arg);
-	Z(x == arg);
+	m_probing = false;
+	m_nextProbeCycle = cycle + m_probeBackoff;
+	m_probeBackoff = std::min(2 * m_probeBackoff, MaxProbeBackoff);
 }
 
-void MOS6502::CPY(uint16_t addr)
+bool MOS6502State::IsRam(int address, int size) const
 {
-	uint8_t arg = Read(addr);
-	N((y - arg) & 0x80);
-	C(y >= arg);
-	Z(y == arg);
+	if (address + size > 0x10000)
+		return false;
+	for (int page = address >> 8; page <= (address + size - 1) >> 8; ++page)
+	{
+		if (!m_ram[page])
+			return false;
+	}
+	return true;
 }
 
-void MOS6502::DEC(uint16_t addr)
+void MOS6502State::Fill(uint16_t address, int size, uint8_t value)
 {
-	uint8_t value = Read(addr) - 1;
-	N(value & 0x80);
-	Z(value == 0);
-	Write(addr, value);
+	if (m_probing)
+		m_probe.clean = false;
+	if (m_ramWritten)
+		m_ramWritten(address, size);
+	while (size > 0)
+	{
+		int offset = address & 0xff;
+		int count = std::min(size, 0x100 - offset);
+		std::memset(m_ram[address >> 8] + offset, value, count);
+		if (DecodedPage* code = m_code[address >> 8])
+			code->Invalidate(offset, offset + count - 1);
+		address += count;
+		size -= count;
+	}
 }
 
-void MOS6502::EOR(uint16_t addr)
+// Copies bytes in ascending address order, like the 6502 loops it replaces
+void MOS6502State::Copy(uint16_t to, uint16_t from, int size)
 {
-	a ^= Read(addr);
-	N(a & 0x80);
-	Z(a == 0);
-}
+	if (m_probing)
+		m_probe.clean = false;
+	if (m_ramWritten)
+		m_ramWritten(to, size);
+	if (to > from && to < from + size)
+	{
+		for (int i = 0; i < size; ++i)
+		{
+			uint16_t address = to + i;
+			m_ram[address >> 8][address & 0xff] = m_ram[(from + i) >> 8][(from + i) & 0xff];
+			InvalidateCode(address);
+		}
+		return;
+	}
 
-void MOS6502::INC(uint16_t addr)
-{
-	uint8_t value = Read(addr) + 1;
-	Write(addr, value);
-	N(value & 0x80);
-	Z(value == 0);
+	while (size > 0)
+	{
+		int count = std::min(size, 0x100 - std::max(to & 0xff, from & 0xff));
+		std::memmove(m_ram[to >> 8] + (to & 0xff), m_ram[from >> 8] + (from & 0xff), count);
+		if (DecodedPage* code = m_code[to >> 8])
+			code->Invalidate(to & 0xff, (to & 0xff) + count - 1);
+		to += count;
+		from += count;
+		size -= count;
+	}
 }
 
-void MOS6502::JMP(uint16_t addr)
-{
-	pc = addr;
-}
+namespace {
 
-void MOS6502::JSR(uint16_t addr)
+struct LoopPattern
 {
-	uint16_t next = pc - 1;
-	Push(MSB(next));
-	Push(LSB(next));
-	pc = addr;
-}
+	LoopIdiom idiom;
+	std::array<int, 11> code;	// -1 matches any operand
+	int size;
+};
 
-void MOS6502::LDA(uint16_t addr)
+const LoopPattern loopPatterns[] =
 {
-	a = Read(addr);
-	N(a & 0x80);
-	Z(a == 0);
-}
+	{ LoopIdiom::FillUp, { 0x91, -1, 0xc8, 0xd0, 0xfb }, 5 },
+	{ LoopIdiom::FillDown, { 0x88, 0x91, -1, 0xd0, 0xfb }, 5 },
+	{ LoopIdiom::FillDown4, { 0x91, -1, 0x91, -1, 0x91, -1, 0x91, -1, 0x88, 0xd0, 0xf5 }, 11 },
+	{ LoopIdiom::CopyUp, { 0xb1, -1, 0x91, -1, 0xc8, 0xd0, 0xf9 }, 7 },
+	{ LoopIdiom::FillZeroPageX, { 0x95, -1, 0xe8, 0xd0, 0xfb }, 5 },
+	{ LoopIdiom::FillAbsoluteX, { 0x9d, -1, -1, 0xe8, 0xd0, 0xfa }, 6 },
+};
 
-void MOS6502::LDX(uint16_t addr)
-{
-	x = Read(addr);
-	N(x & 0x80);
-	Z(x == 0);
-}
+} // namespace
 
-void MOS6502::LDY(uint16_t addr)
+LoopIdiom MOS6502State::MatchLoop(const uint8_t* code, int size)
 {
-	y = Read(addr);
-	N(y & 0x80);
-	Z(y == 0);
+	for (auto& pattern : loopPatterns)
+	{
+		if (pattern.size > size)
+			continue;
+		int i = 0;
+		while (i < pattern.size && (pattern.code[i] < 0 || pattern.code[i] == code[i]))
+			++i;
+		if (i == pattern.size)
+			return pattern.idiom;
+	}
+	return LoopIdiom::None;
 }
 
-void MOS6502::NOP(ImpliedType)
+int MOS6502State::LoopSize(LoopIdiom idiom)
 {
+	for (auto& pattern : loopPatterns)
+	{
+		if (pattern.idiom == idiom)
+			return pattern.size;
+	}
+	return 0;
 }
 
-void MOS6502::RTI(ImpliedType)
+// BRK, JSR, RTI, JMP, RTS and the branches
+bool MOS6502State::EndsBlock(uint8_t opcode)
 {
-	p = Pull() & 0xcf;
-	uint16_t addr = Pull();
-	addr |= Pull() << 8;
-	pc = addr;
+	return (opcode & 0x9f) == 0x00 || (opcode & 0xdf) == 0x4c || (opcode & 0x1f) == 0x10;
 }
 
-void MOS6502::RTS(ImpliedType)
+uint16_t MOS6502State::PC() const
 {
-	uint16_t addr = Pull();
-	addr |= Pull() << 8;
-	pc = addr + 1;
+	return pc;
 }
 
-void MOS6502::STA(uint16_t addr)
+uint8_t MOS6502State::A() const
 {
-	Write(addr, a);
+	return a;
 }
 
-void MOS6502::STX(uint16_t addr)
+uint8_t MOS6502State::X() const
 {
-	Write(addr, x);
+	return x;
 }
 
-void MOS6502::STY(uint16_t addr)
+uint8_t MOS6502State::Y() const
 {
-	Write(addr, y);
+	return y;
 }
 
-void MOS6502::TXS(ImpliedType)
+uint8_t MOS6502State::P() const
 {
-	s = x;
+	return (p & 0x7d) | (nResult & 0x80) | (zResult == 0 ? 0x02 : 0x00);
 }
 
-void MOS6502::TSX(ImpliedType)
+uint8_t MOS6502State::S() const
 {
-	x = s;
-	N(x & 0x80);
-	Z(x == 0);
+	return s;
 }
 
-void MOS6502::PHA(ImpliedType)
+bool MOS6502State::N() const
 {
-	Push(a);
+	return (nResult & 0x80) != 0;
 }
 
-void MOS6502::PLA(ImpliedType)
+void MOS6502State::N(bool value)
 {
-	a = Pull();
-	Z(a == 0);
-	N(a & 0x80);
+	nResult = value ? 0x80 : 0x00;
 }
 
-void MOS6502::PHP(ImpliedType)
+bool MOS6502State::V() const
 {
-	Push(p | 0x30);
+	return GetP<6>();
 }
 
-void MOS6502::PLP(ImpliedType)
+void MOS6502State::V(bool value)
 {
-	p = Pull() & 0xcf;
+	SetP<6>(value);
 }
 
-void MOS6502::TAX(ImpliedType)
+bool MOS6502State::B() const
 {
-	x = a;
-	N(x & 0x80);
-	Z(x == 0);
+	return GetP<4>();
 }
 
-void MOS6502::TXA(ImpliedType)
+bool MOS6502State::D() const
 {
-	a = x;
-	N(a & 0x80);
-	Z(a == 0);
+	return GetP<3>();
 }
 
-void MOS6502::DEX(ImpliedType)
+void MOS6502State::D(bool value)
 {
-	--x;
-	N(x & 0x80);
-	Z(x == 0);
+	SetP<3>(value);
 }
 
-void MOS6502::INX(ImpliedType)
+bool MOS6502State::I() const
 {
-	++x;
-	N(x & 0x80);
-	Z(x == 0);
+	return GetP<2>();
 }
 
-void MOS6502::TAY(ImpliedType)
+void MOS6502State::I(bool value)
 {
-	y = a;
-	N(y & 0x80);
-	Z(y == 0);
+	SetP<2>(value);
 }
 
-void MOS6502::TYA(ImpliedType)
+bool MOS6502State::Z() const
 {
-	a = y;
-	N(a & 0x80);
-	Z(a == 0);
+	return zResult == 0;
 }
 
-void MOS6502::DEY(ImpliedType)
+void MOS6502State::Z(bool value)
 {
-	--y;
-	N(y & 0x80);
-	Z(y == 0);
+	zResult = value ? 0x00 : 0x01;
 }
 
-void MOS6502::INY(ImpliedType)
+bool MOS6502State::C() const
 {
-	++y;
-	N(y & 0x80);
-	Z(y == 0);
+	return GetP<0>();
 }
 
-void MOS6502::Branch(bool condition)
+void MOS6502State::C(bool value)
 {
-	if (condition)
-	{
-		int8_t offset = static_cast<int8_t>(ReadPC());
-		uint16_t dst = pc + offset;
-		if ((dst & 0xff00) != (pc & 0xff00))
-			cycle += 1;
-		pc = dst;
-		cycle += 1;
-	}
-	else
-	{
-		pc += 1;
-	}
-	cycle += 2;
+	SetP<0>(value);
 }
 
-uint8_t MOS6502::Read(uint16_t address)
+uint64_t MOS6502State::Cycles() const
 {
-	return m_memory.Read(address);
+	return cycle;
 }
 
-void MOS6502::Write(uint16_t address, uint8_t value)
-{
-	m_memory.Write(address, value);
-}
+template class BasicMOS6502<Memory>;
+template class BasicMOS6502<Memory, DebugPolicy>;
 
 } // namespace DjeeDjay
@@ -0,0 +1,397 @@
+// (C) Copyright Gert-Jan de Vos 2021.
+
+#include <cstring>
+#include <new>
+#include "DjeeDjay/X64Assembler.h"
+
+#if defined(_WIN32)
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif // _WIN32
+
+namespace DjeeDjay {
+
+X64Mem::X64Mem(X64Reg base, int32_t displacement) :
+	base(base),
+	index(X64Reg::Rax),
+	indexed(false),
+	scale(1),
+	displacement(displacement)
+{
+}
+
+X64Mem::X64Mem(X64Reg base, X64Reg index, int scale, int32_t displacement) :
+	base(base),
+	index(index),
+	indexed(true),
+	scale(static_cast<uint8_t>(scale)),
+	displacement(displacement)
+{
+}
+
+namespace {
+
+int Number(X64Reg reg)
+{
+	return static_cast<int>(reg);
+}
+
+bool IsByte(int32_t value)
+{
+	return value >= -128 && value <= 127;
+}
+
+} // namespace
+
+auto X64Assembler::NewLabel() -> Label
+{
+	m_labels.push_back(-1);
+	return static_cast<Label>(m_labels.size() - 1);
+}
+
+void X64Assembler::Bind(Label label)
+{
+	m_labels[label] = static_cast<ptrdiff_t>(m_code.size());
+}
+
+void X64Assembler::Mov(int size, X64Reg dst, X64Reg src)
+{
+	Encode(size, size == 1 ? 0x88 : 0x89, Number(src), size == 1, dst);
+}
+
+void X64Assembler::Mov(int size, X64Reg dst, const X64Mem& src)
+{
+	Encode(size, size == 1 ? 0x8a : 0x8b, Number(dst), size == 1, src);
+}
+
+void X64Assembler::Mov(int size, const X64Mem& dst, X64Reg src)
+{
+	Encode(size, size == 1 ? 0x88 : 0x89, Number(src), size == 1, dst);
+}
+
+void X64Assembler::Mov(int size, const X64Mem& dst, int32_t value)
+{
+	Encode(size, size == 1 ? 0xc6 : 0xc7, 0, false, dst);
+	Immediate(size, value);
+}
+
+// Values that fit 32 bits use the zero extending 32 bit form
+void X64Assembler::Mov(X64Reg dst, uint64_t value)
+{
+	bool wide = value > 0xffffffff;
+	Rex(wide ? 8 : 4, 0, false, 0, Number(dst), false);
+	Emit(static_cast<uint8_t>(0xb8 + (Number(dst) & 7)));
+	Emit32(static_cast<uint32_t>(value));
+	if (wide)
+		Emit32(static_cast<uint32_t>(value >> 32));
+}
+
+void X64Assembler::MovzxByte(X64Reg dst, X64Reg src)
+{
+	Encode2(4, 0xb6, Number(dst), false, src, true);
+}
+
+void X64Assembler::MovzxByte(X64Reg dst, const X64Mem& src)
+{
+	Encode2(4, 0xb6, Number(dst), false, src);
+}
+
+void X64Assembler::Lea(int size, X64Reg dst, const X64Mem& src)
+{
+	Encode(size, 0x8d, Number(dst), false, src);
+}
+
+void X64Assembler::Op(Alu op, int size, X64Reg dst, X64Reg src)
+{
+	Encode(size, static_cast<uint8_t>(8 * static_cast<int>(op) + (size == 1 ? 0 : 1)), Number(src), size == 1, dst);
+}
+
+void X64Assembler::Op(Alu op, int size, X64Reg dst, const X64Mem& src)
+{
+	Encode(size, static_cast<uint8_t>(8 * static_cast<int>(op) + (size == 1 ? 2 : 3)), Number(dst), size == 1, src);
+}
+
+void X64Assembler::Op(Alu op, int size, X64Reg dst, int32_t value)
+{
+	bool shortForm = size != 1 && IsByte(value);
+	Encode(size, size == 1 ? 0x80 : shortForm ? 0x83 : 0x81, static_cast<int>(op), false, dst);
+	Immediate(shortForm ? 1 : size, value);
+}
+
+void X64Assembler::Op(Alu op, int size, const X64Mem& dst, int32_t value)
+{
+	bool shortForm = size != 1 && IsByte(value);
+	Encode(size, size == 1 ? 0x80 : shortForm ? 0x83 : 0x81, static_cast<int>(op), false, dst);
+	Immediate(shortForm ? 1 : size, value);
+}
+
+void X64Assembler::Op(Alu op, int size, const X64Mem& dst, X64Reg src)
+{
+	Encode(size, static_cast<uint8_t>(8 * static_cast<int>(op) + (size == 1 ? 0 : 1)), Number(src), size == 1, dst);
+}
+
+void X64Assembler::Test(int size, X64Reg reg, X64Reg other)
+{
+	Encode(size, size == 1 ? 0x84 : 0x85, Number(other), size == 1, reg);
+}
+
+void X64Assembler::Test(int size, X64Reg reg, int32_t value)
+{
+	Encode(size, size == 1 ? 0xf6 : 0xf7, 0, false, reg);
+	Immediate(size, value);
+}
+
+void X64Assembler::Test(int size, const X64Mem& mem, int32_t value)
+{
+	Encode(size, size == 1 ? 0xf6 : 0xf7, 0, false, mem);
+	Immediate(size, value);
+}
+
+void X64Assembler::Op(Shift op, int size, X64Reg reg, int count)
+{
+	if (count == 1)
+	{
+		Encode(size, size == 1 ? 0xd0 : 0xd1, static_cast<int>(op), false, reg);
+		return;
+	}
+	Encode(size, size == 1 ? 0xc0 : 0xc1, static_cast<int>(op), false, reg);
+	Immediate(1, count);
+}
+
+void X64Assembler::Not(int size, X64Reg reg)
+{
+	Encode(size, size == 1 ? 0xf6 : 0xf7, 2, false, reg);
+}
+
+void X64Assembler::Set(X64Cond cond, X64Reg dst)
+{
+	Encode2(1, static_cast<uint8_t>(0x90 + static_cast<int>(cond)), 0, false, dst, true);
+}
+
+void X64Assembler::Jump(X64Cond cond, Label label)
+{
+	Emit(0x0f);
+	Emit(static_cast<uint8_t>(0x80 + static_cast<int>(cond)));
+	m_fixups.push_back({ m_code.size(), label });
+	Emit32(0);
+}
+
+void X64Assembler::Jump(Label label)
+{
+	Emit(0xe9);
+	m_fixups.push_back({ m_code.size(), label });
+	Emit32(0);
+}
+
+void X64Assembler::Call(X64Reg target)
+{
+	Encode(4, 0xff, 2, false, target);
+}
+
+void X64Assembler::Push(X64Reg reg)
+{
+	if (Number(reg) >= 8)
+		Emit(0x41);
+	Emit(static_cast<uint8_t>(0x50 + (Number(reg) & 7)));
+}
+
+void X64Assembler::Pop(X64Reg reg)
+{
+	if (Number(reg) >= 8)
+		Emit(0x41);
+	Emit(static_cast<uint8_t>(0x58 + (Number(reg) & 7)));
+}
+
+void X64Assembler::Ret()
+{
+	Emit(0xc3);
+}
+
+std::vector<uint8_t> X64Assembler::Finish()
+{
+	for (auto& fixup : m_fixups)
+	{
+		auto target = static_cast<int32_t>(m_labels[fixup.label] - static_cast<ptrdiff_t>(fixup.offset + 4));
+		std::memcpy(&m_code[fixup.offset], &target, sizeof(target));
+	}
+	m_fixups.clear();
+	return std::move(m_code);
+}
+
+void X64Assembler::Emit(uint8_t byte)
+{
+	m_code.push_back(byte);
+}
+
+void X64Assembler::Emit32(uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		Emit(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+// Byte registers 4 to 7 are SPL, BPL, SIL and DIL only with a REX prefix, AH to BH without one
+void X64Assembler::Rex(int size, int reg, bool byteReg, int index, int base, bool byteBase)
+{
+	if (size == 2)
+		Emit(0x66);
+	int rex = 0x40 | (size == 8 ? 0x08 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+	bool lowByte = (byteReg && reg >= 4 && reg < 8) || (byteBase && base >= 4 && base < 8);
+	if (rex != 0x40 || lowByte)
+		Emit(static_cast<uint8_t>(rex));
+}
+
+void X64Assembler::Encode(int size, uint8_t opcode, int reg, bool byteReg, X64Reg rm)
+{
+	Rex(size, reg, byteReg, 0, Number(rm), size == 1);
+	Emit(opcode);
+	Emit(static_cast<uint8_t>(0xc0 | (reg & 7) << 3 | (Number(rm) & 7)));
+}
+
+void X64Assembler::Encode(int size, uint8_t opcode, int reg, bool byteReg, const X64Mem& rm)
+{
+	Rex(size, reg, byteReg, rm.indexed ? Number(rm.index) : 0, Number(rm.base), false);
+	Emit(opcode);
+	ModRm(reg, rm);
+}
+
+void X64Assembler::Encode2(int size, uint8_t opcode, int reg, bool byteReg, X64Reg rm, bool byteRm)
+{
+	Rex(size, reg, byteReg, 0, Number(rm), byteRm);
+	Emit(0x0f);
+	Emit(opcode);
+	Emit(static_cast<uint8_t>(0xc0 | (reg & 7) << 3 | (Number(rm) & 7)));
+}
+
+void X64Assembler::Encode2(int size, uint8_t opcode, int reg, bool byteReg, const X64Mem& rm)
+{
+	Rex(size, reg, byteReg, rm.indexed ? Number(rm.index) : 0, Number(rm.base), false);
+	Emit(0x0f);
+	Emit(opcode);
+	ModRm(reg, rm);
+}
+
+// RSP and R12 as base need a SIB byte, RBP and R13 as base need a displacement
+void X64Assembler::ModRm(int reg, const X64Mem& rm)
+{
+	int base = Number(rm.base) & 7;
+	int mod = rm.displacement == 0 && base != 5 ? 0 : IsByte(rm.displacement) ? 1 : 2;
+	if (rm.indexed || base == 4)
+	{
+		int scale = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+		Emit(static_cast<uint8_t>(mod << 6 | (reg & 7) << 3 | 4));
+		Emit(static_cast<uint8_t>(scale << 6 | (rm.indexed ? Number(rm.index) & 7 : 4) << 3 | base));
+	}
+	else
+	{
+		Emit(static_cast<uint8_t>(mod << 6 | (reg & 7) << 3 | base));
+	}
+	if (mod == 1)
+		Emit(static_cast<uint8_t>(rm.displacement));
+	else if (mod == 2)
+		Emit32(static_cast<uint32_t>(rm.displacement));
+}
+
+void X64Assembler::Immediate(int size, int32_t value)
+{
+	if (size == 1)
+		Emit(static_cast<uint8_t>(value));
+	else if (size == 2)
+	{
+		Emit(static_cast<uint8_t>(value));
+		Emit(static_cast<uint8_t>(value >> 8));
+	}
+	else
+		Emit32(static_cast<uint32_t>(value));
+}
+
+namespace {
+
+// Code starts at this alignment
+const size_t CodeAlignment = 16;
+
+#if defined(_WIN32)
+
+uint8_t* Allocate(size_t size)
+{
+	return static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READ));
+}
+
+void Free(uint8_t* data, size_t)
+{
+	VirtualFree(data, 0, MEM_RELEASE);
+}
+
+void Protect(uint8_t* data, size_t size, bool writable)
+{
+	DWORD old;
+	if (!VirtualProtect(data, size, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old))
+		throw std::bad_alloc();
+	if (!writable)
+		FlushInstructionCache(GetCurrentProcess(), data, size);
+}
+
+#else
+
+uint8_t* Allocate(size_t size)
+{
+	void* data = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return data != MAP_FAILED ? static_cast<uint8_t*>(data) : nullptr;
+}
+
+void Free(uint8_t* data, size_t size)
+{
+	munmap(data, size);
+}
+
+void Protect(uint8_t* data, size_t size, bool writable)
+{
+	auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	auto first = reinterpret_cast<uintptr_t>(data) & ~(pageSize - 1);
+	auto last = reinterpret_cast<uintptr_t>(data) + size;
+	if (mprotect(reinterpret_cast<void*>(first), last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0)
+		throw std::bad_alloc();
+	if (!writable)
+		__builtin___clear_cache(reinterpret_cast<char*>(data), reinterpret_cast<char*>(data + size));
+}
+
+#endif // _WIN32
+
+} // namespace
+
+ExecutableMemory::ExecutableMemory(size_t size) :
+	m_data(Allocate(size)),
+	m_size(size),
+	m_used(0)
+{
+	if (!m_data)
+		throw std::bad_alloc();
+}
+
+ExecutableMemory::~ExecutableMemory()
+{
+	Free(m_data, m_size);
+}
+
+const uint8_t* ExecutableMemory::Add(const std::vector<uint8_t>& code)
+{
+	if (code.size() > m_size - m_used)
+		return nullptr;
+
+	uint8_t* address = m_data + m_used;
+	Protect(address, code.size(), true);
+	std::memcpy(address, code.data(), code.size());
+	Protect(address, code.size(), false);
+	m_used = (m_used + code.size() + CodeAlignment - 1) & ~(CodeAlignment - 1);
+	if (m_used > m_size)
+		m_used = m_size;
+	return address;
+}
+
+void ExecutableMemory::Clear()
+{
+	m_used = 0;
+}
+
+} // namespace DjeeDjay